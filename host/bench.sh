@@ -0,0 +1,49 @@
+#!/bin/sh
+# Time builds of N generated sources with 1, 2, 4, ... workers up to the
+# core count and report each one's speedup over -j1.
+# usage: ./bench.sh [N]
+set -e
+N=${1:-256}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+cd "$(dirname "$0")"
+make -s ezasm
+
+i=0
+while [ $i -lt "$N" ]; do
+    {
+        echo "start:"
+        j=0
+        while [ $j -lt 60 ]; do
+            echo "l$j:"
+            echo " nop"
+            echo " call l$j"
+            j=$((j + 1))
+        done
+        echo " ret"
+    } > "$DIR/S$i.asm"
+    i=$((i + 1))
+done
+
+# ms of one build, from ezasm's "N built, F failed, MS ms (-jJ)" line
+build_ms() {
+    ./ezasm -j "$1" -o "$DIR" "$DIR"/*.asm 2>&1 > /dev/null | awk '/ built, / { print $5 }'
+}
+
+CORES=${CORES:-$(nproc)} # set CORES to try more workers than cores
+BASE=$(build_ms 1)
+echo "$N sources, $CORES cores"
+echo "jobs      ms  speedup"
+j=1
+while :; do
+    if [ "$j" -eq 1 ]; then
+        MS=$BASE
+    else
+        MS=$(build_ms "$j")
+    fi
+    awk -v j="$j" -v ms="$MS" -v base="$BASE" \
+        'BEGIN { printf "%4d %7d %7.2fx\n", j, ms, (ms > 0 ? base / ms : 0) }'
+    [ "$j" -ge "$CORES" ] && break
+    j=$((j * 2))
+    [ "$j" -gt "$CORES" ] && j=$CORES
+done
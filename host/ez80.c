@@ -0,0 +1,1046 @@
+#include "ez80.h"
+#include <stdio.h>
+#include <string.h>
+
+#define MASK 0xFFFFFF
+#define MEM_SIZE 0x1000000
+
+#define FLAG_C 0x01
+#define FLAG_N 0x02
+#define FLAG_PV 0x04
+#define FLAG_H 0x10
+#define FLAG_Z 0x40
+#define FLAG_S 0x80
+
+Ez80 ez80;
+
+static uint8_t mem[MEM_SIZE];
+static unsigned long start_cycles; // of the instruction running, for timer reads
+static char error[64];
+
+// Register index of the instruction running: 0 hl, 1 ix, 2 iy
+static uint8_t index_mode;
+
+void ez80_reset(void)
+{
+    memset(mem, 0, sizeof(mem));
+    memset(&ez80, 0, sizeof(ez80));
+    ez80.sp = EZ80_STACK;
+    error[0] = '\0';
+}
+
+void ez80_write(uint32_t address, const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        mem[(address + i) & MASK] = data[i];
+}
+
+void ez80_read(uint32_t address, uint8_t *out, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        out[i] = mem[(address + i) & MASK];
+}
+
+// Why the last ez80_call() stopped early, "" if it returned
+const char *ez80_error(void)
+{
+    return error;
+}
+
+// --- Memory: every byte moved costs a cycle ---
+
+static uint8_t rd8(uint32_t address)
+{
+    address &= MASK;
+    ez80.cycles++;
+    if (address >= EZ80_TIMER1 && address < EZ80_TIMER1 + 4)
+        return (uint8_t)(start_cycles >> (8 * (address - EZ80_TIMER1)));
+    return mem[address];
+}
+
+static void wr8(uint32_t address, uint8_t value)
+{
+    ez80.cycles++;
+    mem[address & MASK] = value;
+}
+
+static uint32_t rd24(uint32_t address)
+{
+    uint32_t lo = rd8(address);
+    uint32_t mid = rd8(address + 1);
+    return lo | (mid << 8) | ((uint32_t)rd8(address + 2) << 16);
+}
+
+static void wr24(uint32_t address, uint32_t value)
+{
+    wr8(address, value & 0xFF);
+    wr8(address + 1, (value >> 8) & 0xFF);
+    wr8(address + 2, (value >> 16) & 0xFF);
+}
+
+static uint8_t fetch8(void)
+{
+    uint8_t value = rd8(ez80.pc);
+    ez80.pc = (ez80.pc + 1) & MASK;
+    return value;
+}
+
+static uint32_t fetch24(void)
+{
+    uint32_t value = rd24(ez80.pc);
+    ez80.pc = (ez80.pc + 3) & MASK;
+    return value;
+}
+
+static int8_t fetch_disp(void)
+{
+    return (int8_t)fetch8();
+}
+
+static void push24(uint32_t value)
+{
+    ez80.sp = (ez80.sp - 3) & MASK;
+    wr24(ez80.sp, value);
+}
+
+static uint32_t pop24(void)
+{
+    uint32_t value = rd24(ez80.sp);
+    ez80.sp = (ez80.sp + 3) & MASK;
+    return value;
+}
+
+// --- Registers ---
+
+static uint32_t *index_reg(void)
+{
+    return index_mode == 1 ? &ez80.ix : index_mode == 2 ? &ez80.iy : &ez80.hl;
+}
+
+// rp table: bc, de, hl (or the index register), sp
+static uint32_t *pair(uint8_t p)
+{
+    switch (p)
+    {
+    case 0:
+        return &ez80.bc;
+    case 1:
+        return &ez80.de;
+    case 2:
+        return index_reg();
+    default:
+        return &ez80.sp;
+    }
+}
+
+// 8-bit register r (b c d e h l - a). With plain set, h and l stay h and l
+// even after an index prefix, as next to (ix+d).
+static uint8_t get_r(uint8_t r, bool plain)
+{
+    uint32_t hl = plain ? ez80.hl : *index_reg();
+    switch (r)
+    {
+    case 0:
+        return (ez80.bc >> 8) & 0xFF;
+    case 1:
+        return ez80.bc & 0xFF;
+    case 2:
+        return (ez80.de >> 8) & 0xFF;
+    case 3:
+        return ez80.de & 0xFF;
+    case 4:
+        return (hl >> 8) & 0xFF;
+    case 5:
+        return hl & 0xFF;
+    default:
+        return ez80.a;
+    }
+}
+
+static void set_r(uint8_t r, uint8_t value, bool plain)
+{
+    uint32_t *hl = plain ? &ez80.hl : index_reg();
+    switch (r)
+    {
+    case 0:
+        ez80.bc = (ez80.bc & 0xFF00FF) | (value << 8);
+        break;
+    case 1:
+        ez80.bc = (ez80.bc & 0xFFFF00) | value;
+        break;
+    case 2:
+        ez80.de = (ez80.de & 0xFF00FF) | (value << 8);
+        break;
+    case 3:
+        ez80.de = (ez80.de & 0xFFFF00) | value;
+        break;
+    case 4:
+        *hl = (*hl & 0xFF00FF) | (value << 8);
+        break;
+    case 5:
+        *hl = (*hl & 0xFFFF00) | value;
+        break;
+    default:
+        ez80.a = value;
+        break;
+    }
+}
+
+// Address of (hl), or of (ix+d)/(iy+d) with the displacement fetched
+static uint32_t memory_operand(void)
+{
+    if (index_mode == 0)
+        return ez80.hl;
+    return (*index_reg() + fetch_disp()) & MASK;
+}
+
+// --- Flags ---
+
+static uint8_t parity(uint8_t value)
+{
+    value ^= value >> 4;
+    value ^= value >> 2;
+    value ^= value >> 1;
+    return (value & 1) ? 0 : FLAG_PV;
+}
+
+static uint8_t sign_zero(uint8_t value)
+{
+    return (value & 0x80) | (value == 0 ? FLAG_Z : 0);
+}
+
+static bool condition(uint8_t cc)
+{
+    switch (cc)
+    {
+    case 0:
+        return !(ez80.f & FLAG_Z);
+    case 1:
+        return ez80.f & FLAG_Z;
+    case 2:
+        return !(ez80.f & FLAG_C);
+    case 3:
+        return ez80.f & FLAG_C;
+    case 4:
+        return !(ez80.f & FLAG_PV);
+    case 5:
+        return ez80.f & FLAG_PV;
+    case 6:
+        return !(ez80.f & FLAG_S);
+    default:
+        return ez80.f & FLAG_S;
+    }
+}
+
+// add adc sub sbc and xor or cp
+static void alu(uint8_t op, uint8_t value)
+{
+    uint8_t a = ez80.a;
+    unsigned carry = (op == 1 || op == 3) ? (ez80.f & FLAG_C) : 0;
+    unsigned result;
+    switch (op)
+    {
+    case 0:
+    case 1:
+        result = a + value + carry;
+        ez80.f = sign_zero(result & 0xFF) | ((a ^ value ^ result) & FLAG_H) |
+                 (((a ^ ~value) & (a ^ result) & 0x80) ? FLAG_PV : 0) | (result > 0xFF ? FLAG_C : 0);
+        ez80.a = result & 0xFF;
+        break;
+    case 4:
+        ez80.a &= value;
+        ez80.f = sign_zero(ez80.a) | FLAG_H | parity(ez80.a);
+        break;
+    case 5:
+        ez80.a ^= value;
+        ez80.f = sign_zero(ez80.a) | parity(ez80.a);
+        break;
+    case 6:
+        ez80.a |= value;
+        ez80.f = sign_zero(ez80.a) | parity(ez80.a);
+        break;
+    default: // sub, sbc, cp
+        result = a - value - carry;
+        ez80.f = sign_zero(result & 0xFF) | FLAG_N | ((a ^ value ^ result) & FLAG_H) |
+                 (((a ^ value) & (a ^ result) & 0x80) ? FLAG_PV : 0) | ((result & 0x100) ? FLAG_C : 0);
+        if (op != 7)
+            ez80.a = result & 0xFF;
+        break;
+    }
+}
+
+static uint8_t inc8(uint8_t value)
+{
+    uint8_t result = value + 1;
+    ez80.f = (ez80.f & FLAG_C) | sign_zero(result) | ((value & 0x0F) == 0x0F ? FLAG_H : 0) |
+             (value == 0x7F ? FLAG_PV : 0);
+    return result;
+}
+
+static uint8_t dec8(uint8_t value)
+{
+    uint8_t result = value - 1;
+    ez80.f = (ez80.f & FLAG_C) | FLAG_N | sign_zero(result) | ((value & 0x0F) == 0 ? FLAG_H : 0) |
+             (value == 0x80 ? FLAG_PV : 0);
+    return result;
+}
+
+// CB rotates and shifts: rlc rrc rl rr sla sra - srl
+static bool rotate(uint8_t op, uint8_t *value)
+{
+    uint8_t v = *value;
+    uint8_t carry;
+    switch (op)
+    {
+    case 0:
+        carry = v >> 7;
+        v = (v << 1) | carry;
+        break;
+    case 1:
+        carry = v & 1;
+        v = (v >> 1) | (carry << 7);
+        break;
+    case 2:
+        carry = v >> 7;
+        v = (v << 1) | (ez80.f & FLAG_C);
+        break;
+    case 3:
+        carry = v & 1;
+        v = (v >> 1) | ((ez80.f & FLAG_C) << 7);
+        break;
+    case 4:
+        carry = v >> 7;
+        v <<= 1;
+        break;
+    case 5:
+        carry = v & 1;
+        v = (v >> 1) | (v & 0x80);
+        break;
+    case 7:
+        carry = v & 1;
+        v >>= 1;
+        break;
+    default:
+        return false;
+    }
+    *value = v;
+    ez80.f = sign_zero(v) | parity(v) | carry;
+    return true;
+}
+
+static void add24(uint32_t *dest, uint32_t value)
+{
+    uint32_t result = *dest + value;
+    ez80.f = (ez80.f & (FLAG_S | FLAG_Z | FLAG_PV)) | (((*dest ^ value ^ result) >> 8) & FLAG_H) |
+             (result > MASK ? FLAG_C : 0);
+    *dest = result & MASK;
+}
+
+// adc hl,rr and sbc hl,rr
+static void adc24(uint32_t value, bool subtract)
+{
+    uint32_t hl = ez80.hl;
+    uint32_t carry = ez80.f & FLAG_C;
+    uint32_t result = subtract ? hl - value - carry : hl + value + carry;
+    bool overflow = subtract ? ((hl ^ value) & (hl ^ result) & 0x800000) : ((hl ^ ~value) & (hl ^ result) & 0x800000);
+    ez80.f = ((result & 0x800000) ? FLAG_S : 0) | ((result & MASK) == 0 ? FLAG_Z : 0) |
+             (((hl ^ value ^ result) >> 8) & FLAG_H) | (overflow ? FLAG_PV : 0) | (subtract ? FLAG_N : 0) |
+             ((result >> 24) & 1 ? FLAG_C : 0);
+    ez80.hl = result & MASK;
+}
+
+static void daa(void)
+{
+    uint8_t a = ez80.a;
+    uint8_t fix = 0;
+    uint8_t carry = ez80.f & FLAG_C;
+    if ((ez80.f & FLAG_H) || (a & 0x0F) > 9)
+        fix |= 0x06;
+    if (carry || a > 0x99)
+    {
+        fix |= 0x60;
+        carry = FLAG_C;
+    }
+    uint8_t result = (ez80.f & FLAG_N) ? a - fix : a + fix;
+    ez80.f = sign_zero(result) | parity(result) | (ez80.f & FLAG_N) | ((a ^ result) & FLAG_H) | carry;
+    ez80.a = result;
+}
+
+// --- Control flow: a taken jump refills the pipeline, a return takes two more ---
+
+static void jump(uint32_t target)
+{
+    ez80.pc = target & MASK;
+    ez80.cycles++;
+}
+
+static void call(uint32_t target)
+{
+    push24(ez80.pc);
+    ez80.pc = target & MASK;
+}
+
+static void ret(void)
+{
+    ez80.pc = pop24();
+    ez80.cycles += 2;
+}
+
+static bool unknown(const uint8_t *bytes, uint8_t count, uint32_t at)
+{
+    int n = snprintf(error, sizeof(error), "unknown opcode");
+    for (uint8_t i = 0; i < count && n < (int)sizeof(error); i++)
+        n += snprintf(error + n, sizeof(error) - n, " %02X", bytes[i]);
+    if (n < (int)sizeof(error))
+        snprintf(error + n, sizeof(error) - n, " at %06lX", (unsigned long)at);
+    return false;
+}
+
+// ldi ldd cpi cpd, once or repeated; each round of a repeat costs a cycle
+// more, the last one too, as .assert_cycles counts them
+static void block(uint8_t y, uint8_t z)
+{
+    bool down = y & 1;
+    bool repeat = y & 2;
+    for (;;)
+    {
+        uint8_t value = rd8(ez80.hl);
+        ez80.hl = (ez80.hl + (down ? -1 : 1)) & MASK;
+        ez80.bc = (ez80.bc - 1) & MASK;
+        bool more = ez80.bc != 0;
+        if (z == 0)
+        {
+            wr8(ez80.de, value);
+            ez80.de = (ez80.de + (down ? -1 : 1)) & MASK;
+            ez80.f = (ez80.f & (FLAG_S | FLAG_Z | FLAG_C)) | (more ? FLAG_PV : 0);
+        }
+        else
+        {
+            uint8_t result = ez80.a - value;
+            ez80.f = (ez80.f & FLAG_C) | FLAG_N | sign_zero(result) | ((ez80.a ^ value ^ result) & FLAG_H) |
+                     (more ? FLAG_PV : 0);
+            more = more && result != 0;
+        }
+        if (!repeat)
+            break;
+        ez80.cycles++;
+        if (!more)
+            break;
+    }
+}
+
+static bool step_cb(uint32_t at)
+{
+    uint32_t address = 0;
+    if (index_mode)
+        address = memory_operand();
+    uint8_t op = fetch8();
+    uint8_t x = op >> 6;
+    uint8_t y = (op >> 3) & 7;
+    uint8_t z = op & 7;
+    if (index_mode && z != 6)
+        return unknown((uint8_t[]){index_mode == 1 ? 0xDD : 0xFD, 0xCB, op}, 3, at);
+    bool in_memory = z == 6;
+    if (in_memory && !index_mode)
+        address = ez80.hl;
+    uint8_t value = in_memory ? rd8(address) : get_r(z, true);
+    switch (x)
+    {
+    case 0:
+        if (!rotate(y, &value))
+            return unknown((uint8_t[]){0xCB, op}, 2, at);
+        break;
+    case 1:
+        ez80.f = (ez80.f & FLAG_C) | FLAG_H |
+                 ((value & (1 << y)) ? (y == 7 ? FLAG_S : 0) : FLAG_Z | FLAG_PV);
+        return true;
+    case 2:
+        value &= ~(1 << y);
+        break;
+    default:
+        value |= 1 << y;
+        break;
+    }
+    if (in_memory)
+        wr8(address, value);
+    else
+        set_r(z, value, true);
+    return true;
+}
+
+static bool step_ed(uint32_t at)
+{
+    uint8_t op = fetch8();
+    uint8_t x = op >> 6;
+    uint8_t y = (op >> 3) & 7;
+    uint8_t z = op & 7;
+    uint8_t p = y >> 1;
+    bool q = y & 1;
+    index_mode = 0;
+
+    if (x == 0)
+    {
+        switch (z)
+        {
+        case 0: // in0 r,(n): no ports here, reads 0
+            fetch8();
+            if (y != 6)
+                set_r(y, 0, true);
+            ez80.f = (ez80.f & FLAG_C) | FLAG_Z | FLAG_PV;
+            return true;
+        case 1:
+            if (y == 6) // ld iy,(hl)
+                ez80.iy = rd24(ez80.hl);
+            else // out0 (n),r
+                fetch8();
+            return true;
+        case 2: // lea rr,ix+d; ed 32 is lea ix,ix+d
+        case 3: // lea rr,iy+d; ed 33 is lea iy,iy+d
+        {
+            uint32_t base = z == 2 ? ez80.ix : ez80.iy;
+            uint32_t value = (base + fetch_disp()) & MASK;
+            if (q)
+                break;
+            if (p == 3)
+                *(z == 2 ? &ez80.ix : &ez80.iy) = value;
+            else
+                *pair(p) = value;
+            return true;
+        }
+        case 4: // tst a,r
+        {
+            uint8_t value = ez80.a & (y == 6 ? rd8(ez80.hl) : get_r(y, true));
+            ez80.f = sign_zero(value) | FLAG_H | parity(value);
+            return true;
+        }
+        case 6: // ld (hl),iy
+            if (y == 7)
+            {
+                wr24(ez80.hl, ez80.iy);
+                return true;
+            }
+            break;
+        case 7: // ld rr,(hl) / ld (hl),rr, ix in place of sp
+            if (p == 3 && !q)
+                ez80.ix = rd24(ez80.hl);
+            else if (p == 3)
+                wr24(ez80.hl, ez80.ix);
+            else if (!q)
+                *pair(p) = rd24(ez80.hl);
+            else
+                wr24(ez80.hl, *pair(p));
+            return true;
+        default:
+            break;
+        }
+        return unknown((uint8_t[]){0xED, op}, 2, at);
+    }
+
+    if (x == 1)
+    {
+        switch (z)
+        {
+        case 0: // in r,(c)
+            if (y != 6)
+                set_r(y, 0, true);
+            ez80.f = (ez80.f & FLAG_C) | FLAG_Z | FLAG_PV;
+            return true;
+        case 1: // out (c),r
+            return true;
+        case 2:
+            adc24(*pair(p), !q);
+            return true;
+        case 3:
+        {
+            uint32_t address = fetch24();
+            if (q)
+                *pair(p) = rd24(address);
+            else
+                wr24(address, *pair(p));
+            return true;
+        }
+        case 4:
+            if (q) // mlt rr
+            {
+                uint32_t *rr = pair(p);
+                *rr = ((*rr >> 8) & 0xFF) * (*rr & 0xFF);
+                return true;
+            }
+            switch (p)
+            {
+            case 0: // neg
+            {
+                uint8_t value = ez80.a;
+                ez80.a = 0;
+                alu(2, value);
+                return true;
+            }
+            case 1: // lea iy,ix+d
+                ez80.iy = (ez80.ix + fetch_disp()) & MASK;
+                return true;
+            case 2: // tst a,n
+            {
+                uint8_t value = ez80.a & fetch8();
+                ez80.f = sign_zero(value) | FLAG_H | parity(value);
+                return true;
+            }
+            default: // tstio n
+                fetch8();
+                ez80.f = (ez80.f & FLAG_C) | FLAG_Z | FLAG_H | FLAG_PV;
+                return true;
+            }
+        case 5:
+            switch (y)
+            {
+            case 0: // retn
+            case 1: // reti
+                ret();
+                return true;
+            case 2: // lea ix,iy+d
+                ez80.ix = (ez80.iy + fetch_disp()) & MASK;
+                return true;
+            case 4: // pea ix+d
+                push24((ez80.ix + fetch_disp()) & MASK);
+                return true;
+            case 5: // ld mb,a
+                ez80.mb = ez80.a;
+                return true;
+            case 7: // stmix
+                return true;
+            default:
+                break;
+            }
+            break;
+        case 6:
+            switch (y)
+            {
+            case 0: // im 0
+            case 2: // im 1
+            case 3: // im 2
+                return true;
+            case 4: // pea iy+d
+                push24((ez80.iy + fetch_disp()) & MASK);
+                return true;
+            case 5: // ld a,mb
+                ez80.a = ez80.mb;
+                return true;
+            case 6: // slp
+                snprintf(error, sizeof(error), "slp at %06lX", (unsigned long)at);
+                return false;
+            case 7: // rsmix
+                return true;
+            default:
+                break;
+            }
+            break;
+        default:
+            switch (y)
+            {
+            case 0: // ld i,a
+                ez80.i = ez80.a;
+                return true;
+            case 1: // ld r,a
+                return true;
+            case 2: // ld a,i
+            case 3: // ld a,r
+                ez80.a = y == 2 ? ez80.i : (uint8_t)ez80.cycles;
+                ez80.f = (ez80.f & FLAG_C) | sign_zero(ez80.a);
+                return true;
+            case 4: // rrd
+            case 5: // rld
+            {
+                uint8_t value = rd8(ez80.hl);
+                uint8_t a = ez80.a;
+                if (y == 4)
+                {
+                    ez80.a = (a & 0xF0) | (value & 0x0F);
+                    value = (value >> 4) | (a << 4);
+                }
+                else
+                {
+                    ez80.a = (a & 0xF0) | (value >> 4);
+                    value = (value << 4) | (a & 0x0F);
+                }
+                wr8(ez80.hl, value);
+                ez80.f = (ez80.f & FLAG_C) | sign_zero(ez80.a) | parity(ez80.a);
+                return true;
+            }
+            default:
+                break;
+            }
+            break;
+        }
+        return unknown((uint8_t[]){0xED, op}, 2, at);
+    }
+
+    if (x == 2 && y >= 4 && z <= 1)
+    {
+        block(y - 4, z);
+        return true;
+    }
+    return unknown((uint8_t[]){0xED, op}, 2, at);
+}
+
+// Prefixed loads new on the eZ80: ld rr,(ix+d) and ld (ix+d),rr
+static bool step_index_load(uint8_t op)
+{
+    uint32_t *other = index_mode == 1 ? &ez80.iy : &ez80.ix;
+    uint32_t address = memory_operand();
+    switch (op)
+    {
+    case 0x07:
+    case 0x17:
+        *pair(op >> 4) = rd24(address);
+        return true;
+    case 0x27: // hl itself, not the index register
+        ez80.hl = rd24(address);
+        return true;
+    case 0x37:
+        *index_reg() = rd24(address);
+        return true;
+    case 0x31:
+        *other = rd24(address);
+        return true;
+    case 0x0F:
+    case 0x1F:
+        wr24(address, *pair(op >> 4));
+        return true;
+    case 0x2F:
+        wr24(address, ez80.hl);
+        return true;
+    case 0x3F:
+        wr24(address, *index_reg());
+        return true;
+    default: // 0x3E
+        wr24(address, *other);
+        return true;
+    }
+}
+
+// Run one instruction. False when the run has to stop.
+static bool step(void)
+{
+    uint32_t at = ez80.pc;
+    start_cycles = ez80.cycles;
+    index_mode = 0;
+
+    uint8_t op = fetch8();
+    while (op == 0xDD || op == 0xFD || op == 0x5B)
+    {
+        if (op != 0x5B) // .lil changes nothing in ADL mode
+            index_mode = op == 0xDD ? 1 : 2;
+        op = fetch8();
+    }
+    if (op == 0x40 || op == 0x49 || op == 0x52)
+    {
+        snprintf(error, sizeof(error), "Z80-mode suffix at %06lX", (unsigned long)at);
+        return false;
+    }
+
+    uint8_t x = op >> 6;
+    uint8_t y = (op >> 3) & 7;
+    uint8_t z = op & 7;
+    uint8_t p = y >> 1;
+    bool q = y & 1;
+
+    if (index_mode && (op == 0x07 || op == 0x17 || op == 0x27 || op == 0x37 || op == 0x31 || op == 0x0F ||
+                       op == 0x1F || op == 0x2F || op == 0x3F || op == 0x3E))
+    {
+        return step_index_load(op);
+    }
+
+    if (x == 0)
+    {
+        switch (z)
+        {
+        case 0:
+            if (y == 0) // nop
+                return true;
+            if (y == 1) // ex af,af'
+            {
+                uint8_t a = ez80.a, f = ez80.f;
+                ez80.a = ez80.a2;
+                ez80.f = ez80.f2;
+                ez80.a2 = a;
+                ez80.f2 = f;
+                return true;
+            }
+            {
+                int8_t offset = fetch_disp();
+                bool taken;
+                if (y == 2) // djnz
+                {
+                    uint8_t b = ((ez80.bc >> 8) - 1) & 0xFF;
+                    set_r(0, b, true);
+                    taken = b != 0;
+                }
+                else
+                {
+                    taken = y == 3 || condition(y - 4);
+                }
+                if (taken)
+                    jump(ez80.pc + offset);
+                return true;
+            }
+        case 1:
+            if (q)
+                add24(index_reg(), *pair(p));
+            else
+                *pair(p) = fetch24();
+            return true;
+        case 2:
+        {
+            switch (y)
+            {
+            case 0:
+                wr8(ez80.bc, ez80.a);
+                break;
+            case 1:
+                ez80.a = rd8(ez80.bc);
+                break;
+            case 2:
+                wr8(ez80.de, ez80.a);
+                break;
+            case 3:
+                ez80.a = rd8(ez80.de);
+                break;
+            case 4:
+                wr24(fetch24(), *index_reg());
+                break;
+            case 5:
+                *index_reg() = rd24(fetch24());
+                break;
+            case 6:
+                wr8(fetch24(), ez80.a);
+                break;
+            default:
+                ez80.a = rd8(fetch24());
+                break;
+            }
+            return true;
+        }
+        case 3:
+            *pair(p) = (*pair(p) + (q ? -1 : 1)) & MASK;
+            return true;
+        case 4:
+        case 5:
+        case 6:
+            if (y == 6)
+            {
+                uint32_t address = memory_operand();
+                if (z == 6)
+                    wr8(address, fetch8());
+                else
+                    wr8(address, z == 4 ? inc8(rd8(address)) : dec8(rd8(address)));
+            }
+            else if (z == 6)
+                set_r(y, fetch8(), false);
+            else
+                set_r(y, z == 4 ? inc8(get_r(y, false)) : dec8(get_r(y, false)), false);
+            return true;
+        default:
+        {
+            uint8_t a = ez80.a;
+            uint8_t keep = ez80.f & (FLAG_S | FLAG_Z | FLAG_PV);
+            switch (y)
+            {
+            case 0: // rlca
+                ez80.a = (a << 1) | (a >> 7);
+                ez80.f = keep | (a >> 7);
+                break;
+            case 1: // rrca
+                ez80.a = (a >> 1) | (a << 7);
+                ez80.f = keep | (a & 1);
+                break;
+            case 2: // rla
+                ez80.a = (a << 1) | (ez80.f & FLAG_C);
+                ez80.f = keep | (a >> 7);
+                break;
+            case 3: // rra
+                ez80.a = (a >> 1) | ((ez80.f & FLAG_C) << 7);
+                ez80.f = keep | (a & 1);
+                break;
+            case 4:
+                daa();
+                break;
+            case 5: // cpl
+                ez80.a = ~a;
+                ez80.f |= FLAG_H | FLAG_N;
+                break;
+            case 6: // scf
+                ez80.f = keep | FLAG_C;
+                break;
+            default: // ccf
+                ez80.f = keep | ((ez80.f & FLAG_C) ? FLAG_H : FLAG_C);
+                break;
+            }
+            return true;
+        }
+        }
+    }
+
+    if (x == 1)
+    {
+        if (op == 0x76)
+        {
+            snprintf(error, sizeof(error), "halt at %06lX", (unsigned long)at);
+            return false;
+        }
+        if (y == 6)
+            wr8(memory_operand(), get_r(z, true));
+        else if (z == 6)
+            set_r(y, rd8(memory_operand()), true);
+        else
+            set_r(y, get_r(z, false), false);
+        return true;
+    }
+
+    if (x == 2)
+    {
+        alu(y, z == 6 ? rd8(memory_operand()) : get_r(z, false));
+        return true;
+    }
+
+    switch (z)
+    {
+    case 0: // ret cc
+        if (condition(y))
+            ret();
+        else
+            ez80.cycles++;
+        return true;
+    case 1:
+        if (!q)
+        {
+            uint32_t value = pop24();
+            if (p == 3)
+            {
+                ez80.f = value & 0xFF;
+                ez80.a = (value >> 8) & 0xFF;
+            }
+            else
+                *pair(p) = value;
+            return true;
+        }
+        switch (p)
+        {
+        case 0:
+            ret();
+            return true;
+        case 1: // exx
+        {
+            uint32_t bc = ez80.bc, de = ez80.de, hl = ez80.hl;
+            ez80.bc = ez80.bc2;
+            ez80.de = ez80.de2;
+            ez80.hl = ez80.hl2;
+            ez80.bc2 = bc;
+            ez80.de2 = de;
+            ez80.hl2 = hl;
+            return true;
+        }
+        case 2: // jp (hl)
+            jump(*index_reg());
+            return true;
+        default: // ld sp,hl
+            ez80.sp = *index_reg();
+            return true;
+        }
+    case 2:
+    {
+        uint32_t target = fetch24();
+        if (condition(y))
+            jump(target);
+        return true;
+    }
+    case 3:
+        switch (y)
+        {
+        case 0:
+            jump(fetch24());
+            return true;
+        case 1:
+            return step_cb(at);
+        case 2: // out (n),a
+            fetch8();
+            return true;
+        case 3: // in a,(n)
+            fetch8();
+            ez80.a = 0;
+            return true;
+        case 4: // ex (sp),hl
+        {
+            uint32_t value = rd24(ez80.sp);
+            wr24(ez80.sp, *index_reg());
+            *index_reg() = value;
+            return true;
+        }
+        case 5: // ex de,hl
+        {
+            uint32_t de = ez80.de;
+            ez80.de = ez80.hl;
+            ez80.hl = de;
+            return true;
+        }
+        default: // di, ei
+            return true;
+        }
+    case 4:
+    {
+        uint32_t target = fetch24();
+        if (condition(y))
+            call(target);
+        return true;
+    }
+    case 5:
+        if (!q)
+        {
+            push24(p == 3 ? ((uint32_t)ez80.a << 8) | ez80.f : *pair(p));
+            return true;
+        }
+        if (p == 0)
+        {
+            call(fetch24());
+            return true;
+        }
+        if (p == 2)
+            return step_ed(at);
+        break;
+    case 6:
+        alu(y, fetch8());
+        return true;
+    default: // rst
+        call(y * 8);
+        return true;
+    }
+    return unknown(&op, 1, at);
+}
+
+// Call the code at address with the registers as they are set, until it
+// returns. False if it does something the stand-in cannot run or is still
+// going after max_cycles; ez80_error() says which.
+bool ez80_call(uint32_t address, unsigned long max_cycles)
+{
+    unsigned long limit = ez80.cycles + max_cycles;
+    error[0] = '\0';
+    push24(EZ80_EXIT);
+    ez80.cycles -= 3; // the return address is the caller's work, not the routine's
+    ez80.pc = address & MASK;
+    while (ez80.pc != EZ80_EXIT)
+    {
+        if (ez80.pc < EZ80_OS_END)
+        {
+            // an OS call: return straight away, costing nothing more
+            ez80.pc = mem[ez80.sp] | (mem[(ez80.sp + 1) & MASK] << 8) | ((uint32_t)mem[(ez80.sp + 2) & MASK] << 16);
+            ez80.sp = (ez80.sp + 3) & MASK;
+            continue;
+        }
+        if (ez80.cycles > limit)
+        {
+            snprintf(error, sizeof(error), "still running after %lu cycles", max_cycles);
+            return false;
+        }
+        if (!step())
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,37 @@
+#ifndef EZ80_H
+#define EZ80_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// eZ80 stand-in that runs built programs on the host. ADL mode only: the
+// registers and addresses are 24 bits, and Z80-mode code (MBASE, .sis and
+// the other suffixes but .lil) stops the run. Cycles follow the zero wait
+// state model of .assert_cycles, and timer 1 counts them, so a .bench
+// harness measures the same way. A call into the OS (below EZ80_OS_END)
+// returns at once; nothing it would do happens.
+#define EZ80_STACK 0xD1A87E  // SPL when a program starts
+#define EZ80_EXIT 0xFFFFFF   // return address ez80_call() pushes
+#define EZ80_OS_END 0x400000 // boot code, OS and flash
+#define EZ80_TIMER1 0xF20000 // counter, read-only here
+
+typedef struct
+{
+    uint8_t a, f;
+    uint32_t bc, de, hl, ix, iy, sp, pc;
+    uint8_t a2, f2; // shadow registers
+    uint32_t bc2, de2, hl2;
+    uint8_t i, mb;
+    unsigned long cycles;
+} Ez80;
+
+extern Ez80 ez80;
+
+void ez80_reset(void);
+void ez80_write(uint32_t address, const uint8_t *data, size_t size);
+void ez80_read(uint32_t address, uint8_t *out, size_t size);
+bool ez80_call(uint32_t address, unsigned long max_cycles);
+const char *ez80_error(void);
+
+#endif
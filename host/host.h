@@ -0,0 +1,13 @@
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HOST_RUN_CYCLES 200000000UL // a run still going after this is stopped
+
+void host_add_search_dir(const char *dir);
+int host_run(uint8_t *image, size_t size, uint24_t origin);
+int host_check_runtime(void);
+
+#endif
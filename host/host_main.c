@@ -0,0 +1,312 @@
+// ezasm host command line: assemble many sources at once on a PC.
+//
+//   ezasm [-j N] [-o DIR] [-I DIR] [-r] [--flag ...] FILE...
+//   ezasm -w ADDRESS MAPFILE
+//   ezasm -u PACKED OUT
+//   ezasm -d FILE [ORIGIN]
+//   ezasm -t
+//   ezasm [-I DIR] --index=LIB_NAME
+//   ezasm -k
+//
+// The assembler core keeps its per-build state (labels, lines, code buffer)
+// in globals, so each source is built in its own forked worker process and
+// up to N workers run at the same time. Output goes to DIR/NAME.bin, its
+// source map to DIR/NAME.map and its symbols, as text, to DIR/NAME.sym,
+// where NAME is the source file name without its extension. -r runs each
+// program after building it in the eZ80 stand-in (ez80.c) and saves what
+// --profile counted, as the calculator does after a launch. -w looks up
+// the source line of an address in a map. -u unpacks a program built with
+// --compress, as its stub would, to check it against an uncompressed build.
+// -d disassembles an output (unpacking it first if needed); -t encodes and
+// decodes every instruction table entry and lists the ones that disagree.
+// --index writes a library's index (LIB_NAME, found like an include, to
+// IDX_NAME in the current directory) instead of building.
+// -k builds and runs every runtime library routine against C (rtcheck.c).
+
+#include "host.h"
+#include "../src/assembler.h"
+#include "../src/console.h"
+#include "../src/options.h"
+#include "../src/pack.h"
+#include "../src/linker.h"
+#include "../src/disasm.h"
+#include "../src/srcmap.h"
+#include "../src/symmap.h"
+#include "../src/profile.h"
+#include "../src/libindex.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define LOG_SIZE 4096
+
+static void usage(void)
+{
+    fputs("usage: ezasm [-j N] [-o DIR] [-I DIR] [-r] [--flag ...] FILE...\n"
+          "       ezasm -w ADDRESS MAPFILE\n"
+          "       ezasm -u PACKED OUT\n"
+          "       ezasm -d FILE [ORIGIN]\n"
+          "       ezasm -t\n"
+          "       ezasm [-I DIR] --index=LIB_NAME\n"
+          "       ezasm -k\n",
+          stderr);
+    exit(2);
+}
+
+// Build one source in a worker. Messages are collected and printed in one
+// write so lines from parallel jobs do not interleave.
+static int build_one(const char *src, const char *outdir, bool run)
+{
+    const char *base = strrchr(src, '/');
+    base = base ? base + 1 : src;
+    char name[256];
+    snprintf(name, sizeof(name), "%s", base);
+    char *dot = strrchr(name, '.');
+    if (dot)
+        *dot = '\0';
+    char out[512];
+    char map[512];
+    char sym[512];
+    snprintf(out, sizeof(out), "%s/%s.bin", outdir, name);
+    snprintf(map, sizeof(map), "%s/%s.map", outdir, name);
+    snprintf(sym, sizeof(sym), "%s/%s.sym", outdir, name);
+
+    char log[LOG_SIZE];
+    console_capture(log, sizeof(log));
+    if (build_options.profile)
+        profile_report(PROFILE_APPVAR);
+    bool ok = assemble_file(src, out);
+    if (ok)
+    {
+        srcmap_save(map);
+        symmap_save_text(sym);
+    }
+    if (ok && run)
+        ok = run_program();
+    console_capture(NULL, 0);
+
+    char report[LOG_SIZE + 512];
+    size_t used = 0;
+    for (char *line = strtok(log, "\n"); line; line = strtok(NULL, "\n"))
+    {
+        used += snprintf(report + used, sizeof(report) - used, "%s: %s\n", src, line);
+        if (used >= sizeof(report))
+            break;
+    }
+    if (used < sizeof(report))
+        snprintf(report + used, sizeof(report) - used, "%s: %s\n", src, ok ? out : "FAILED");
+    fputs(report, stdout);
+    fflush(stdout);
+    return ok ? 0 : 1;
+}
+
+// -w: print FILE:LINE for an address (any base strtoul accepts)
+static int where(const char *address, const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        perror(path);
+        return 1;
+    }
+    static uint8_t map[65536];
+    size_t size = fread(map, 1, sizeof(map), f);
+    fclose(f);
+
+    uint8_t file;
+    uint16_t line;
+    if (!srcmap_lookup(map, size, (uint24_t)strtoul(address, NULL, 0), &file, &line))
+    {
+        fprintf(stderr, "%s: not in %s\n", address, path);
+        return 1;
+    }
+    char name[SRCMAP_NAME_LEN + 1];
+    srcmap_file_name(map, file, name);
+    printf("%s:%u\n", name, (unsigned)line);
+    return 0;
+}
+
+// -u: unpack a compressed program and print the ratio
+static int unpack(const char *path, const char *out)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        perror(path);
+        return 1;
+    }
+    static uint8_t program[65536];
+    static uint8_t image[CODE_MAX_SIZE];
+    size_t size = fread(program, 1, sizeof(program), f);
+    fclose(f);
+
+    const uint8_t *body = program;
+    if (size >= 2 && program[0] == 0xEF && program[1] == 0x7B)
+    {
+        body += 2;
+        size -= 2;
+    }
+    size_t n = pack_unpack(body, size, image, sizeof(image));
+    if (!n)
+    {
+        fprintf(stderr, "%s: not a packed program\n", path);
+        return 1;
+    }
+    f = fopen(out, "wb");
+    if (!f || fwrite(image, 1, n, f) != n)
+    {
+        perror(out);
+        return 1;
+    }
+    fclose(f);
+    printf("%zu -> %zu bytes (%u%%)\n", size, n, (unsigned)(size * 100 / n));
+    return 0;
+}
+
+// -d: print the disassembly of an output. Programs run at userMem, raw
+// images at ORIGIN (default 0).
+static int disassemble(const char *path, const char *origin_arg)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        perror(path);
+        return 1;
+    }
+    static uint8_t program[65536];
+    static uint8_t image[CODE_MAX_SIZE];
+    size_t size = fread(program, 1, sizeof(program), f);
+    fclose(f);
+
+    const uint8_t *code = program;
+    uint24_t base = origin_arg ? (uint24_t)strtoul(origin_arg, NULL, 0) : 0;
+    if (size >= 2 && program[0] == 0xEF && program[1] == 0x7B)
+    {
+        code += 2;
+        size -= 2;
+        base = USER_MEM;
+        if (pack_detect(code, size))
+        {
+            size = pack_unpack(code, size, image, sizeof(image));
+            code = image;
+        }
+    }
+    char text[64];
+    for (size_t offset = 0; offset < size;)
+    {
+        uint8_t used = disasm_line(code + offset, size - offset, base + offset, true, text, sizeof(text));
+        printf("%06lX ", (unsigned long)(base + offset));
+        for (uint8_t i = 0; i < 6; i++)
+            printf(i < used ? "%02X" : "  ", code[offset + i]);
+        printf(" %s\n", text);
+        offset += used;
+    }
+    return 0;
+}
+
+static void report_entry(const Instruction *entry, const Instruction *decoded)
+{
+    printf("%-16s", entry->mnemonic);
+    for (uint8_t i = 0; i < entry->length; i++)
+        printf(" %02X", entry->opcode[i]);
+    printf(" -> %s\n", decoded ? decoded->mnemonic : "(unknown)");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 4 && strcmp(argv[1], "-w") == 0)
+        return where(argv[2], argv[3]);
+    if (argc == 4 && strcmp(argv[1], "-u") == 0)
+        return unpack(argv[2], argv[3]);
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "-d") == 0)
+        return disassemble(argv[2], argc == 4 ? argv[3] : NULL);
+    if (argc == 2 && strcmp(argv[1], "-t") == 0)
+    {
+        uint16_t bad = disasm_check_table(report_entry);
+        printf("%u of %u entries do not round-trip\n", (unsigned)bad, (unsigned)INSTRUCTION_COUNT);
+        return bad ? 1 : 0;
+    }
+    if (argc == 2 && strcmp(argv[1], "-k") == 0)
+        return host_check_runtime();
+
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *outdir = ".";
+    bool run = false;
+    int first_file = argc;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            jobs = strtol(argv[++i], NULL, 10);
+        else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2])
+            jobs = strtol(argv[i] + 2, NULL, 10);
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            outdir = argv[++i];
+        else if (strcmp(argv[i], "-I") == 0 && i + 1 < argc)
+            host_add_search_dir(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0)
+            run = true;
+        else if (strncmp(argv[i], "--", 2) == 0)
+        {
+            if (!options_parse_arg(argv[i]))
+            {
+                fprintf(stderr, "ezasm: unknown option %s\n", argv[i]);
+                usage();
+            }
+        }
+        else
+        {
+            first_file = i;
+            break;
+        }
+    }
+    // --index=LIB_NAME: tool mode, as on the calculator
+    if (build_options.index_lib[0])
+    {
+        if (first_file < argc)
+            usage();
+        return libindex_build(build_options.index_lib) ? 0 : 1;
+    }
+    if (first_file >= argc)
+        usage();
+    if (jobs < 1)
+        jobs = 1;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int failed = 0;
+    long running = 0;
+    for (int i = first_file; i < argc || running > 0;)
+    {
+        if (i < argc && running < jobs)
+        {
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid < 0)
+            {
+                perror("ezasm: fork");
+                return 1;
+            }
+            if (pid == 0)
+                _exit(build_one(argv[i], outdir, run));
+            running++;
+            i++;
+            continue;
+        }
+        int status;
+        if (wait(&status) < 0)
+            break;
+        running--;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    fprintf(stderr, "%d built, %d failed, %ld ms (-j%ld)\n", argc - first_file - failed, failed, ms, jobs);
+    return failed ? 1 : 0;
+}
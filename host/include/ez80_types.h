@@ -0,0 +1,10 @@
+#ifndef EZ80_TYPES_H
+#define EZ80_TYPES_H
+
+#include <stdint.h>
+
+// The CE toolchain's stdint.h provides 24-bit integers; the host widens them
+typedef uint32_t uint24_t;
+typedef int32_t int24_t;
+
+#endif
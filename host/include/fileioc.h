@@ -0,0 +1,27 @@
+#ifndef HOST_FILEIOC_H
+#define HOST_FILEIOC_H
+
+// Host stand-in for the CE toolchain's fileioc.h: variables are files
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint8_t ti_var_t;
+
+#define TI_PRGM_TYPE 0x05
+#define TI_PPRGM_TYPE 0x06
+#define TI_APPVAR_TYPE 0x15
+
+ti_var_t ti_Open(const char *name, const char *mode);
+ti_var_t ti_OpenVar(const char *name, const char *mode, uint8_t type);
+int ti_Close(ti_var_t slot);
+size_t ti_Read(void *data, size_t size, size_t count, ti_var_t slot);
+size_t ti_Write(const void *data, size_t size, size_t count, ti_var_t slot);
+int ti_Delete(const char *name);
+int ti_DeleteVar(const char *name, uint8_t type);
+int ti_SetArchiveStatus(bool archived, ti_var_t slot);
+void *ti_GetDataPtr(ti_var_t slot);
+uint16_t ti_GetSize(ti_var_t slot);
+
+#endif
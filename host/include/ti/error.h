@@ -0,0 +1,6 @@
+#ifndef HOST_TI_ERROR_H
+#define HOST_TI_ERROR_H
+
+#define OS_E_MEMORY 0x8E
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef HOST_TICE_H
+#define HOST_TICE_H
+
+// Host stand-in for the subset of the CE toolchain's tice.h the assembler uses
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <strings.h>
+
+#define sk_1 0x22
+#define sk_2 0x1A
+#define sk_3 0x12
+#define sk_4 0x23
+#define sk_Clear 0x0F
+
+void os_PutStrFull(const char *string);
+void os_NewLine(void);
+void os_ClrHome(void);
+uint8_t os_GetCSC(void);
+void os_ThrowError(uint8_t error);
+size_t os_MemChk(void **free);
+void delay(uint16_t msec);
+
+#endif
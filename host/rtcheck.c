@@ -0,0 +1,480 @@
+// -k: check the runtime library. Each routine is built the way a program
+// gets it, spliced in behind a one-line caller, then run in the eZ80
+// stand-in on edge and random inputs and compared against C. Cycles are
+// held to the counts documented in runtime.c.
+
+#include "host.h"
+#include "ez80.h"
+#include "../src/assembler.h"
+#include "../src/console.h"
+#include "../src/linker.h"
+#include "../src/runtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define CHECK_CASES 2000
+#define CHECK_CYCLES 100000UL // a routine still going after this is stuck
+#define REGION 0xD40000       // scratch RAM the block routines work in
+#define REGION_SIZE 1024
+#define BLOCK_MAX 300         // longest block or string tried
+#define LOG_SIZE 4096
+
+static const uint32_t edges[] = {
+    0, 1, 2, 3, 0x7F, 0x80, 0xFF, 0x100, 0x7FFF, 0x8000, 0xFFFF, 0x10000,
+    0x7FFFFF, 0x800000, 0xFFFFFE, 0xFFFFFF,
+};
+#define EDGE_COUNT (sizeof(edges) / sizeof(edges[0]))
+
+static uint32_t seed = 0x2545F491;
+static const char *routine; // name of the routine under test
+static char inputs[96];     // registers of the case under test
+static unsigned long fewest, most;
+
+static uint32_t rnd(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+// Operand for case n: the edges first, then random values of random width
+// so small divisors and short products come up as often as large ones
+static uint32_t operand(int n, int shift)
+{
+    if ((size_t)n < EDGE_COUNT)
+        return edges[(n + shift) % EDGE_COUNT];
+    return rnd() & (0xFFFFFFu >> (rnd() % 24));
+}
+
+// Block or string length for case n: the shortest ones first, then random
+static uint32_t block_size(int n)
+{
+    return n < 4 ? (uint32_t)n : rnd() % BLOCK_MAX;
+}
+
+static bool failed(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    printf("%s: %s: ", routine, inputs);
+    vprintf(format, args);
+    putchar('\n');
+    va_end(args);
+    return false;
+}
+
+// Run the routine at address from a fresh stack and check its cycle count
+static bool call(uint32_t address, unsigned long low, unsigned long high)
+{
+    ez80.sp = EZ80_STACK;
+    unsigned long start = ez80.cycles;
+    if (!ez80_call(address, CHECK_CYCLES))
+        return failed("stopped: %s", ez80_error());
+    unsigned long used = ez80.cycles - start;
+    if (used < fewest)
+        fewest = used;
+    if (used > most)
+        most = used;
+    if (used < low || used > high)
+        return failed("%lu cycles, documented %lu-%lu", used, low, high);
+    return true;
+}
+
+// The block routines get the whole region filled with noise, and the C
+// version of each works on a copy, so a stray write anywhere shows up
+static uint8_t before[REGION_SIZE];
+static uint8_t expected[REGION_SIZE];
+
+static void fill_region(void)
+{
+    for (int i = 0; i < REGION_SIZE; i++)
+        before[i] = rnd() % 255 + 1; // no terminators in the noise
+    ez80_write(REGION, before, REGION_SIZE);
+    memcpy(expected, before, REGION_SIZE);
+}
+
+static bool region_matches(void)
+{
+    uint8_t after[REGION_SIZE];
+    ez80_read(REGION, after, REGION_SIZE);
+    for (int i = 0; i < REGION_SIZE; i++)
+    {
+        if (after[i] != expected[i])
+            return failed("byte %06X is %02X, expected %02X", REGION + i, after[i], expected[i]);
+    }
+    return true;
+}
+
+static bool check_mul8(uint32_t address)
+{
+    for (int n = 0; n < CHECK_CASES; n++)
+    {
+        uint8_t a = operand(n, 0);
+        uint32_t de = operand(n, 5);
+        uint32_t bc = rnd() & 0xFFFFFF;
+        snprintf(inputs, sizeof(inputs), "a=%02X de=%06X", a, de);
+        ez80.a = a;
+        ez80.de = de;
+        ez80.bc = bc;
+        if (!call(address, 14, 14))
+            return false;
+        uint32_t want = a * (de & 0xFF);
+        if (ez80.hl != want)
+            return failed("hl=%06X, expected %06X", ez80.hl, want);
+        if (ez80.de != de || ez80.bc != bc)
+            return failed("bc or de changed");
+    }
+    return true;
+}
+
+static bool check_mul16(uint32_t address)
+{
+    for (int n = 0; n < CHECK_CASES; n++)
+    {
+        uint32_t hl = operand(n, 0);
+        uint32_t de = operand(n, 7);
+        uint32_t bc = rnd() & 0xFFFFFF;
+        snprintf(inputs, sizeof(inputs), "hl=%06X de=%06X", hl, de);
+        ez80.hl = hl;
+        ez80.de = de;
+        ez80.bc = bc;
+        if (!call(address, 35, 35))
+            return false;
+        uint32_t want = (hl * de) & 0xFFFF;
+        if (ez80.hl != want)
+            return failed("hl=%06X, expected %06X", ez80.hl, want);
+        if (ez80.de != de || ez80.bc != bc)
+            return failed("bc or de changed");
+    }
+    return true;
+}
+
+static bool check_mul24(uint32_t address)
+{
+    for (int n = 0; n < CHECK_CASES; n++)
+    {
+        uint32_t hl = operand(n, 0);
+        uint32_t de = operand(n, 3);
+        uint32_t bc = rnd() & 0xFFFFFF;
+        uint32_t ix = rnd() & 0xFFFFFF;
+        snprintf(inputs, sizeof(inputs), "hl=%06X de=%06X", hl, de);
+        ez80.hl = hl;
+        ez80.de = de;
+        ez80.bc = bc;
+        ez80.ix = ix;
+        if (!call(address, 141, 141))
+            return false;
+        uint32_t want = (uint32_t)((unsigned long long)hl * de & 0xFFFFFF);
+        if (ez80.hl != want)
+            return failed("hl=%06X, expected %06X", ez80.hl, want);
+        if (ez80.de != de || ez80.bc != bc || ez80.ix != ix)
+            return failed("bc, de or ix changed");
+    }
+    return true;
+}
+
+static bool check_divu24(uint32_t address)
+{
+    for (int n = 0; n < CHECK_CASES; n++)
+    {
+        uint32_t hl = operand(n, 0);
+        uint32_t de = operand(n, 9);
+        uint32_t bc = rnd() & 0xFFFFFF;
+        snprintf(inputs, sizeof(inputs), "hl=%06X de=%06X", hl, de);
+        ez80.hl = hl;
+        ez80.de = de;
+        ez80.bc = bc;
+        if (!call(address, 412, 508))
+            return false;
+        if (de == 0)
+        {
+            if (ez80.hl != 0xFFFFFF)
+                return failed("hl=%06X, expected FFFFFF", ez80.hl);
+        }
+        else if (ez80.hl != hl / de || ez80.de != hl % de)
+            return failed("hl=%06X de=%06X, expected %06X %06X", ez80.hl, ez80.de, hl / de, hl % de);
+        if (ez80.bc != bc)
+            return failed("bc changed");
+    }
+    return true;
+}
+
+static bool check_memset(uint32_t address)
+{
+    for (int n = 0; n < CHECK_CASES; n++)
+    {
+        uint32_t size = block_size(n);
+        uint32_t at = rnd() % (REGION_SIZE - size);
+        uint8_t a = rnd();
+        snprintf(inputs, sizeof(inputs), "hl=%06X bc=%06X a=%02X", REGION + at, size, a);
+        fill_region();
+        memset(expected + at, a, size);
+        ez80.hl = REGION + at;
+        ez80.bc = size;
+        ez80.a = a;
+        if (!call(address, size ? 0 : 19, size ? 47 + 3 * size : 19) || !region_matches())
+            return false;
+    }
+    return true;
+}
+
+static bool check_memcpy(uint32_t address)
+{
+    for (int n = 0; n < CHECK_CASES; n++)
+    {
+        uint32_t size = block_size(n);
+        uint32_t half = REGION_SIZE / 2;
+        uint32_t from = rnd() % (half - size);
+        uint32_t to = half + rnd() % (half - size);
+        if (rnd() & 1)
+        {
+            uint32_t swap = from;
+            from = to;
+            to = swap;
+        }
+        snprintf(inputs, sizeof(inputs), "hl=%06X de=%06X bc=%06X", REGION + from, REGION + to, size);
+        fill_region();
+        memcpy(expected + to, expected + from, size);
+        ez80.hl = REGION + from;
+        ez80.de = REGION + to;
+        ez80.bc = size;
+        if (!call(address, size ? 0 : 19, size ? 23 + 3 * size : 19) || !region_matches())
+            return false;
+    }
+    return true;
+}
+
+static bool check_memmove(uint32_t address)
+{
+    for (int n = 0; n < CHECK_CASES; n++)
+    {
+        uint32_t size = block_size(n);
+        uint32_t from = rnd() % (REGION_SIZE - size);
+        // overlapping both ways most of the time
+        uint32_t to = n & 1 ? rnd() % (REGION_SIZE - size) : from + rnd() % (2 * size + 1) - size;
+        if (to > REGION_SIZE - size)
+            to = from;
+        snprintf(inputs, sizeof(inputs), "hl=%06X de=%06X bc=%06X", REGION + from, REGION + to, size);
+        fill_region();
+        memmove(expected + to, expected + from, size);
+        ez80.hl = REGION + from;
+        ez80.de = REGION + to;
+        ez80.bc = size;
+        if (!call(address, 0, 43 + 3 * size) || !region_matches())
+            return false;
+    }
+    return true;
+}
+
+// Put a terminator after length characters of noise at offset
+static void terminate(uint32_t at, uint32_t length)
+{
+    uint8_t zero = 0;
+    ez80_write(REGION + at + length, &zero, 1);
+    expected[at + length] = 0;
+}
+
+static bool check_strlen(uint32_t address)
+{
+    for (int n = 0; n < CHECK_CASES; n++)
+    {
+        uint32_t length = block_size(n);
+        uint32_t at = rnd() % (REGION_SIZE - length);
+        snprintf(inputs, sizeof(inputs), "hl=%06X length %u", REGION + at, (unsigned)length);
+        fill_region();
+        terminate(at, length);
+        ez80.hl = REGION + at;
+        ez80.a = rnd();
+        if (!call(address, 37 + 2 * length, 37 + 2 * length) || !region_matches())
+            return false;
+        if (ez80.bc != length || ez80.a != 0 || ez80.hl != REGION + at)
+            return failed("bc=%06X a=%02X hl=%06X, expected %06X 00 %06X", ez80.bc, ez80.a, ez80.hl, length, REGION + at);
+    }
+    return true;
+}
+
+static bool check_strcpy(uint32_t address)
+{
+    for (int n = 0; n < CHECK_CASES; n++)
+    {
+        uint32_t length = block_size(n);
+        uint32_t half = REGION_SIZE / 2;
+        uint32_t from = rnd() % (half - length - 1);
+        uint32_t to = half + rnd() % (half - length - 1);
+        snprintf(inputs, sizeof(inputs), "hl=%06X de=%06X length %u", REGION + from, REGION + to, (unsigned)length);
+        fill_region();
+        terminate(from, length);
+        memcpy(expected + to, expected + from, length + 1);
+        ez80.hl = REGION + from;
+        ez80.de = REGION + to;
+        if (!call(address, 15 + 10 * length, 15 + 10 * length) || !region_matches())
+            return false;
+        if (ez80.hl != REGION + from + length + 1 || ez80.de != REGION + to + length + 1 || ez80.a != 0)
+            return failed("hl=%06X de=%06X a=%02X after the copy", ez80.hl, ez80.de, ez80.a);
+    }
+    return true;
+}
+
+static bool check_strcmp(uint32_t address)
+{
+    for (int n = 0; n < CHECK_CASES; n++)
+    {
+        // a shared prefix, then (most of the time) a first difference or
+        // one string ending early
+        uint32_t same = block_size(n);
+        uint32_t half = REGION_SIZE / 2;
+        uint32_t left = rnd() % (half - same - 2);
+        uint32_t right = half + rnd() % (half - same - 2);
+        fill_region();
+        memcpy(expected + right, expected + left, same);
+        switch (rnd() % 4)
+        {
+        case 0: // equal
+            expected[left + same] = expected[right + same] = 0;
+            break;
+        case 1: // one ends first
+            expected[(rnd() & 1 ? left : right) + same] = 0;
+            break;
+        default: // differ, terminated or not after that
+            expected[right + same] = expected[left + same] + 1 + rnd() % 254;
+            if (expected[right + same] == 0)
+                expected[right + same] = 1;
+            break;
+        }
+        ez80_write(REGION, expected, REGION_SIZE);
+        int order = strcmp((const char *)expected + left, (const char *)expected + right);
+        snprintf(inputs, sizeof(inputs), "hl=%06X de=%06X prefix %u", REGION + left, REGION + right, (unsigned)same);
+        ez80.hl = REGION + left;
+        ez80.de = REGION + right;
+        if (!call(address, 12 + 16 * same, 15 + 16 * same) || !region_matches())
+            return false;
+        bool zero = ez80.f & 0x40;
+        bool carry = ez80.f & 0x01;
+        if (zero != (order == 0) || (order != 0 && carry != (order < 0)))
+            return failed("z=%d c=%d, expected %s", zero, carry, order == 0 ? "equal" : order < 0 ? "below" : "above");
+        if (ez80.hl != REGION + left + same || ez80.de != REGION + right + same)
+            return failed("hl=%06X de=%06X, expected them at the first difference", ez80.hl, ez80.de);
+    }
+    return true;
+}
+
+static const struct
+{
+    const char *name;
+    bool (*check)(uint32_t address);
+} checks[] = {
+    {"__mul8", check_mul8},
+    {"__mul16", check_mul16},
+    {"__mul24", check_mul24},
+    {"__divu24", check_divu24},
+    {"__memset", check_memset},
+    {"__memcpy", check_memcpy},
+    {"__memmove", check_memmove},
+    {"__strlen", check_strlen},
+    {"__strcpy", check_strcpy},
+    {"__strcmp", check_strcmp},
+};
+#define CHECK_COUNT (sizeof(checks) / sizeof(checks[0]))
+
+// Build "call NAME" in dir and test the routine it pulled in. Runs in a
+// worker, as the core's build state is global.
+static int check_one(uint8_t r, const char *dir)
+{
+    routine = runtime_name(r);
+    snprintf(inputs, sizeof(inputs), "build");
+    bool (*check)(uint32_t) = NULL;
+    for (size_t i = 0; i < CHECK_COUNT; i++)
+    {
+        if (strcmp(checks[i].name, routine) == 0)
+            check = checks[i].check;
+    }
+    if (!check)
+        {
+            failed("no check for this routine");
+            return 1;
+        }
+
+    char src[512];
+    char out[512];
+    snprintf(src, sizeof(src), "%s/%s.asm", dir, routine);
+    snprintf(out, sizeof(out), "%s/%s.bin", dir, routine);
+    FILE *f = fopen(src, "w");
+    if (!f)
+    {
+        perror(src);
+        return 1;
+    }
+    fprintf(f, "main:\n    call %s\n    ret\n", routine);
+    fclose(f);
+
+    char log[LOG_SIZE];
+    console_capture(log, sizeof(log));
+    bool ok = assemble_file(src, out);
+    console_capture(NULL, 0);
+    remove(src);
+    remove(out);
+    if (!ok)
+    {
+        fputs(log, stdout);
+        {
+            failed("does not assemble");
+            return 1;
+        }
+    }
+    // main's call holds the address the routine landed at
+    const uint8_t *image = linker_image();
+    if (linker_size() < 4 || image[0] != 0xCD)
+        {
+            failed("caller not at the origin");
+            return 1;
+        }
+    uint32_t address = image[1] | (image[2] << 8) | ((uint32_t)image[3] << 16);
+
+    ez80_reset();
+    ez80_write(linker_origin(), image, linker_size());
+    fewest = (unsigned long)-1;
+    most = 0;
+    if (!check(address))
+        return 1;
+    printf("%-10s ok, %d cases, %lu-%lu cycles\n", routine, CHECK_CASES, fewest, most);
+    return 0;
+}
+
+int host_check_runtime(void)
+{
+    char dir[] = "/tmp/ezasmXXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("ezasm: mkdtemp");
+        return 1;
+    }
+    int bad = 0;
+    for (uint8_t r = 0; r < runtime_count(); r++)
+    {
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            perror("ezasm: fork");
+            bad++;
+            break;
+        }
+        if (pid == 0)
+        {
+            int status = check_one(r, dir);
+            fflush(stdout);
+            _exit(status);
+        }
+        int status;
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            bad++;
+    }
+    rmdir(dir);
+    printf("%d of %u routines fail\n", bad, (unsigned)runtime_count());
+    return bad ? 1 : 0;
+}
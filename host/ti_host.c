@@ -0,0 +1,185 @@
+#include "host.h"
+#include "ez80.h"
+#include "../src/console.h"
+#include <tice.h>
+#include <fileioc.h>
+#include <ti/error.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_SLOTS 16
+#define MAX_SEARCH_DIRS 8
+
+// Open variables: slot numbers start at 1 like fileioc's
+typedef struct
+{
+    FILE *file;
+    uint8_t *data; // whole file, loaded on the first ti_GetDataPtr()
+} HostSlot;
+
+static HostSlot slots[MAX_SLOTS];
+static const char *search_dirs[MAX_SEARCH_DIRS];
+static uint8_t search_dir_count = 0;
+
+// Variables opened for reading are also looked up in these directories
+void host_add_search_dir(const char *dir)
+{
+    if (search_dir_count < MAX_SEARCH_DIRS)
+        search_dirs[search_dir_count++] = dir;
+}
+
+void os_PutStrFull(const char *string)
+{
+    fputs(string, stdout);
+}
+
+void os_NewLine(void)
+{
+    putchar('\n');
+}
+
+void os_ClrHome(void)
+{
+}
+
+// No keypad: any wait for a key returns at once
+uint8_t os_GetCSC(void)
+{
+    return sk_Clear;
+}
+
+void os_ThrowError(uint8_t error)
+{
+    fprintf(stderr, "ERR:%s\n", error == OS_E_MEMORY ? "MEMORY" : "UNKNOWN");
+    exit(1);
+}
+
+// Free RAM of a calculator with a few programs on it
+size_t os_MemChk(void **free)
+{
+    if (free)
+        *free = NULL;
+    return 60000;
+}
+
+void delay(uint16_t msec)
+{
+    (void)msec;
+}
+
+ti_var_t ti_Open(const char *name, const char *mode)
+{
+    const char *fmode = (mode[0] == 'w') ? "w+b" : (mode[0] == 'a') ? "a+b" : (mode[1] == '+') ? "r+b" : "rb";
+    for (uint8_t i = 1; i < MAX_SLOTS; i++)
+    {
+        if (slots[i].file)
+            continue;
+        FILE *f = fopen(name, fmode);
+        for (uint8_t d = 0; !f && mode[0] == 'r' && d < search_dir_count; d++)
+        {
+            char path[512];
+            snprintf(path, sizeof(path), "%s/%s", search_dirs[d], name);
+            f = fopen(path, fmode);
+        }
+        if (!f)
+            return 0;
+        slots[i].file = f;
+        slots[i].data = NULL;
+        return i;
+    }
+    return 0;
+}
+
+// Every variable type is a plain file
+ti_var_t ti_OpenVar(const char *name, const char *mode, uint8_t type)
+{
+    (void)type;
+    return ti_Open(name, mode);
+}
+
+int ti_Close(ti_var_t slot)
+{
+    if (slot == 0 || slot >= MAX_SLOTS || !slots[slot].file)
+        return 0;
+    fclose(slots[slot].file);
+    free(slots[slot].data);
+    slots[slot].file = NULL;
+    slots[slot].data = NULL;
+    return 1;
+}
+
+size_t ti_Read(void *data, size_t size, size_t count, ti_var_t slot)
+{
+    return fread(data, size, count, slots[slot].file);
+}
+
+size_t ti_Write(const void *data, size_t size, size_t count, ti_var_t slot)
+{
+    return fwrite(data, size, count, slots[slot].file);
+}
+
+int ti_Delete(const char *name)
+{
+    return remove(name) == 0;
+}
+
+int ti_DeleteVar(const char *name, uint8_t type)
+{
+    (void)type;
+    return ti_Delete(name);
+}
+
+int ti_SetArchiveStatus(bool archived, ti_var_t slot)
+{
+    (void)archived;
+    (void)slot;
+    return 1;
+}
+
+uint16_t ti_GetSize(ti_var_t slot)
+{
+    FILE *f = slots[slot].file;
+    long pos = ftell(f);
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, pos, SEEK_SET);
+    return size > 0xFFFF ? 0xFFFF : (uint16_t)size;
+}
+
+// Variables are read into memory once per open, like a pointer into RAM/archive
+void *ti_GetDataPtr(ti_var_t slot)
+{
+    HostSlot *s = &slots[slot];
+    long pos = ftell(s->file);
+    if (!s->data)
+    {
+        uint16_t size = ti_GetSize(slot);
+        s->data = malloc(size + 1);
+        if (!s->data)
+            return NULL;
+        fseek(s->file, 0, SEEK_SET);
+        size_t got = fread(s->data, 1, size, s->file);
+        s->data[got] = 0;
+        fseek(s->file, pos, SEEK_SET);
+    }
+    return s->data + pos;
+}
+
+// linker_run(): load the image at origin in the eZ80 stand-in, run it and
+// copy the memory back, so counters it wrote can be read as after a real run
+int host_run(uint8_t *image, size_t size, uint24_t origin)
+{
+    ez80_reset();
+    ez80_write(origin, image, size);
+    bool ok = ez80_call(origin, HOST_RUN_CYCLES);
+    ez80_read(origin, image, size);
+    if (!ok)
+    {
+        char buf[96];
+        snprintf(buf, sizeof(buf), "Run stopped: %s\n", ez80_error());
+        console_print(buf);
+        return 0;
+    }
+    return 1;
+}
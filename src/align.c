@@ -0,0 +1,78 @@
+#include "align.h"
+
+static AlignPoint marks[ALIGN_MAX_MARKS];
+static uint8_t mark_count = 0;
+static AlignPoint blocks[ALIGN_MAX_BLOCKS];
+static uint8_t block_count = 0;
+static bool blocks_full = false;
+
+// Pass 1: forget the marks and blocks of the last run
+void align_reset(void)
+{
+    mark_count = 0;
+    block_count = 0;
+    blocks_full = false;
+}
+
+// Bytes from address up to the next multiple of boundary
+uint24_t align_gap(uint24_t address, uint16_t boundary)
+{
+    return (uint24_t)((boundary - address % boundary) % boundary);
+}
+
+void align_mark(uint16_t line, uint24_t pc, uint16_t boundary, uint8_t section, bool adl)
+{
+    if (mark_count >= ALIGN_MAX_MARKS)
+        return;
+    AlignPoint *m = &marks[mark_count++];
+    m->line = line;
+    m->pc = pc;
+    m->boundary = boundary;
+    m->section = section;
+    m->adl = adl;
+}
+
+void align_block(uint16_t line, uint24_t pc, uint8_t section, bool adl)
+{
+    if (block_count >= ALIGN_MAX_BLOCKS)
+    {
+        blocks_full = true;
+        return;
+    }
+    AlignPoint *b = &blocks[block_count++];
+    b->line = line;
+    b->pc = pc;
+    b->boundary = 1;
+    b->section = section;
+    b->adl = adl;
+}
+
+uint8_t align_mark_count(void)
+{
+    return mark_count;
+}
+
+const AlignPoint *align_get_mark(uint8_t index)
+{
+    return &marks[index];
+}
+
+// Recorded blocks; 0 when there were too many to pack safely
+uint8_t align_block_count(void)
+{
+    return blocks_full ? 0 : block_count;
+}
+
+const AlignPoint *align_get_block(uint8_t index)
+{
+    return &blocks[index];
+}
+
+// Padding the recorded marks need with the program at origin
+uint24_t align_padding(uint24_t origin)
+{
+    uint24_t total = 0;
+    for (uint8_t i = 0; i < mark_count; i++)
+        total += align_gap(origin + marks[i].pc, marks[i].boundary);
+    return total;
+}
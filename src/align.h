@@ -0,0 +1,38 @@
+#ifndef ALIGN_H
+#define ALIGN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __INTELLISENSE__
+typedef unsigned long uint24_t;
+#endif
+
+// .align N: the next byte goes to a multiple of N (a power of two up to
+// 256), zero filled. Pass 1 records each .align and each block (a global
+// label up to the next one) so that blocks which can move are packed into
+// the padding instead.
+#define ALIGN_MAX_MARKS 16
+#define ALIGN_MAX_BLOCKS 64
+#define ALIGN_MAX_BOUNDARY 256
+
+typedef struct
+{
+    uint16_t line;
+    uint24_t pc;
+    uint16_t boundary; // 1 for a block
+    uint8_t section;
+    bool adl;
+} AlignPoint;
+
+void align_reset(void);
+uint24_t align_gap(uint24_t address, uint16_t boundary);
+void align_mark(uint16_t line, uint24_t pc, uint16_t boundary, uint8_t section, bool adl);
+void align_block(uint16_t line, uint24_t pc, uint8_t section, bool adl);
+uint8_t align_mark_count(void);
+const AlignPoint *align_get_mark(uint8_t index);
+uint8_t align_block_count(void);
+const AlignPoint *align_get_block(uint8_t index);
+uint24_t align_padding(uint24_t origin);
+
+#endif
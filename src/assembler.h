@@ -0,0 +1,9 @@
+#ifndef ASSEMBLER_H
+#define ASSEMBLER_H
+
+#include <stdbool.h>
+
+bool assemble_file(const char *source, const char *output);
+bool run_program(void);
+
+#endif
@@ -0,0 +1,193 @@
+#include "bench.h"
+#include "console.h"
+#include "linker.h"
+#include <tice.h>
+#include <fileioc.h>
+#include <string.h>
+#include <stdio.h>
+
+// Timer 1 counts CPU cycles upward; the harness reads its low 24 bits
+#define TIMER1_COUNTER 0xF20000
+#define TIMER_CONTROL 0xF20030
+#define TIMER1_ENABLE (1 << 0)
+#define TIMER1_32K (1 << 1)
+#define TIMER1_INT (1 << 2)
+#define TIMER1_UP (1 << 9)
+
+// Offsets of the harness result block, right after the leading jr
+#define BENCH_ITER 2
+#define BENCH_T0 5
+#define BENCH_MIN 8
+#define BENCH_TOTAL 11 // 32 bits
+#define BENCH_CODE 15
+#define BENCH_LOOP 23
+
+typedef struct
+{
+    char name[BENCH_NAME_LEN];
+    uint24_t iterations;
+    uint24_t harness_addr;
+} Bench;
+
+static Bench benches[BENCH_MAX];
+static uint8_t bench_total = 0;
+
+void bench_reset(void)
+{
+    bench_total = 0;
+}
+
+// Register a harness in pass 1 so its results can be read back after the run
+bool bench_add(const char *name, uint24_t iterations, uint24_t harness_addr)
+{
+    if (bench_total >= BENCH_MAX)
+        return false;
+    strncpy(benches[bench_total].name, name, BENCH_NAME_LEN);
+    benches[bench_total].name[BENCH_NAME_LEN - 1] = '\0';
+    benches[bench_total].iterations = iterations;
+    benches[bench_total].harness_addr = harness_addr;
+    bench_total++;
+    return true;
+}
+
+uint8_t bench_count(void)
+{
+    return bench_total;
+}
+
+static uint8_t *put24(uint8_t *out, uint24_t value)
+{
+    *out++ = value & 0xFF;
+    *out++ = (value >> 8) & 0xFF;
+    *out++ = (value >> 16) & 0xFF;
+    return out;
+}
+
+// put24() for an address inside the program, which moves with the image
+static uint8_t *put_addr(uint8_t *out, uint24_t value)
+{
+    linker_reloc_at(out, 3);
+    return put24(out, value);
+}
+
+// Write the BENCH_HARNESS_SIZE byte harness (ADL mode) for a harness placed at
+// harness_addr: call routine iterations times, timing each call with timer 1
+// and keeping the minimum and 32-bit total in the result block.
+void bench_harness(uint8_t *out, uint24_t harness_addr, uint24_t routine, uint24_t iterations)
+{
+    uint24_t iter = harness_addr + BENCH_ITER;
+    uint24_t t0 = harness_addr + BENCH_T0;
+    uint24_t min = harness_addr + BENCH_MIN;
+    uint24_t total = harness_addr + BENCH_TOTAL;
+    uint8_t *p = out;
+
+    *p++ = 0x18; // jr over the result block
+    *p++ = BENCH_CODE - 2;
+    p = put24(p, iterations); // iterations left; stays non-zero if never run
+    p = put24(p, 0);          // t0
+    p = put24(p, 0xFFFFFF);   // min
+    p = put24(p, 0);          // total
+    *p++ = 0;
+
+    *p++ = 0x21; // ld hl,iterations
+    p = put24(p, iterations);
+    *p++ = 0x22; // ld (iter),hl
+    p = put_addr(p, iter);
+
+    // loop:
+    *p++ = 0x2A; // ld hl,(timer)
+    p = put24(p, TIMER1_COUNTER);
+    *p++ = 0x22; // ld (t0),hl
+    p = put_addr(p, t0);
+    *p++ = 0xCD; // call routine
+    p = put_addr(p, routine);
+    *p++ = 0x2A; // ld hl,(timer)
+    p = put24(p, TIMER1_COUNTER);
+    *p++ = 0xED; // ld de,(t0)
+    *p++ = 0x5B;
+    p = put_addr(p, t0);
+    *p++ = 0xB7; // or a
+    *p++ = 0xED; // sbc hl,de   -> hl = elapsed
+    *p++ = 0x52;
+    *p++ = 0xEB; // ex de,hl
+
+    *p++ = 0x2A; // ld hl,(total)
+    p = put_addr(p, total);
+    *p++ = 0x19; // add hl,de
+    *p++ = 0x22; // ld (total),hl
+    p = put_addr(p, total);
+    *p++ = 0x30; // jr nc,+5
+    *p++ = 0x05;
+    *p++ = 0x21; // ld hl,total+3
+    p = put_addr(p, total + 3);
+    *p++ = 0x34; // inc (hl)
+
+    *p++ = 0x2A; // ld hl,(min)
+    p = put_addr(p, min);
+    *p++ = 0xB7; // or a
+    *p++ = 0xED; // sbc hl,de
+    *p++ = 0x52;
+    *p++ = 0x38; // jr c,+5     (min < elapsed)
+    *p++ = 0x05;
+    *p++ = 0xED; // ld (min),de
+    *p++ = 0x53;
+    p = put_addr(p, min);
+
+    *p++ = 0x2A; // ld hl,(iter)
+    p = put_addr(p, iter);
+    *p++ = 0x2B; // dec hl
+    *p++ = 0x22; // ld (iter),hl
+    p = put_addr(p, iter);
+    *p++ = 0x11; // ld de,0
+    p = put24(p, 0);
+    *p++ = 0xB7; // or a
+    *p++ = 0xED; // sbc hl,de
+    *p++ = 0x52;
+    *p++ = 0x20; // jr nz,loop
+    *p = (uint8_t)(BENCH_LOOP - (BENCH_HARNESS_SIZE));
+}
+
+// Start timer 1 counting CPU cycles upward, without interrupts. The host's
+// eZ80 stand-in has no timer registers; its timer 1 always counts.
+void bench_timer_enable(void)
+{
+#ifndef HOST_BUILD
+    volatile uint16_t *control = (volatile uint16_t *)TIMER_CONTROL;
+    *control = (*control & ~(TIMER1_ENABLE | TIMER1_32K | TIMER1_INT | TIMER1_UP)) |
+               TIMER1_ENABLE | TIMER1_UP;
+#endif
+}
+
+static uint24_t read24(const uint8_t *p)
+{
+    return p[0] | ((uint24_t)p[1] << 8) | ((uint24_t)p[2] << 16);
+}
+
+// After the program returns: print min/avg cycles per call for each harness
+// and save the same lines to appvar for comparison across builds. The
+// results are read from image, which was assembled for origin.
+void bench_report(const char *appvar, const uint8_t *image, uint24_t origin)
+{
+    ti_Delete(appvar);
+    ti_var_t f = ti_Open(appvar, "w");
+    char buf[48];
+
+    for (uint8_t i = 0; i < bench_total; i++)
+    {
+        const uint8_t *result = image + (benches[i].harness_addr - origin);
+        uint24_t left = read24(result + BENCH_ITER);
+        uint24_t min = read24(result + BENCH_MIN);
+        uint32_t total = read24(result + BENCH_TOTAL) | ((uint32_t)result[BENCH_TOTAL + 3] << 24);
+
+        if (left != 0)
+            snprintf(buf, sizeof(buf), "%s: not run\n", benches[i].name);
+        else
+            snprintf(buf, sizeof(buf), "%s min:%lu avg:%lu\n", benches[i].name, (unsigned long)min,
+                     (unsigned long)(total / benches[i].iterations));
+        console_print(buf);
+        if (f)
+            ti_Write(buf, 1, strlen(buf), f);
+    }
+    if (f)
+        ti_Close(f);
+}
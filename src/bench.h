@@ -0,0 +1,26 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __INTELLISENSE__
+typedef unsigned long uint24_t;
+#endif
+
+// Generated by .bench label, iterations. Clobbers AF, DE, HL plus whatever
+// the routine itself clobbers.
+#define BENCH_HARNESS_SIZE 96
+#define BENCH_MAX 8
+#define BENCH_NAME_LEN 16
+
+#define BENCH_APPVAR "ABENCH"
+
+void bench_reset(void);
+bool bench_add(const char *name, uint24_t iterations, uint24_t harness_addr);
+uint8_t bench_count(void);
+void bench_harness(uint8_t *out, uint24_t harness_addr, uint24_t routine, uint24_t iterations);
+void bench_timer_enable(void);
+void bench_report(const char *appvar, const uint8_t *image, uint24_t origin);
+
+#endif
@@ -0,0 +1,39 @@
+#include "console.h"
+#include <tice.h>
+#include <string.h>
+
+static char *capture_buf = NULL;
+static size_t capture_size = 0;
+
+// Append to the capture buffer when one is set, else print to the screen
+void console_print(const char *str)
+{
+    if (!capture_buf)
+    {
+        os_PutStrFull(str);
+        return;
+    }
+    size_t used = strlen(capture_buf);
+    if (used + 1 < capture_size)
+    {
+        strncat(capture_buf, str, capture_size - used - 1);
+    }
+}
+
+void console_newline(void)
+{
+    if (!capture_buf)
+        os_NewLine();
+    else
+        console_print("\n");
+}
+
+// Redirect messages into buf (NUL-terminated, truncated at size);
+// NULL restores screen output
+void console_capture(char *buf, size_t size)
+{
+    capture_buf = buf;
+    capture_size = size;
+    if (buf && size)
+        buf[0] = '\0';
+}
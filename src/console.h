@@ -0,0 +1,12 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stddef.h>
+
+// All assembler messages go through here so headless builds can collect
+// them instead of writing to the home screen
+void console_print(const char *str);
+void console_newline(void);
+void console_capture(char *buf, size_t size);
+
+#endif
@@ -0,0 +1,128 @@
+#include "diag.h"
+#include "console.h"
+#include <string.h>
+#include <stdio.h>
+
+// Errors of the current build, in the order they were found
+static Diagnostic errors[DIAG_MAX_ERRORS];
+static uint8_t error_count = 0;
+static uint16_t total_errors = 0;
+
+static char file_names[DIAG_MAX_FILES][9];
+
+static const char *const kind_text[] = {
+    "Unknown instruction",
+    "Missing operand",
+    "Undefined label",
+    "Unknown table",
+    "Bad .bench",
+    "Too many .bench",
+    "Code buffer full",
+    "Unmatched .else",
+    "Unmatched .endif",
+    "Too many .if",
+    "Missing .endif",
+    "Only .ds in .bss",
+    ".org goes backwards",
+    "Disassembles differently",
+    "Bad operand",
+    "Operand out of range",
+    "Bad .incbin",
+    "Bad .assert_cycles",
+    "Over cycle budget",
+    "Loop without .trips",
+    "Too much code to time",
+    "Bad .switch",
+    ".bss too large",
+    "Too many labels",
+};
+
+void diag_reset(void)
+{
+    error_count = 0;
+    total_errors = 0;
+}
+
+// Remember the AppVar behind a file id for the report. Host builds pass
+// paths; only the last component is kept.
+void diag_name_file(uint8_t file, const char *name)
+{
+    if (file >= DIAG_MAX_FILES)
+        return;
+    const char *slash = strrchr(name, '/');
+    if (slash)
+        name = slash + 1;
+    strncpy(file_names[file], name, sizeof(file_names[file]) - 1);
+    file_names[file][sizeof(file_names[file]) - 1] = '\0';
+}
+
+// Name given to a file id, or NULL
+const char *diag_file_name(uint8_t file)
+{
+    if (file >= DIAG_MAX_FILES || !file_names[file][0])
+        return NULL;
+    return file_names[file];
+}
+
+void diag_error(DiagKind kind, uint8_t file, uint16_t line, uint8_t column)
+{
+    total_errors++;
+    if (error_count >= DIAG_MAX_ERRORS)
+        return;
+    Diagnostic *d = &errors[error_count++];
+    d->kind = kind;
+    d->file = file;
+    d->line = line;
+    d->column = column;
+}
+
+// Every error found, including those past DIAG_MAX_ERRORS
+uint16_t diag_error_count(void)
+{
+    return total_errors;
+}
+
+// Errors kept for diag_get()
+uint8_t diag_count(void)
+{
+    return error_count;
+}
+
+const Diagnostic *diag_get(uint8_t index)
+{
+    return index < error_count ? &errors[index] : NULL;
+}
+
+const char *diag_text(DiagKind kind)
+{
+    return kind_text[kind];
+}
+
+// Print one "FILE:LINE:COL message" line per kept error, then the total
+void diag_report(void)
+{
+    char buf[32];
+    for (uint8_t i = 0; i < error_count; i++)
+    {
+        const Diagnostic *d = &errors[i];
+        if (d->file < DIAG_MAX_FILES && file_names[d->file][0])
+            snprintf(buf, sizeof(buf), "%s", file_names[d->file]);
+        else
+            snprintf(buf, sizeof(buf), "#%u", (unsigned)d->file);
+        console_print(buf);
+        if (d->line != DIAG_NO_LINE)
+        {
+            snprintf(buf, sizeof(buf), ":%u:%u", (unsigned)d->line, (unsigned)d->column);
+            console_print(buf);
+        }
+        console_print(" ");
+        console_print(kind_text[d->kind]);
+        console_newline();
+    }
+    if (total_errors > 0)
+    {
+        snprintf(buf, sizeof(buf), "%u error(s)", (unsigned)total_errors);
+        console_print(buf);
+        console_newline();
+    }
+}
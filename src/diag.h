@@ -0,0 +1,57 @@
+#ifndef DIAG_H
+#define DIAG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DIAG_MAX_ERRORS 16 // kept for the report; further errors are only counted
+#define DIAG_MAX_FILES 16  // files the report can name; others print as #id
+#define DIAG_NO_LINE 0xFFFF
+
+typedef enum
+{
+    DIAG_UNKNOWN_INSTRUCTION,
+    DIAG_MISSING_OPERAND,
+    DIAG_UNDEFINED_LABEL,
+    DIAG_UNKNOWN_TABLE,
+    DIAG_BAD_BENCH,
+    DIAG_TOO_MANY_BENCH,
+    DIAG_CODE_FULL,
+    DIAG_UNMATCHED_ELSE,
+    DIAG_UNMATCHED_ENDIF,
+    DIAG_TOO_MANY_IF,
+    DIAG_MISSING_ENDIF,
+    DIAG_BSS_CONTENT,
+    DIAG_BAD_ORG,
+    DIAG_VERIFY,
+    DIAG_BAD_OPERAND,
+    DIAG_RANGE,
+    DIAG_BAD_INCBIN,
+    DIAG_BAD_ASSERT,
+    DIAG_CYCLES,
+    DIAG_UNBOUNDED,
+    DIAG_TIMING_FULL,
+    DIAG_BAD_SWITCH,
+    DIAG_BSS_FULL,
+    DIAG_TOO_MANY_LABELS
+} DiagKind;
+
+typedef struct
+{
+    uint8_t kind;
+    uint8_t file;   // 0 for the source, else the include id
+    uint16_t line;  // 1-based, DIAG_NO_LINE when not tied to a line
+    uint8_t column; // 1-based, 0 when unknown
+} Diagnostic;
+
+void diag_reset(void);
+void diag_name_file(uint8_t file, const char *name);
+const char *diag_file_name(uint8_t file);
+void diag_error(DiagKind kind, uint8_t file, uint16_t line, uint8_t column);
+uint16_t diag_error_count(void);
+uint8_t diag_count(void);
+const Diagnostic *diag_get(uint8_t index);
+const char *diag_text(DiagKind kind);
+void diag_report(void);
+
+#endif
@@ -0,0 +1,258 @@
+#include "disasm.h"
+#include "diag.h"
+#include <stdio.h>
+#include <string.h>
+
+// Reverse tables: index + 1 of the table entry for each opcode byte, 0 when
+// none. Slot 0 is unprefixed, the others follow a CB, DD, ED or FD prefix.
+// Built on the first decode and kept, like the mnemonic index.
+#define PREFIX_SLOTS 5
+static uint16_t reverse[PREFIX_SLOTS][256];
+static bool reverse_built = false;
+
+typedef struct
+{
+    uint16_t offset;
+    uint16_t index;
+    uint8_t length; // with any suffix prefix
+    bool adl;
+    uint8_t file;
+    uint16_t line;
+} Check;
+
+static Check checks[DISASM_MAX_CHECKS];
+static uint16_t check_count = 0;
+
+static uint8_t prefix_slot(uint8_t byte)
+{
+    switch (byte)
+    {
+    case 0xCB:
+        return 1;
+    case 0xDD:
+        return 2;
+    case 0xED:
+        return 3;
+    case 0xFD:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+static bool is_suffix(uint8_t byte)
+{
+    return byte == SUFFIX_SIS || byte == SUFFIX_LIS || byte == SUFFIX_SIL || byte == SUFFIX_LIL;
+}
+
+static void build_reverse(void)
+{
+    for (uint16_t i = 0; i < INSTRUCTION_COUNT; i++)
+    {
+        const Instruction *inst = &instruction_table[i];
+        uint8_t key = instruction_key_length(inst);
+        uint16_t *slot;
+        if (key == 1)
+            slot = &reverse[0][inst->opcode[0]];
+        else if (key == 2 && prefix_slot(inst->opcode[0]))
+            slot = &reverse[prefix_slot(inst->opcode[0])][inst->opcode[1]];
+        else
+            continue;
+
+        // a 24-bit entry wins over a shorter one with the same opcode, as
+        // ADL programs use that form; otherwise the first one does
+        const Instruction *held = *slot ? &instruction_table[*slot - 1] : NULL;
+        if (!held || (inst->type == OP_IMM24 && held->type != OP_IMM24 && held->type != OP_NOARG))
+            *slot = i + 1;
+    }
+    reverse_built = true;
+}
+
+// Decode with skip set to 1 when a mode suffix prefix comes first
+static const Instruction *decode(const uint8_t *code, size_t avail, bool adl, uint8_t *length, uint8_t *skip)
+{
+    if (!reverse_built)
+        build_reverse();
+    *skip = 0;
+    if (avail == 0)
+        return NULL;
+
+    bool wide = adl;
+    if (is_suffix(code[0]) && avail >= 2)
+    {
+        *skip = 1;
+        wide = code[0] == SUFFIX_SIL || code[0] == SUFFIX_LIL;
+    }
+
+    uint8_t first = code[*skip];
+    uint16_t index = 0;
+    if (prefix_slot(first) && avail >= *skip + 2u)
+        index = reverse[prefix_slot(first)][code[*skip + 1]];
+    if (!index)
+        index = reverse[0][first];
+    if (!index)
+        return NULL;
+    const Instruction *inst = &instruction_table[index - 1];
+    *length = *skip + instruction_size(inst, wide);
+    if (*length > avail)
+        return NULL;
+    return inst;
+}
+
+// Table entry for the instruction at code, or NULL if it is unknown or
+// runs past avail bytes. length covers any suffix prefix and an address
+// operand as wide as adl mode, or the suffix, makes it.
+const Instruction *disasm_decode(const uint8_t *code, size_t avail, bool adl, uint8_t *length)
+{
+    uint8_t skip;
+    return decode(code, avail, adl, length, &skip);
+}
+
+static const char *suffix_name(uint8_t byte)
+{
+    switch (byte)
+    {
+    case SUFFIX_SIS:
+        return ".sis";
+    case SUFFIX_LIS:
+        return ".lis";
+    case SUFFIX_SIL:
+        return ".sil";
+    default:
+        return ".lil";
+    }
+}
+
+// Format the instruction at code, which runs at addr, into out. The operand
+// replaces the placeholder of the mnemonic, or is appended; jr shows its
+// target. Unknown bytes come out as .db. Returns the bytes used.
+uint8_t disasm_line(const uint8_t *code, size_t avail, uint24_t addr, bool adl, char *out, size_t size)
+{
+    uint8_t length;
+    uint8_t skip;
+    const Instruction *inst = decode(code, avail, adl, &length, &skip);
+    if (!inst)
+    {
+        snprintf(out, size, ".db 0x%02X", avail ? code[0] : 0);
+        return 1;
+    }
+
+    // the suffix goes after the first word
+    const char *mnemonic = inst->mnemonic;
+    const char *rest = strchr(mnemonic, ' ');
+    int word = rest ? (int)(rest - mnemonic) : (int)strlen(mnemonic);
+    const char *suffix = skip ? suffix_name(code[0]) : "";
+    if (!rest)
+        rest = "";
+
+    const char *at;
+    uint8_t hole_len;
+    HoleKind hole = instruction_hole(inst, &at, &hole_len);
+    if (hole == HOLE_NONE)
+    {
+        snprintf(out, size, "%.*s%s%s", word, mnemonic, suffix, rest);
+        return length;
+    }
+
+    uint8_t key = skip + instruction_key_length(inst);
+    uint8_t bytes = length - key;
+    unsigned long value = 0;
+    for (uint8_t i = 0; i < bytes; i++)
+        value |= (unsigned long)code[key + i] << (8 * i);
+
+    char text[16];
+    if (hole == HOLE_REL)
+        snprintf(text, sizeof(text), "0x%06lX", (unsigned long)((addr + length + (int8_t)value) & 0xFFFFFF));
+    else if (hole == HOLE_DISP && (int8_t)value < 0)
+        snprintf(text, sizeof(text), "-0x%02X", (unsigned)-(int8_t)value);
+    else
+        snprintf(text, sizeof(text), "0x%0*lX", bytes * 2, value);
+
+    if (at)
+    {
+        // a negative displacement takes the place of the + before it
+        int keep = (int)(at - rest) - (text[0] == '-' ? 1 : 0);
+        snprintf(out, size, "%.*s%s%.*s%s%s", word, mnemonic, suffix, keep, rest, text, at + hole_len);
+    }
+    else
+    {
+        snprintf(out, size, "%.*s%s%s%s%s", word, mnemonic, suffix, rest, *rest ? "," : " ", text);
+    }
+    return length;
+}
+
+void disasm_reset(void)
+{
+    check_count = 0;
+}
+
+// --verify: note that inst was emitted at offset in the image, length
+// bytes long with any suffix, in ADL mode or not. Past DISASM_MAX_CHECKS
+// instructions the rest go unchecked.
+void disasm_expect(uint24_t offset, const Instruction *inst, uint8_t length, bool adl, uint8_t file, uint16_t line)
+{
+    if (check_count >= DISASM_MAX_CHECKS)
+        return;
+    Check *c = &checks[check_count++];
+    c->offset = (uint16_t)offset;
+    c->index = (uint16_t)(inst - instruction_table);
+    c->length = length;
+    c->adl = adl;
+    c->file = file;
+    c->line = line;
+}
+
+// Decode every noted instruction from the finished image and report the
+// ones that do not come back as the same opcode bytes and length
+bool disasm_verify(const uint8_t *image, size_t size)
+{
+    bool ok = true;
+    for (uint16_t i = 0; i < check_count; i++)
+    {
+        const Check *c = &checks[i];
+        const Instruction *emitted = &instruction_table[c->index];
+        uint8_t length = 0;
+        uint8_t skip = 0;
+        const Instruction *decoded = c->offset < size ? decode(image + c->offset, size - c->offset, c->adl, &length, &skip) : NULL;
+        if (!decoded || length != c->length ||
+            memcmp(image + c->offset + skip, emitted->opcode, instruction_key_length(emitted)) != 0)
+        {
+            diag_error(DIAG_VERIFY, c->file, c->line, 0);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Encode every table entry at its own operand width and decode it again.
+// Calls report for each entry that comes back as other bytes, or as an
+// entry with another mnemonic and another kind of operand (ld hl,nn and
+// ld hl,nnnnnn are one instruction); returns how many did.
+uint16_t disasm_check_table(void (*report)(const Instruction *entry, const Instruction *decoded))
+{
+    uint16_t bad = 0;
+    for (uint16_t i = 0; i < INSTRUCTION_COUNT; i++)
+    {
+        const Instruction *entry = &instruction_table[i];
+        bool wide = entry->type == OP_IMM24;
+        uint8_t bytes[8] = {0};
+        uint8_t size = instruction_encode(entry, wide, 0, bytes);
+        uint8_t length = 0;
+        const Instruction *decoded = disasm_decode(bytes, sizeof(bytes), wide, &length);
+        if (decoded == entry)
+            continue;
+        if (decoded && length == size &&
+            memcmp(bytes, decoded->opcode, instruction_key_length(decoded)) == 0)
+        {
+            const char *at;
+            uint8_t len;
+            HoleKind a = instruction_hole(entry, &at, &len);
+            HoleKind b = instruction_hole(decoded, &at, &len);
+            if (strcmp(decoded->mnemonic, entry->mnemonic) == 0 || (a == b && a != HOLE_NONE))
+                continue;
+        }
+        report(entry, decoded);
+        bad++;
+    }
+    return bad;
+}
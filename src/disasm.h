@@ -0,0 +1,25 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include "opcodes.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __INTELLISENSE__
+typedef unsigned long uint24_t;
+#endif
+
+// Disassembly from instruction_table through reverse tables indexed by the
+// opcode byte after an optional CB/DD/ED/FD prefix
+#define DISASM_MAX_CHECKS 512 // instructions --verify can check per build
+
+const Instruction *disasm_decode(const uint8_t *code, size_t avail, bool adl, uint8_t *length);
+uint8_t disasm_line(const uint8_t *code, size_t avail, uint24_t addr, bool adl, char *out, size_t size);
+
+void disasm_reset(void);
+void disasm_expect(uint24_t offset, const Instruction *inst, uint8_t length, bool adl, uint8_t file, uint16_t line);
+bool disasm_verify(const uint8_t *image, size_t size);
+
+uint16_t disasm_check_table(void (*report)(const Instruction *entry, const Instruction *decoded));
+
+#endif
@@ -0,0 +1,103 @@
+#include "hot.h"
+#include "profile.h"
+#include <fileioc.h>
+#include <string.h>
+
+typedef struct
+{
+    char name[HOT_NAME_LEN];
+    uint24_t weight;
+} HotEntry;
+
+static HotEntry entries[HOT_MAX_ENTRIES];
+static uint8_t entry_count = 0;
+
+static void add_entry(const char *name, uint24_t weight)
+{
+    if (entry_count >= HOT_MAX_ENTRIES || name[0] == '\0')
+        return;
+    HotEntry *e = &entries[entry_count++];
+    size_t n = strlen(name);
+    n = n < HOT_NAME_LEN - 1 ? n : HOT_NAME_LEN - 1;
+    memcpy(e->name, name, n);
+    e->name[n] = '\0';
+    e->weight = weight;
+}
+
+// One text line: name, spaces, decimal weight. A name alone counts as 1.
+static void parse_line(char *line)
+{
+    char *p = strchr(line, ';');
+    if (p)
+        *p = '\0';
+    p = line;
+    while (*p == ' ' || *p == '\t')
+        p++;
+    char *name = p;
+    while (*p && *p != ' ' && *p != '\t')
+        p++;
+    if (*p)
+        *p++ = '\0';
+    while (*p == ' ' || *p == '\t')
+        p++;
+    uint24_t weight = *p ? 0 : 1;
+    while (*p >= '0' && *p <= '9')
+        weight = weight * 10 + (uint24_t)(*p++ - '0');
+    add_entry(name, weight);
+}
+
+// Read the weights. False if the AppVar is missing.
+bool hot_load(const char *appvar)
+{
+    static ProfileEntry profile[PROFILE_MAX_ROUTINES];
+    entry_count = 0;
+
+    uint8_t n = profile_read(appvar, profile);
+    if (n > 0)
+    {
+        for (uint8_t i = 0; i < n; i++)
+            add_entry(profile[i].name, profile[i].count);
+        return true;
+    }
+
+    ti_var_t f = ti_Open(appvar, "r");
+    if (!f)
+        return false;
+    char buf[40];
+    uint8_t pos = 0;
+    uint8_t ch;
+    bool more = true;
+    while (more)
+    {
+        more = ti_Read(&ch, 1, 1, f) == 1;
+        if (!more || ch == '\n' || ch == '\r')
+        {
+            buf[pos] = '\0';
+            parse_line(buf);
+            pos = 0;
+        }
+        else if (pos < sizeof(buf) - 1)
+            buf[pos++] = (char)ch;
+    }
+    ti_Close(f);
+    return true;
+}
+
+uint8_t hot_count(void)
+{
+    return entry_count;
+}
+
+// Weight of a routine, false if it is not listed
+bool hot_weight(const char *name, uint24_t *weight)
+{
+    for (uint8_t i = 0; i < entry_count; i++)
+    {
+        if (strncmp(entries[i].name, name, HOT_NAME_LEN - 1) == 0)
+        {
+            *weight = entries[i].weight;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,22 @@
+#ifndef HOT_H
+#define HOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __INTELLISENSE__
+typedef unsigned long uint24_t;
+#endif
+
+// --hot=NAME: routine weights that decide the order of movable .text
+// routines. The AppVar is either an APROF profile (call counts) or text,
+// one "name weight" per line with ; comments. Listed routines with a
+// weight go first, heaviest first; weight 0 sends a routine to the end.
+#define HOT_MAX_ENTRIES 64
+#define HOT_NAME_LEN 16
+
+bool hot_load(const char *appvar);
+uint8_t hot_count(void);
+bool hot_weight(const char *name, uint24_t *weight);
+
+#endif
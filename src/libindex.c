@@ -0,0 +1,347 @@
+#include "libindex.h"
+#include "opcodes.h"
+#include "console.h"
+#include <tice.h>
+#include <fileioc.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdio.h>
+
+// Index AppVar: "LIX", version, routine count, preamble length (u16), the
+// library's size and checksum (u16 each), then count records and the
+// dependency bytes. Records are fixed size so a routine can be reached
+// without parsing the ones before it.
+#define LIBINDEX_VERSION 2
+#define LIBINDEX_HEADER 11
+#define REC_NAME 0
+#define REC_OFFSET 16
+#define REC_LENGTH 18
+#define REC_DEP_FIRST 20
+#define REC_DEP_COUNT 22
+#define REC_SIZE 23
+
+static uint16_t get16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+// Fletcher-16 of size bytes
+uint16_t libindex_checksum(const uint8_t *data, uint16_t size)
+{
+    uint16_t a = 0;
+    uint16_t b = 0;
+    for (uint16_t i = 0; i < size; i++)
+    {
+        a = (a + data[i]) % 255;
+        b = (b + a) % 255;
+    }
+    return (b << 8) | a;
+}
+
+// "LIB_GFX" -> "IDX_GFX"; other names get an 'I' prefix
+void libindex_name(const char *lib, char *out)
+{
+    if (strncmp(lib, "LIB_", 4) == 0)
+    {
+        strcpy(out, "IDX_");
+        strncat(out, lib + 4, 4);
+    }
+    else
+    {
+        out[0] = 'I';
+        out[1] = '\0';
+        strncat(out, lib, 7);
+    }
+}
+
+// Copy the next identifier at or after *p (stopping at end, a comment or
+// a newline) into word. Skips quoted strings. Returns false at end of line.
+static bool next_word(const uint8_t **p, const uint8_t *end, char *word)
+{
+    const uint8_t *s = *p;
+    while (s < end && *s != '\n' && *s != '\r' && *s != ';')
+    {
+        if (*s == '"' || *s == '\'')
+        {
+            uint8_t quote = *s++;
+            while (s < end && *s != quote && *s != '\n')
+                s++;
+            if (s < end && *s == quote)
+                s++;
+            continue;
+        }
+        if (isalpha(*s) || *s == '_')
+        {
+            uint8_t n = 0;
+            while (s < end && (isalnum(*s) || *s == '_'))
+            {
+                if (n < LIBINDEX_NAME_LEN - 1)
+                    word[n++] = *s;
+                s++;
+            }
+            word[n] = '\0';
+            *p = s;
+            return true;
+        }
+        s++;
+    }
+    *p = s;
+    return false;
+}
+
+// Start of the line after p
+static const uint8_t *next_line(const uint8_t *p, const uint8_t *end)
+{
+    while (p < end && *p != '\n' && *p != '\r')
+        p++;
+    while (p < end && (*p == '\n' || *p == '\r'))
+        p++;
+    return p;
+}
+
+// If the line at p defines a label, copy its name and return true
+static bool line_label(const uint8_t *p, const uint8_t *end, char *name)
+{
+    uint8_t n = 0;
+    while (p < end && (isalnum(*p) || *p == '_'))
+    {
+        if (n < LIBINDEX_NAME_LEN - 1)
+            name[n++] = *p;
+        p++;
+    }
+    name[n] = '\0';
+    return n > 0 && p < end && *p == ':';
+}
+
+// Whether the last statement of [p, end) can run on into the next routine
+static bool falls_through(const uint8_t *p, const uint8_t *end)
+{
+    bool flows = true;
+    while (p < end)
+    {
+        char stmt[64];
+        uint8_t n = 0;
+        const uint8_t *q = p;
+        while (q < end && *q != '\n' && *q != '\r' && *q != ';' && n < sizeof(stmt) - 1)
+            stmt[n++] = *q++;
+        stmt[n] = '\0';
+        p = next_line(p, end);
+
+        char *s = stmt;
+        char *colon = strchr(s, ':');
+        if (colon && !strchr(s, '"') && !strchr(s, '\''))
+            s = colon + 1;
+        char *mnemonic = strtok(s, " \t");
+        if (!mnemonic)
+            continue;
+        char *operands = strtok(NULL, "");
+        if (operands)
+        {
+            while (*operands == ' ' || *operands == '\t')
+                operands++;
+            if (operands[0] == '\0')
+                operands = NULL;
+        }
+        if (mnemonic[0] == '.' || strcasecmp(mnemonic, "db") == 0 || strcasecmp(mnemonic, "dw") == 0 ||
+            strcasecmp(mnemonic, "dl") == 0)
+            flows = false;
+        else
+            flows = !instruction_ends_flow(mnemonic, operands);
+    }
+    return flows;
+}
+
+// Tool mode: scan a library and write its index AppVar
+bool libindex_build(const char *lib)
+{
+    static char names[LIBINDEX_MAX_ROUTINES][LIBINDEX_NAME_LEN];
+    static uint16_t offsets[LIBINDEX_MAX_ROUTINES + 1];
+    static uint8_t deps[LIBINDEX_MAX_DEPS];
+    static uint8_t record[REC_SIZE];
+    uint16_t dep_count = 0;
+    uint8_t count = 0;
+    char name[LIBINDEX_NAME_LEN];
+    char buf[32];
+
+    ti_var_t f = ti_Open(lib, "r");
+    if (!f)
+    {
+        console_print("Library not found\n");
+        return false;
+    }
+    const uint8_t *text = ti_GetDataPtr(f);
+    uint16_t size = ti_GetSize(f);
+    const uint8_t *end = text + size;
+
+    // routines start at label lines
+    for (const uint8_t *p = text; p < end; p = next_line(p, end))
+    {
+        if (!line_label(p, end, name))
+            continue;
+        if (count >= LIBINDEX_MAX_ROUTINES)
+        {
+            console_print("Too many routines\n");
+            ti_Close(f);
+            return false;
+        }
+        strcpy(names[count], name);
+        offsets[count++] = (uint16_t)(p - text);
+    }
+    offsets[count] = size;
+
+    char idx_name[9];
+    libindex_name(lib, idx_name);
+    ti_Delete(idx_name);
+    ti_var_t out = ti_Open(idx_name, "w");
+    if (!out)
+    {
+        ti_Close(f);
+        return false;
+    }
+    uint8_t header[LIBINDEX_HEADER] = {'L', 'I', 'X', LIBINDEX_VERSION, count};
+    put16(header + 5, count ? offsets[0] : size);
+    put16(header + 7, size);
+    put16(header + 9, libindex_checksum(text, size));
+    ti_Write(header, 1, LIBINDEX_HEADER, out);
+
+    // records, with dependencies found by matching identifiers to routine names
+    for (uint8_t r = 0; r < count; r++)
+    {
+        const uint8_t *p = text + offsets[r];
+        const uint8_t *stop = text + offsets[r + 1];
+        uint16_t first = dep_count;
+
+        while (p < stop)
+        {
+            char word[LIBINDEX_NAME_LEN];
+            const uint8_t *line_end = next_line(p, stop);
+            while (next_word(&p, line_end, word))
+            {
+                for (uint8_t d = 0; d < count; d++)
+                {
+                    if (d == r || strcmp(word, names[d]) != 0)
+                        continue;
+                    bool seen = false;
+                    for (uint16_t k = first; k < dep_count; k++)
+                        seen |= deps[k] == d;
+                    if (!seen && dep_count < LIBINDEX_MAX_DEPS)
+                        deps[dep_count++] = d;
+                }
+            }
+            p = line_end;
+        }
+        if (r + 1 < count && falls_through(text + offsets[r], stop) && dep_count < LIBINDEX_MAX_DEPS)
+            deps[dep_count++] = r + 1;
+
+        memset(record, 0, sizeof(record));
+        strncpy((char *)record + REC_NAME, names[r], LIBINDEX_NAME_LEN - 1);
+        put16(record + REC_OFFSET, offsets[r]);
+        put16(record + REC_LENGTH, offsets[r + 1] - offsets[r]);
+        put16(record + REC_DEP_FIRST, first);
+        record[REC_DEP_COUNT] = (uint8_t)(dep_count - first);
+        ti_Write(record, 1, REC_SIZE, out);
+    }
+    ti_Write(deps, 1, dep_count, out);
+    ti_SetArchiveStatus(true, out);
+    ti_Close(out);
+    ti_Close(f);
+
+    snprintf(buf, sizeof(buf), "Indexed %u routines", (unsigned)count);
+    console_print(buf);
+    console_newline();
+    return true;
+}
+
+// Open a library through its index. Both stay open (and unmoved) until
+// libindex_close(); the library text is read in place, even from archive.
+// False when the library changed since it was indexed.
+bool libindex_open(const char *lib, LibIndex *idx)
+{
+    char idx_name[9];
+    libindex_name(lib, idx_name);
+    idx->idx_slot = ti_Open(idx_name, "r");
+    if (!idx->idx_slot)
+        return false;
+    idx->lib_slot = ti_Open(lib, "r");
+    if (!idx->lib_slot)
+    {
+        ti_Close(idx->idx_slot);
+        return false;
+    }
+
+    const uint8_t *data = ti_GetDataPtr(idx->idx_slot);
+    uint16_t size = ti_GetSize(idx->idx_slot);
+    if (size < LIBINDEX_HEADER || memcmp(data, "LIX", 3) != 0 || data[3] != LIBINDEX_VERSION ||
+        size < LIBINDEX_HEADER + data[4] * REC_SIZE)
+    {
+        libindex_close(idx);
+        return false;
+    }
+    idx->text = ti_GetDataPtr(idx->lib_slot);
+    idx->text_size = ti_GetSize(idx->lib_slot);
+    if (get16(data + 7) != idx->text_size || get16(data + 9) != libindex_checksum(idx->text, idx->text_size))
+    {
+        libindex_close(idx);
+        return false;
+    }
+    idx->count = data[4];
+    idx->preamble = get16(data + 5);
+    idx->records = data + LIBINDEX_HEADER;
+    idx->deps = idx->records + idx->count * REC_SIZE;
+    return true;
+}
+
+void libindex_close(LibIndex *idx)
+{
+    ti_Close(idx->lib_slot);
+    ti_Close(idx->idx_slot);
+}
+
+int libindex_find(const LibIndex *idx, const char *name)
+{
+    for (uint8_t i = 0; i < idx->count; i++)
+    {
+        if (strncmp((const char *)idx->records + i * REC_SIZE + REC_NAME, name, LIBINDEX_NAME_LEN) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// Mark a routine and everything it depends on
+void libindex_select(const LibIndex *idx, uint8_t routine, bool *selected)
+{
+    if (selected[routine])
+        return;
+    selected[routine] = true;
+    const uint8_t *rec = idx->records + routine * REC_SIZE;
+    const uint8_t *dep = idx->deps + get16(rec + REC_DEP_FIRST);
+    for (uint8_t k = 0; k < rec[REC_DEP_COUNT]; k++)
+        libindex_select(idx, dep[k], selected);
+}
+
+// Select every routine named by an identifier in line, with its dependencies
+void libindex_select_referenced(const LibIndex *idx, const char *line, bool *selected)
+{
+    const uint8_t *p = (const uint8_t *)line;
+    const uint8_t *end = p + strlen(line);
+    char word[LIBINDEX_NAME_LEN];
+    while (next_word(&p, end, word))
+    {
+        int routine = libindex_find(idx, word);
+        if (routine >= 0)
+            libindex_select(idx, routine, selected);
+    }
+}
+
+void libindex_range(const LibIndex *idx, uint8_t routine, uint16_t *offset, uint16_t *length)
+{
+    const uint8_t *rec = idx->records + routine * REC_SIZE;
+    *offset = get16(rec + REC_OFFSET);
+    *length = get16(rec + REC_LENGTH);
+}
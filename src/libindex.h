@@ -0,0 +1,35 @@
+#ifndef LIBINDEX_H
+#define LIBINDEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Symbol index for a library AppVar: each routine (label up to the next
+// label) with its byte range in the library and the routines it needs.
+// "LIB_NAME" is indexed into "IDX_NAME".
+#define LIBINDEX_MAX_ROUTINES 64
+#define LIBINDEX_MAX_DEPS 512
+#define LIBINDEX_NAME_LEN 16
+
+typedef struct {
+    const uint8_t *text;    // library source, possibly still in archive
+    uint16_t text_size;
+    const uint8_t *records; // one LIBINDEX record per routine
+    const uint8_t *deps;    // dependency lists, routine indices
+    uint8_t count;
+    uint16_t preamble;      // bytes before the first label, always loaded
+    uint8_t lib_slot;
+    uint8_t idx_slot;
+} LibIndex;
+
+uint16_t libindex_checksum(const uint8_t *data, uint16_t size);
+void libindex_name(const char *lib, char *out);
+bool libindex_build(const char *lib);
+bool libindex_open(const char *lib, LibIndex *idx);
+void libindex_close(LibIndex *idx);
+int libindex_find(const LibIndex *idx, const char *name);
+void libindex_select(const LibIndex *idx, uint8_t routine, bool *selected);
+void libindex_select_referenced(const LibIndex *idx, const char *line, bool *selected);
+void libindex_range(const LibIndex *idx, uint8_t routine, uint16_t *offset, uint16_t *length);
+
+#endif
@@ -1,7 +1,14 @@
 #include "linker.h"
+#include "console.h"
+#include "pack.h"
 #include <tice.h>
 #include <fileioc.h>
 #include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HOST_BUILD
+#include "host.h"
+#endif
 
 #ifdef __INTELLISENSE__
 typedef unsigned long uint24_t;
@@ -9,46 +16,175 @@ typedef unsigned long uint24_t;
 #define false 0
 #endif
 
-static uint8_t *code_ptr = (uint8_t*)CODE_START;
-static size_t code_size = 0; // Track how many bytes were emitted
+// The image is assembled for origin but built here; running it in place
+// means moving its absolute addresses to this buffer first. The spare 255
+// bytes let the run slide it to an address equal to origin mod 256, so
+// .align tables stay aligned.
+static uint8_t code_buf[CODE_MAX_SIZE + 255];
+#define CODE_BASE code_buf
+
+static uint8_t *code_ptr = CODE_BASE;
+static uint8_t *image_base = CODE_BASE; // where the image is now; moved by a run
+static size_t code_size = 0; // Track how many bytes were emitted (furthest byte written)
+static uint24_t origin = ORIGIN_DEFAULT;
+static bool compress = false;
+
+// Image offsets of absolute addresses; bit 15 set for 24-bit fields
+static uint16_t relocs[MAX_RELOCS];
+static uint16_t reloc_count = 0;
+static bool reloc_overflow = false;
+
+#define RELOC_24 0x8000
 
 void linker_reset(void) {
-    code_ptr = (uint8_t*)CODE_START;
+    code_ptr = CODE_BASE;
+    image_base = CODE_BASE;
     code_size = 0;
+    reloc_count = 0;
+    reloc_overflow = false;
+}
+
+// Address the first byte of the image runs at
+void linker_set_origin(uint24_t addr) {
+    origin = addr;
+}
+
+uint24_t linker_origin(void) {
+    return origin;
+}
+
+// Save programs compressed behind a self-extracting stub
+void linker_set_compress(bool on) {
+    compress = on;
 }
 
 int linker_emit(const uint8_t *bytes, uint8_t length) {
-    if ((code_ptr + length) > (uint8_t*)(CODE_START + CODE_MAX_SIZE)) {
+    if ((code_ptr + length) > CODE_BASE + CODE_MAX_SIZE) {
         return 0; // Overflow
     }
     for (uint8_t i = 0; i < length; i++) {
         *code_ptr++ = bytes[i];
     }
-    code_size += length;
+    if ((size_t)(code_ptr - CODE_BASE) > code_size) {
+        code_size = code_ptr - CODE_BASE;
+    }
+    return 1;
+}
+
+// Claim length bytes of the code buffer for the caller to fill directly,
+// so large blocks go out in one write instead of byte-by-byte emits
+uint8_t *linker_reserve(size_t length) {
+    if ((code_ptr + length) > CODE_BASE + CODE_MAX_SIZE) {
+        return NULL; // Overflow
+    }
+    uint8_t *block = code_ptr;
+    code_ptr += length;
+    if ((size_t)(code_ptr - CODE_BASE) > code_size) {
+        code_size = code_ptr - CODE_BASE;
+    }
+    return block;
+}
+
+// Move the write position to offset bytes from the start of the program,
+// so each section can be emitted at its own place in the image
+int linker_seek(size_t offset) {
+    if (offset > CODE_MAX_SIZE) {
+        return 0; // Overflow
+    }
+    code_ptr = CODE_BASE + offset;
     return 1;
 }
 
-static void linker_save_to_vat(const char *name) {
-    // Delete any existing program with this name
+// Note that the width (2 or 3) bytes at field, inside the image, hold an
+// address assembled against the origin
+void linker_reloc_at(const uint8_t *field, uint8_t width) {
+    if (reloc_count >= MAX_RELOCS) {
+        reloc_overflow = true;
+        return;
+    }
+    relocs[reloc_count++] = (uint16_t)(field - CODE_BASE) | (width == 3 ? RELOC_24 : 0);
+}
+
+uint8_t *linker_image(void) {
+    return image_base;
+}
+
+size_t linker_size(void) {
+    return code_size;
+}
+
+// Save the image. At the default origin it becomes a protected program the
+// OS can launch (tExtTok, tAsm84CeCmp header, code loaded at userMem);
+// an image for any other origin is stored raw in an AppVar.
+int linker_save(const char *name) {
+    static const uint8_t asm_header[2] = {0xEF, 0x7B};
+    bool program = origin == USER_MEM;
+
+    // Delete any existing variable with this name
     ti_Delete(name);
+    ti_DeleteVar(name, TI_PPRGM_TYPE);
 
-    // Create a new program in RAM
-    ti_var_t slot = ti_Open(name, "w");
-    if (!slot) return; // Failed to create
+    ti_var_t slot = program ? ti_OpenVar(name, "w", TI_PPRGM_TYPE) : ti_Open(name, "w");
+    if (!slot) return 0; // Failed to create
 
-    // Write the assembled code into the VAT program
-    ti_Write((void*)CODE_START, 1, code_size, slot);
+    if (program) {
+        ti_Write(asm_header, 1, sizeof(asm_header), slot);
+    }
+
+    // Only programs can unpack themselves; keep the raw image unless
+    // packing actually saves space
+    uint8_t *packed = program && compress ? malloc(pack_bound(code_size)) : NULL;
+    size_t packed_size = packed ? pack_program(CODE_BASE, code_size, packed, pack_bound(code_size)) : 0;
+    if (packed_size && packed_size < code_size) {
+        char buf[40];
+        ti_Write(packed, 1, packed_size, slot);
+        snprintf(buf, sizeof(buf), "Packed: %u -> %u bytes", (unsigned)code_size, (unsigned)packed_size);
+        console_print(buf);
+        console_newline();
+    } else {
+        ti_Write(CODE_BASE, 1, code_size, slot);
+    }
+    free(packed);
 
     // Optionally archive it
     ti_SetArchiveStatus(true, slot);
 
     ti_Close(slot);
+    return 1;
 }
 
-void linker_run(void) {
-    // Save to VAT before running
-    linker_save_to_vat("BUILT");
+// Save to the VAT, then run the image in the code buffer. Returns 0 if it
+// could not be moved there. The host build runs it in its eZ80 stand-in.
+int linker_run(void) {
+#ifdef HOST_BUILD
+    return host_run(CODE_BASE, code_size, origin);
+#else
+    linker_save("BUILT");
 
-    // Jump to assembled code in RAM
-    ((void(*)())CODE_START)();
-}
\ No newline at end of file
+    if (reloc_overflow) {
+        console_print("Too many relocations\n");
+        return 0;
+    }
+    uint8_t *base = CODE_BASE + ((origin - (uint24_t)(uintptr_t)CODE_BASE) & 0xFF);
+    memmove(base, CODE_BASE, code_size);
+    image_base = base;
+    uint24_t delta = (uint24_t)(uintptr_t)base - origin;
+    for (uint16_t i = 0; i < reloc_count; i++) {
+        uint8_t *field = base + (relocs[i] & ~RELOC_24);
+        uint24_t value = field[0] | (field[1] << 8);
+        if (relocs[i] & RELOC_24) {
+            value |= (uint24_t)field[2] << 16;
+            value += delta;
+            field[2] = (value >> 16) & 0xFF;
+        } else {
+            value += delta;
+        }
+        field[0] = value & 0xFF;
+        field[1] = (value >> 8) & 0xFF;
+    }
+
+    // Jump to the image in the code buffer
+    ((void(*)())base)();
+    return 1;
+#endif
+}
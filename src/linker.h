@@ -2,12 +2,29 @@
 #define LINKER_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 
-#define CODE_START 0xD000
+#ifdef __INTELLISENSE__
+typedef unsigned long uint24_t;
+#endif
+
+#define USER_MEM 0xD1A881       // where the OS runs assembly programs
+#define ORIGIN_DEFAULT USER_MEM
 #define CODE_MAX_SIZE 8192
+#define MAX_RELOCS 512          // absolute addresses moved for an in-place run
 
 void linker_reset();
+void linker_set_origin(uint24_t origin);
+uint24_t linker_origin(void);
+void linker_set_compress(bool compress);
 int linker_emit(const uint8_t *bytes, uint8_t length);
-void linker_run();
+uint8_t *linker_reserve(size_t length);
+int linker_seek(size_t offset);
+void linker_reloc_at(const uint8_t *field, uint8_t width);
+uint8_t *linker_image(void);
+size_t linker_size(void);
+int linker_save(const char *name);
+int linker_run();
 
-#endif
\ No newline at end of file
+#endif
@@ -4,8 +4,28 @@
 #include <ctype.h>
 #include <fileioc.h>
 #include <stdlib.h> // for atoi()
+#include <time.h>
 #include "opcodes.h"
 #include "linker.h"
+#include "tables.h"
+#include "options.h"
+#include "profile.h"
+#include "bench.h"
+#include "shake.h"
+#include "libindex.h"
+#include "console.h"
+#include "diag.h"
+#include "srcmap.h"
+#include "symmap.h"
+#include "disasm.h"
+#include "pack.h"
+#include "pool.h"
+#include "timing.h"
+#include "runtime.h"
+#include "switch.h"
+#include "align.h"
+#include "hot.h"
+#include "assembler.h"
 #include "version.h"
 #include <stdint.h>
 #include <stdbool.h>
@@ -13,6 +33,7 @@
 
 #define MAX_LABELS 64
 #define LABEL_NAME_LEN 16
+#define MAX_LOCAL_LABELS 32 // .name, @@, + and - labels per scope
 
 #ifdef __INTELLISENSE__
 typedef unsigned long uint24_t;
@@ -23,11 +44,14 @@ typedef unsigned long uint24_t;
 char **stored_lines = NULL; // pointer to array of char*
 uint16_t stored_count = 0;  // number of lines read
 uint16_t capacity = 0;      // allocated capacity
+uint8_t *stored_files = NULL; // per line: 0 for ASRC, else the include it came from
+uint16_t *stored_numbers = NULL; // per line: its line number in that file
 
 typedef struct
 {
     char name[LABEL_NAME_LEN];
     uint24_t address;
+    bool constant; // from .equ: a value, not a code address
 } Label;
 
 Label labels[MAX_LABELS];
@@ -37,13 +61,115 @@ uint8_t label_count = 0;
 
 #define MAX_INCLUDE_DEPTH 8
 
+#define MAX_COND_DEPTH 8     // nested .if blocks
+#define MAX_CONDITIONALS 256 // evaluated .if/.ifdef/.ifndef per build
+
+// Conditional assembly directives, the only words the skip scanner recognizes
+typedef enum
+{
+    COND_NONE,
+    COND_IF,
+    COND_IFDEF,
+    COND_IFNDEF,
+    COND_ELSE,
+    COND_ENDIF
+} CondKind;
+
+// --profile: counters live in a block appended after the last pass 1 address
+static uint24_t profile_base = 0;
+static uint8_t profile_next = 0; // pass 2 counter index
+
+// Pass 1 condition outcomes, replayed in pass 2 so both passes take the same branches
+static uint8_t cond_taken[MAX_CONDITIONALS / 8];
+
 // helper struct for read result
 typedef struct
 {
     char **lines;
+    uint16_t *numbers; // line number of each line in its file, from 1
     uint16_t count;
 } LinesResult;
 
+#define SOURCE_APPVAR "ASRC"
+#define STATUS_APPVAR "ASTAT"
+
+#define VIEW_COLUMNS 26 // home screen characters per line
+#define VIEW_ROWS 9     // disassembly lines per --view page
+
+#define MAX_SOURCE_STAMPS 16
+#define MAX_CACHED_INCLUDES 8
+
+// --session: size and checksum of an AppVar the last load read
+typedef struct
+{
+    char name[9];
+    uint16_t size;
+    uint16_t sum;
+} SourceStamp;
+
+static SourceStamp source_stamps[MAX_SOURCE_STAMPS];
+static uint8_t source_stamp_count = 0;
+static bool source_stamps_full = false;
+
+// --session: include lines kept between builds, reused while the AppVar is unchanged
+typedef struct
+{
+    SourceStamp stamp;
+    LinesResult lines;
+} CachedInclude;
+
+static CachedInclude include_cache[MAX_CACHED_INCLUDES];
+static uint8_t include_cache_count = 0;
+
+static uint24_t pass1_end = 0; // end of .data after the last pass 1, kept for session re-runs of pass 2
+
+// Sections, laid out as: BSS clear stub, .text, .data, profile counters, .bss
+typedef enum
+{
+    SECTION_TEXT,
+    SECTION_DATA,
+    SECTION_BSS,
+    SECTION_COUNT
+} Section;
+
+#define BSS_STUB_SIZE 16  // ld hl,bss / ld (hl),0 / ld de,bss+1 / ld bc,size-1 / ldir
+#define MAX_LAYOUT_PASSES 8 // .org moves and --relax sizes settle within this
+
+static uint24_t section_base[SECTION_COUNT]; // program offsets from the last layout
+static uint24_t section_pc[SECTION_COUNT];   // location counters of the current pass
+static bool section_used[SECTION_COUNT];     // named by a directive in the current pass
+static uint8_t current_section = SECTION_TEXT;
+static uint24_t bss_size = 0; // bytes the stub clears, 0 for no stub
+
+static uint24_t origin = ORIGIN_DEFAULT;      // address of the first image byte, from the last layout
+static uint24_t org_request = ORIGIN_DEFAULT; // origin the current pass asked for with .org
+static uint16_t pool_skip = 0;                 // last line of a block --pool left out
+
+static bool adl_mode = true;        // .adl: addresses are 24 bits unless a suffix says otherwise
+static uint8_t *line_choice = NULL; // per line: the match pass 1 picked, replayed in pass 2
+static bool size_guess = false;     // pass 1 sized an instruction by a label it had not seen yet
+static Label prev_labels[MAX_LABELS]; // labels of the previous pass 1, for those guesses
+static uint8_t prev_label_count = 0;
+
+// Labels of the current scope, the lines from one global label to the
+// next: .name, and anonymous @@, + or - (kept with an empty name). Pass 1
+// sets their addresses per line, so the table is rebuilt from the source
+// whenever a scope opens and the global table only holds global labels.
+typedef struct
+{
+    char name[LABEL_NAME_LEN];
+    uint16_t line;
+} LocalLabel;
+
+static LocalLabel scope_labels[MAX_LOCAL_LABELS];
+static uint8_t scope_count = 0;
+static uint24_t *line_address = NULL; // per line: address of a local label defined there
+
+static uint16_t pending_trips = 0; // .trips for the next instruction
+
+// Copy of the line being assembled; diagnostics take their column from it
+static const char *line_start = NULL;
+
 void trim(char *str)
 {
     size_t len = strlen(str);
@@ -53,42 +179,278 @@ void trim(char *str)
     }
 }
 
-void add_label(const char *name, uint24_t address)
+// Record an error on a stored line at the position of token in line_start.
+// A token copied out of the line (a matched operand) is looked up by its text.
+static void report_error(DiagKind kind, uint24_t line_number, const char *token)
 {
-    if (label_count < MAX_LABELS)
+    uint8_t column = 0;
+    if (line_start && token && token >= line_start && token < line_start + 256) // both line copies are 256 bytes
+        column = (uint8_t)(token - line_start + 1);
+    else if (line_start && token && *token)
     {
-        strncpy(labels[label_count].name, name, LABEL_NAME_LEN);
-        labels[label_count].name[LABEL_NAME_LEN - 1] = '\0';
-        labels[label_count].address = address;
-        label_count++;
+        const char *found = strstr(stored_lines[line_number], token);
+        column = found ? (uint8_t)(found - stored_lines[line_number] + 1) : 0;
     }
+    diag_error(kind, stored_files[line_number], stored_numbers[line_number], column);
 }
 
-int find_label(const char *name, uint24_t *out_addr)
+// Grow stored_lines, stored_files and stored_numbers together to hold at least needed lines
+static bool grow_lines(size_t needed)
+{
+    size_t new_cap = capacity;
+    while (new_cap < needed)
+        new_cap += (MIN_ALLOC_SIZE / sizeof(char *));
+    char **new_mem = realloc(stored_lines, new_cap * sizeof(char *));
+    if (!new_mem)
+        return false;
+    stored_lines = new_mem;
+    uint8_t *new_files = realloc(stored_files, new_cap);
+    if (!new_files)
+        return false;
+    stored_files = new_files;
+    uint16_t *new_numbers = realloc(stored_numbers, new_cap * sizeof(uint16_t));
+    if (!new_numbers)
+        return false;
+    stored_numbers = new_numbers;
+    capacity = new_cap;
+    return true;
+}
+
+// False when the table is full; the caller reports it at the defining line
+bool add_label(const char *name, uint24_t address, bool constant)
+{
+    if (label_count >= MAX_LABELS)
+        return false;
+    strncpy(labels[label_count].name, name, LABEL_NAME_LEN);
+    labels[label_count].name[LABEL_NAME_LEN - 1] = '\0';
+    labels[label_count].address = address;
+    labels[label_count].constant = constant;
+    label_count++;
+    return true;
+}
+
+// Index of a label in labels[], or -1
+static int label_index(const char *name)
 {
     for (uint8_t i = 0; i < label_count; i++)
     {
         if (strcmp(labels[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// Is name (without its colon) a local or anonymous label?
+static bool is_local_name(const char *name)
+{
+    return name[0] == '.' || strcmp(name, "@@") == 0 || strcmp(name, "+") == 0 || strcmp(name, "-") == 0;
+}
+
+// Label defined on a stored line, copied to out without its colon, or false
+static bool line_label(uint16_t line, char *out, size_t size)
+{
+    const char *p = stored_lines[line];
+    while (*p == ' ' || *p == '\t')
+        p++;
+    size_t n = strcspn(p, " \t;");
+    if (n < 2 || p[n - 1] != ':')
+        return false;
+    n = n - 1 < size - 1 ? n - 1 : size - 1;
+    memcpy(out, p, n);
+    out[n] = '\0';
+    return true;
+}
+
+// Fill the scope table with the local labels from line first up to the
+// next global label. Past MAX_LOCAL_LABELS the rest are left out.
+static void open_scope(uint16_t first)
+{
+    scope_count = 0;
+    for (uint16_t i = first; i < stored_count; i++)
+    {
+        char name[LABEL_NAME_LEN];
+        if (!line_label(i, name, sizeof(name)))
+            continue;
+        if (!is_local_name(name))
         {
-            *out_addr = labels[i].address;
-            return 1;
+            if (i == first)
+                continue;
+            break;
+        }
+        if (scope_count < MAX_LOCAL_LABELS)
+        {
+            LocalLabel *local = &scope_labels[scope_count++];
+            strcpy(local->name, name[0] == '.' ? name : "");
+            local->line = i;
         }
     }
-    return 0;
+}
+
+// Resolve a reference to a local label from line: .name, or an anonymous
+// one as + / @f (next), - / @b (previous), ++ / -- and so on for further
+// ones. Returns -1 if arg is no such reference, 0 if the scope has no
+// such label, else 1 with ahead set when it is defined after line.
+static int8_t local_label(const char *arg, uint16_t line, uint24_t *out, bool *ahead)
+{
+    int16_t step = 0;
+    if (strcasecmp(arg, "@f") == 0)
+        step = 1;
+    else if (strcasecmp(arg, "@b") == 0)
+        step = -1;
+    else if (arg[0] == '+' || arg[0] == '-')
+    {
+        size_t n = strspn(arg, arg[0] == '+' ? "+" : "-");
+        if (arg[n] != '\0')
+            return -1;
+        step = arg[0] == '+' ? (int16_t)n : -(int16_t)n;
+    }
+    else if (arg[0] != '.')
+        return -1;
+
+    const LocalLabel *found = NULL;
+    if (step > 0)
+    {
+        for (uint8_t i = 0; i < scope_count && !found; i++)
+        {
+            if (!scope_labels[i].name[0] && scope_labels[i].line > line && --step == 0)
+                found = &scope_labels[i];
+        }
+    }
+    else if (step < 0)
+    {
+        for (uint8_t i = scope_count; i > 0 && !found; i--)
+        {
+            if (!scope_labels[i - 1].name[0] && scope_labels[i - 1].line <= line && ++step == 0)
+                found = &scope_labels[i - 1];
+        }
+    }
+    else
+    {
+        for (uint8_t i = 0; i < scope_count && !found; i++)
+        {
+            if (strcmp(scope_labels[i].name, arg) == 0)
+                found = &scope_labels[i];
+        }
+    }
+    if (!found)
+        return 0;
+    *out = line_address[found->line];
+    *ahead = found->line > line;
+    return 1;
+}
+
+// Pass 1: define the label on line. A local one only records its address
+// for the scope table; a global one also starts a routine for tree shaking.
+static void define_label(const char *name, uint16_t line, uint24_t address, uint24_t pc)
+{
+    if (is_local_name(name))
+    {
+        line_address[line] = address;
+        return;
+    }
+    if (!add_label(name, address, false))
+        report_error(DIAG_TOO_MANY_LABELS, line, name);
+    shake_begin_routine(name, line, pc, stored_files[line] != 0);
+    align_block(line, pc, current_section, adl_mode);
+}
+
+int find_label(const char *name, uint24_t *out_addr)
+{
+    int index = label_index(name);
+    if (index < 0)
+        return 0;
+    *out_addr = labels[index].address;
+    return 1;
+}
+
+// Free a LinesResult and leave it empty
+static void free_lines(LinesResult *res)
+{
+    for (uint16_t i = 0; i < res->count; i++)
+        free(res->lines[i]);
+    free(res->lines);
+    free(res->numbers);
+    res->lines = NULL;
+    res->numbers = NULL;
+    res->count = 0;
+}
+
+// Append a copy of buf, found at line number of its file, to res, growing
+// in MIN_ALLOC_SIZE chunks. On allocation failure res is freed and false is returned.
+static bool push_line(LinesResult *res, uint16_t *cap, const char *buf, uint16_t number)
+{
+    if (res->count >= *cap)
+    {
+        size_t newcap = *cap + (MIN_ALLOC_SIZE / sizeof(char *));
+        char **newmem = realloc(res->lines, newcap * sizeof(char *));
+        if (!newmem)
+        {
+            free_lines(res);
+            return false;
+        }
+        res->lines = newmem;
+        uint16_t *newnumbers = realloc(res->numbers, newcap * sizeof(uint16_t));
+        if (!newnumbers)
+        {
+            free_lines(res);
+            return false;
+        }
+        res->numbers = newnumbers;
+        *cap = newcap;
+    }
+    size_t len = strlen(buf) + 1;
+    res->lines[res->count] = malloc(len);
+    if (!res->lines[res->count])
+    {
+        free_lines(res);
+        return false;
+    }
+    memcpy(res->lines[res->count], buf, len);
+    res->numbers[res->count] = number;
+    res->count++;
+    return true;
+}
+
+// Split len bytes of text, starting at line number, into lines appended to
+// res. Lines longer than 255 characters are truncated, empty lines are dropped.
+static bool push_text_lines(LinesResult *res, uint16_t *cap, const uint8_t *text, uint16_t len, uint16_t number)
+{
+    char buf[256];
+    uint16_t pos = 0;
+    for (uint16_t i = 0; i <= len; i++)
+    {
+        if (i == len || text[i] == '\n' || text[i] == '\r')
+        {
+            if (pos > 0)
+            {
+                buf[pos] = '\0';
+                if (!push_line(res, cap, buf, number))
+                    return false;
+                pos = 0;
+            }
+            if (i < len && text[i] == '\n')
+                number++;
+        }
+        else if (pos < sizeof(buf) - 1)
+        {
+            buf[pos++] = text[i];
+        }
+    }
+    return true;
 }
 
 // Read an AppVar into a LinesResult. Caller must free lines and each line.
 static LinesResult read_appvar_lines(const char *name)
 {
-    LinesResult res = {NULL, 0};
+    LinesResult res = {NULL, NULL, 0};
     ti_var_t f = ti_Open(name, "r");
     if (!f)
         return res;
     uint8_t ch;
     char buf[256];
     uint16_t pos = 0;
-    uint16_t count = 0;
     uint16_t cap = 0;
+    uint16_t number = 1;
 
     while (ti_Read(&ch, 1, 1, f) == 1)
     {
@@ -97,39 +459,15 @@ static LinesResult read_appvar_lines(const char *name)
             if (pos > 0)
             {
                 buf[pos] = '\0';
-                if (count >= cap)
-                {
-                    size_t newcap = cap + (MIN_ALLOC_SIZE / sizeof(char *));
-                    char **newmem = realloc(res.lines, newcap * sizeof(char *));
-                    if (!newmem)
-                    { // cleanup and return empty
-                        for (uint16_t i = 0; i < count; i++)
-                            free(res.lines[i]);
-                        free(res.lines);
-                        res.lines = NULL;
-                        res.count = 0;
-                        ti_Close(f);
-                        return res;
-                    }
-                    res.lines = newmem;
-                    cap = newcap;
-                }
-                size_t len = strlen(buf) + 1;
-                res.lines[count] = malloc(len);
-                if (!res.lines[count])
+                if (!push_line(&res, &cap, buf, number))
                 {
-                    for (uint16_t i = 0; i < count; i++)
-                        free(res.lines[i]);
-                    free(res.lines);
-                    res.lines = NULL;
-                    res.count = 0;
                     ti_Close(f);
                     return res;
                 }
-                memcpy(res.lines[count], buf, len);
-                count++;
                 pos = 0;
             }
+            if (ch == '\n')
+                number++;
         }
         else if (pos < sizeof(buf) - 1)
         {
@@ -140,44 +478,325 @@ static LinesResult read_appvar_lines(const char *name)
     if (pos > 0)
     {
         buf[pos] = '\0';
-        if (count >= cap)
+        push_line(&res, &cap, buf, number);
+    }
+
+    ti_Close(f);
+    return res;
+}
+
+// Resolve an operand to a value: label reference or numeric literal.
+// Undefined labels are 0 in pass 1 and an error in pass 2. address, when
+// given, is set if the value is a code address that moves with the origin.
+static bool resolve_operand(const char *arg, bool pass2, uint24_t line_number, unsigned long *out, bool *address)
+{
+    if (address)
+        *address = false;
+    uint24_t local;
+    bool ahead;
+    int8_t found = local_label(arg, (uint16_t)line_number, &local, &ahead);
+    if (found >= 0)
+    {
+        // the placeholder in pass 1 is the address the last pass 1 gave it
+        if (!found && pass2)
         {
-            size_t newcap = cap + (MIN_ALLOC_SIZE / sizeof(char *));
-            char **newmem = realloc(res.lines, newcap * sizeof(char *));
-            if (!newmem)
-            {
-                for (uint16_t i = 0; i < count; i++)
-                    free(res.lines[i]);
-                free(res.lines);
-                res.lines = NULL;
-                res.count = 0;
-                ti_Close(f);
-                return res;
-            }
-            res.lines = newmem;
-            cap = newcap;
+            report_error(DIAG_UNDEFINED_LABEL, line_number, arg);
+            return false;
+        }
+        *out = found ? local : 0;
+        if (address)
+            *address = found;
+    }
+    else if (isalpha((unsigned char)arg[0]) || arg[0] == '_')
+    {
+        shake_note_reference(arg);
+        uint24_t addr = 0; // placeholder in pass1
+        int index = label_index(arg);
+        if (index >= 0)
+        {
+            addr = labels[index].address;
+            if (address)
+                *address = !labels[index].constant;
+        }
+        else if (pass2)
+        {
+            report_error(DIAG_UNDEFINED_LABEL, line_number, arg);
+            return false;
+        }
+        *out = addr;
+    }
+    else
+    {
+        char *end;
+        *out = strtoul(arg, &end, 0);
+        if (end == arg || *end != '\0')
+        {
+            report_error(DIAG_BAD_OPERAND, line_number, arg);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Emit an item in pass 2. When address is set its last width bytes hold an
+// address, recorded so the image can run somewhere other than its origin.
+static bool emit_item(const uint8_t *bytes, uint8_t length, bool address, uint8_t width)
+{
+    uint8_t *out = linker_reserve(length);
+    if (!out)
+        return false;
+    memcpy(out, bytes, length);
+    if (address)
+        linker_reloc_at(out + length - width, width);
+    return true;
+}
+
+// Pass 1 value of an instruction operand on line, for choosing its
+// encoding. A label not defined yet has the address it had in the previous
+// pass 1 and sets guessed; false if there was none.
+static bool peek_operand(const char *expr, uint16_t line, unsigned long *value, bool *guessed)
+{
+    uint24_t local;
+    bool ahead = false;
+    int8_t found = local_label(expr, line, &local, &ahead);
+    if (found >= 0)
+    {
+        if (!found || ahead)
+            *guessed = true;
+        *value = found ? local : 0;
+        return found && (!ahead || local != 0);
+    }
+    if (!isalpha((unsigned char)expr[0]) && expr[0] != '_')
+    {
+        // a malformed number is reported when the line is encoded
+        char *end;
+        *value = strtoul(expr, &end, 0);
+        return end != expr && *end == '\0';
+    }
+    int index = label_index(expr);
+    if (index >= 0)
+    {
+        *value = labels[index].address;
+        return true;
+    }
+    *guessed = true;
+    for (uint8_t i = 0; i < prev_label_count; i++)
+    {
+        if (strcmp(prev_labels[i].name, expr) == 0)
+        {
+            *value = prev_labels[i].address;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Does value fit the operand? next is the address after the instruction,
+// which jr offsets count from.
+static bool operand_fits(HoleKind hole, unsigned long value, uint24_t next)
+{
+    long v = (long)value;
+    switch (hole)
+    {
+    case HOLE_BYTE:
+        return v >= -128 && v <= 255;
+    case HOLE_DISP:
+        return v >= -128 && v <= 127;
+    case HOLE_REL:
+        v -= (long)next;
+        return v >= -128 && v <= 127;
+    default:
+        return true;
+    }
+}
+
+// Pass 1: pick the smallest match whose operand fits, or the largest when
+// none does or a label is still unknown. extra counts a suffix prefix.
+static uint8_t choose_match(const Match *matches, uint8_t count, bool wide, uint8_t extra, uint24_t pc, uint16_t line)
+{
+    uint8_t best = 0xFF;
+    uint8_t largest = 0;
+    bool guessed = false;
+    bool unknown = false;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        uint8_t size = extra + instruction_size(matches[i].inst, wide);
+        if (size > extra + instruction_size(matches[largest].inst, wide))
+            largest = i;
+        unsigned long value = 0;
+        if (matches[i].hole != HOLE_NONE && !peek_operand(matches[i].expr, line, &value, &guessed))
+        {
+            unknown = true;
+            continue;
+        }
+        if (operand_fits(matches[i].hole, value, origin + pc + size) &&
+            (best == 0xFF || size < extra + instruction_size(matches[best].inst, wide)))
+            best = i;
+    }
+    uint8_t pick = (unknown || best == 0xFF) ? largest : best;
+    // only a choice between sizes needs the labels to settle
+    for (uint8_t i = 0; i < count && (guessed || unknown); i++)
+    {
+        if (instruction_size(matches[i].inst, wide) != instruction_size(matches[pick].inst, wide))
+        {
+            size_guess = true;
+            break;
         }
-        size_t len = strlen(buf) + 1;
-        res.lines[count] = malloc(len);
-        if (!res.lines[count])
+    }
+    return pick;
+}
+
+// Copy every line of src into a fresh dst. Out of memory, dst is left
+// empty (never a partial copy) and false is returned.
+static bool copy_lines(const LinesResult *src, LinesResult *dst)
+{
+    uint16_t cap = 0;
+    dst->lines = NULL;
+    dst->numbers = NULL;
+    dst->count = 0;
+    for (uint16_t i = 0; i < src->count; i++)
+    {
+        if (!push_line(dst, &cap, src->lines[i], src->numbers[i]))
         {
-            for (uint16_t i = 0; i < count; i++)
-                free(res.lines[i]);
-            free(res.lines);
-            res.lines = NULL;
-            res.count = 0;
-            ti_Close(f);
-            return res;
+            free_lines(dst);
+            return false;
         }
-        memcpy(res.lines[count], buf, len);
-        count++;
     }
+    return true;
+}
 
+// Size and Fletcher-16 checksum of an AppVar, read in place
+static bool appvar_stamp(const char *name, SourceStamp *stamp)
+{
+    ti_var_t f = ti_Open(name, "r");
+    if (!f)
+        return false;
+    const uint8_t *data = ti_GetDataPtr(f);
+    uint16_t size = ti_GetSize(f);
+    uint16_t sum = libindex_checksum(data, size);
     ti_Close(f);
-    res.count = count;
+
+    strncpy(stamp->name, name, sizeof(stamp->name) - 1);
+    stamp->name[sizeof(stamp->name) - 1] = '\0';
+    stamp->size = size;
+    stamp->sum = sum;
+    return true;
+}
+
+// --session: remember an input of this load so a rebuild can tell if it changed
+static void record_stamp(const char *name)
+{
+    if (!build_options.session)
+        return;
+    for (uint8_t i = 0; i < source_stamp_count; i++)
+    {
+        if (strncmp(source_stamps[i].name, name, sizeof(source_stamps[i].name) - 1) == 0)
+            return; // .incbin assets are seen again by every pass 1
+    }
+    if (source_stamp_count >= MAX_SOURCE_STAMPS)
+        source_stamps_full = true;
+    else if (appvar_stamp(name, &source_stamps[source_stamp_count]))
+        source_stamp_count++;
+}
+
+#ifndef HOST_BUILD
+// --session: has any input of the last load changed or disappeared?
+static bool sources_changed(void)
+{
+    if (source_stamps_full)
+        return true;
+    for (uint8_t i = 0; i < source_stamp_count; i++)
+    {
+        SourceStamp now;
+        if (!appvar_stamp(source_stamps[i].name, &now) || now.size != source_stamps[i].size ||
+            now.sum != source_stamps[i].sum)
+            return true;
+    }
+    return false;
+}
+#endif
+
+// Read an include. In a session or batch, unchanged includes come from the
+// cache instead of being read and split again.
+static LinesResult read_include_lines(const char *name)
+{
+    LinesResult res = {NULL, NULL, 0};
+    SourceStamp stamp;
+    bool cached = build_options.session || build_options.batch[0];
+    if (!cached || !appvar_stamp(name, &stamp))
+        return read_appvar_lines(name);
+
+    CachedInclude *slot = NULL;
+    for (uint8_t i = 0; i < include_cache_count; i++)
+    {
+        if (strcmp(include_cache[i].stamp.name, name) == 0)
+            slot = &include_cache[i];
+    }
+    if (slot && slot->stamp.size == stamp.size && slot->stamp.sum == stamp.sum)
+    {
+        // out of memory: no lines, so the include fails as an unreadable one does
+        if (!copy_lines(&slot->lines, &res))
+            free_lines(&res);
+        return res;
+    }
+
+    res = read_appvar_lines(name);
+    if (!res.lines)
+        return res;
+    if (!slot && include_cache_count < MAX_CACHED_INCLUDES)
+        slot = &include_cache[include_cache_count++];
+    if (slot)
+    {
+        free_lines(&slot->lines);
+        slot->stamp = stamp;
+        if (!copy_lines(&res, &slot->lines))
+            slot->stamp.name[0] = '\0'; // out of memory: never matches again
+    }
     return res;
 }
 
+// Line number of the byte at offset in text
+static uint16_t text_line_at(const uint8_t *text, uint16_t offset)
+{
+    uint16_t number = 1;
+    for (uint16_t i = 0; i < offset; i++)
+    {
+        if (text[i] == '\n')
+            number++;
+    }
+    return number;
+}
+
+// Load only the routines of an indexed library that the program names
+// (plus their dependencies and the library's preamble), reading the
+// library text in place. Returns false on memory errors.
+static bool read_indexed_lines(const LibIndex *idx, LinesResult *res)
+{
+    static bool selected[LIBINDEX_MAX_ROUTINES];
+    uint16_t cap = 0;
+    memset(selected, 0, sizeof(selected));
+
+    for (uint16_t i = 0; i < stored_count; i++)
+        libindex_select_referenced(idx, stored_lines[i], selected);
+
+    if (!push_text_lines(res, &cap, idx->text, idx->preamble, 1))
+        return false;
+    for (uint8_t r = 0; r < idx->count; r++)
+    {
+        uint16_t offset, length;
+        if (!selected[r])
+            continue;
+        libindex_range(idx, r, &offset, &length);
+        if (offset + length > idx->text_size ||
+            !push_text_lines(res, &cap, idx->text + offset, length, text_line_at(idx->text, offset)))
+        {
+            free_lines(res);
+            return false;
+        }
+    }
+    return true;
+}
+
 // parse include directive line and extract filename (returns malloc'd string or NULL)
 static char *parse_include_filename(const char *line)
 {
@@ -225,6 +844,7 @@ static bool process_includes(void)
     // simple stack to detect recursion and depth
     char *include_stack[MAX_INCLUDE_DEPTH];
     int depth = 0;
+    uint8_t include_id = 0; // tags spliced lines in stored_files
 
     // We'll iterate through stored_lines and build a new array in-place
     uint16_t i = 0;
@@ -245,7 +865,7 @@ static bool process_includes(void)
         // check recursion depth
         if (depth >= MAX_INCLUDE_DEPTH)
         {
-            os_PutStrFull("Include depth exceeded\n");
+            console_print("Include depth exceeded\n");
             free(fname);
             return false;
         }
@@ -261,15 +881,44 @@ static bool process_includes(void)
         }
         if (cycle)
         {
-            os_PutStrFull("Include cycle detected\n");
+            console_print("Include cycle detected\n");
             free(fname);
             return false;
         }
-        // read included file
-        LinesResult inc = read_appvar_lines(fname);
-        if (!inc.lines || inc.count == 0)
+        if (include_id == 0xFF)
         {
-            os_PutStrFull("Include file not found or empty\n");
+            console_print("Too many includes\n");
+            free(fname);
+            return false;
+        }
+        include_id++;
+        diag_name_file(include_id, fname);
+        // read included file, through its index when one was built
+        LinesResult inc = {NULL, NULL, 0};
+        LibIndex idx;
+        bool indexed = libindex_open(fname, &idx);
+        record_stamp(fname);
+        if (indexed)
+        {
+            char idx_name[9];
+            libindex_name(fname, idx_name);
+            record_stamp(idx_name);
+            bool loaded = read_indexed_lines(&idx, &inc);
+            libindex_close(&idx);
+            if (!loaded)
+            {
+                console_print("Memory error expanding includes\n");
+                free(fname);
+                return false;
+            }
+        }
+        else
+        {
+            inc = read_include_lines(fname);
+        }
+        if (!indexed && (!inc.lines || inc.count == 0))
+        {
+            console_print("Include file not found or empty\n");
             free(fname);
             return false;
         }
@@ -279,23 +928,13 @@ static bool process_includes(void)
         if (new_count > capacity)
         {
             // grow capacity in same chunk style
-            size_t needed = new_count;
-            size_t newcap = capacity;
-            while (newcap < needed)
-                newcap += (MIN_ALLOC_SIZE / sizeof(char *));
-            char **newmem = realloc(stored_lines, newcap * sizeof(char *));
-            if (!newmem)
+            if (!grow_lines(new_count))
             {
-                os_PutStrFull("Memory error expanding includes\n");
-                // cleanup inc
-                for (uint16_t k = 0; k < inc.count; k++)
-                    free(inc.lines[k]);
-                free(inc.lines);
+                console_print("Memory error expanding includes\n");
+                free_lines(&inc);
                 free(fname);
                 return false;
             }
-            stored_lines = newmem;
-            capacity = newcap;
         }
         // shift tail down/up to make room or close gap
         if (inc.count > 1)
@@ -304,13 +943,21 @@ static bool process_includes(void)
             for (uint16_t t = stored_count; t > i + 1; t--)
             {
                 stored_lines[t - 1 + (inc.count - 1)] = stored_lines[t - 1];
+                stored_files[t - 1 + (inc.count - 1)] = stored_files[t - 1];
+                stored_numbers[t - 1 + (inc.count - 1)] = stored_numbers[t - 1];
             }
         }
         else if (inc.count == 0)
         {
             // nothing to insert, just remove line
+            free(stored_lines[i]);
+            free_lines(&inc);
             for (uint16_t t = i; t < stored_count - 1; t++)
+            {
                 stored_lines[t] = stored_lines[t + 1];
+                stored_files[t] = stored_files[t + 1];
+                stored_numbers[t] = stored_numbers[t + 1];
+            }
             stored_count--;
             free(fname);
             continue;
@@ -320,7 +967,10 @@ static bool process_includes(void)
             // replace in place
             free(stored_lines[i]);
             stored_lines[i] = inc.lines[0];
+            stored_files[i] = include_id;
+            stored_numbers[i] = inc.numbers[0];
             free(inc.lines);
+            free(inc.numbers);
             free(fname);
             // continue scanning after this line
             i++;
@@ -333,11 +983,14 @@ static bool process_includes(void)
         for (uint16_t k = 0; k < inc.count; k++)
         {
             stored_lines[i + k] = inc.lines[k];
+            stored_files[i + k] = include_id;
+            stored_numbers[i + k] = inc.numbers[k];
         }
         // update stored_count
         stored_count = new_count;
         // free inc.lines container (lines themselves moved)
         free(inc.lines);
+        free(inc.numbers);
         free(fname);
         // continue scanning after the inserted block
         i += inc.count;
@@ -345,10 +998,423 @@ static bool process_includes(void)
     return true;
 }
 
+// Append the runtime library routines the program names (and those they
+// call) after its last line, in .text and ADL mode. A routine the program
+// defines itself is left out. Returns false on memory errors.
+static bool splice_runtime(void)
+{
+    static bool selected[RUNTIME_MAX_ROUTINES];
+    static bool own[RUNTIME_MAX_ROUTINES];
+    uint8_t file = 0;
+    memset(selected, 0, sizeof(selected));
+    memset(own, 0, sizeof(own));
+
+    for (uint16_t i = 0; i < stored_count; i++)
+    {
+        char name[LABEL_NAME_LEN];
+        int routine;
+        if (stored_files[i] > file)
+            file = stored_files[i];
+        if (line_label(i, name, sizeof(name)) && (routine = runtime_find(name)) >= 0)
+            own[routine] = selected[routine] = true;
+    }
+    for (uint16_t i = 0; i < stored_count; i++)
+        runtime_select_referenced(stored_lines[i], selected);
+
+    LinesResult res = {NULL, NULL, 0};
+    uint16_t cap = 0;
+    for (uint8_t r = 0; r < runtime_count(); r++)
+    {
+        if (!selected[r] || own[r])
+            continue;
+        if (res.count == 0 && (!push_line(&res, &cap, ".text", 1) || !push_line(&res, &cap, ".adl 1", 1)))
+            return false;
+        const char *text = runtime_source(r);
+        if (!push_text_lines(&res, &cap, (const uint8_t *)text, strlen(text), runtime_first_line(r)))
+            return false;
+    }
+    if (res.count == 0)
+        return true;
+    if (file == 0xFF || !grow_lines(stored_count + res.count))
+    {
+        free_lines(&res);
+        return false;
+    }
+    diag_name_file(++file, RUNTIME_FILE);
+    for (uint16_t k = 0; k < res.count; k++)
+    {
+        stored_lines[stored_count] = res.lines[k];
+        stored_files[stored_count] = file;
+        stored_numbers[stored_count] = res.numbers[k];
+        stored_count++;
+    }
+    free(res.lines);
+    free(res.numbers);
+    return true;
+}
+
+// Classify a line by its leading directive word only. This is all the skip
+// scanner looks at, so lines in a false block never reach assemble_line().
+static CondKind cond_kind(const char *line, const char **rest)
+{
+    while (*line == ' ' || *line == '\t')
+        line++;
+    if (*line != '.')
+        return COND_NONE;
+    line++;
+    uint8_t n = 0;
+    while (n < 6 && isalpha((unsigned char)line[n]))
+        n++;
+    char end = line[n];
+    if (end != '\0' && end != ' ' && end != '\t' && end != ';')
+        return COND_NONE;
+
+    CondKind kind = COND_NONE;
+    if (n == 2 && strncasecmp(line, "if", 2) == 0)
+        kind = COND_IF;
+    else if (n == 5 && strncasecmp(line, "ifdef", 5) == 0)
+        kind = COND_IFDEF;
+    else if (n == 6 && strncasecmp(line, "ifndef", 6) == 0)
+        kind = COND_IFNDEF;
+    else if (n == 4 && strncasecmp(line, "else", 4) == 0)
+        kind = COND_ELSE;
+    else if (n == 5 && strncasecmp(line, "endif", 5) == 0)
+        kind = COND_ENDIF;
+
+    if (kind != COND_NONE && rest)
+        *rest = line + n;
+    return kind;
+}
+
+// Classify the first word after a label: 1 code, 0 data, -1 unknown
+// (nothing, a comment, another label or a conditional directive)
+static int8_t classify_word(const char *word)
+{
+    if (!word || word[0] == '\0' || word[0] == ';')
+        return -1;
+    if (word[strlen(word) - 1] == ':' || cond_kind(word, NULL) != COND_NONE)
+        return -1;
+    if (word[0] == '.' || strcasecmp(word, "db") == 0 || strcasecmp(word, "dw") == 0 ||
+        strcasecmp(word, "dl") == 0)
+        return 0;
+    return 1;
+}
+
+// Does the label on this line start a routine? Data labels must not get a
+// profile stub. Looks past the label on its own line, then a few lines ahead.
+static bool label_starts_routine(const char *after, uint24_t line_number)
+{
+    int8_t kind = classify_word(after);
+    for (uint24_t i = line_number + 1; kind < 0 && i < stored_count && i <= line_number + 8; i++)
+    {
+        char word[32];
+        const char *p = stored_lines[i];
+        uint8_t n = 0;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        while (*p && *p != ' ' && *p != '\t' && n < sizeof(word) - 1)
+            word[n++] = *p++;
+        word[n] = '\0';
+        kind = classify_word(word);
+    }
+    return kind == 1;
+}
+
+// --profile: insert the entry counter sequence for a routine label
+static void emit_profile_stub(const char *name, uint24_t *pc, bool pass2, uint24_t line_number)
+{
+    int index;
+    if (!pass2)
+    {
+        index = profile_add_routine(name);
+        if (index < 0)
+            return; // out of counters: routine stays uninstrumented
+    }
+    else
+    {
+        if (profile_next >= profile_routine_count())
+            return;
+        index = profile_next++;
+    }
+
+    if (pass2)
+    {
+        uint8_t *stub = linker_reserve(PROFILE_STUB_SIZE);
+        if (!stub)
+        {
+            report_error(DIAG_CODE_FULL, line_number, name);
+            return;
+        }
+        profile_stub(stub, origin + profile_base + index * PROFILE_COUNTER_SIZE);
+    }
+    *pc += PROFILE_STUB_SIZE;
+}
+
+// Advance pc by count zero bytes, which .bss only reserves
+static void reserve_space(uint24_t count, uint24_t *pc, bool pass2, uint24_t line_number, const char *token)
+{
+    if (pass2 && current_section != SECTION_BSS)
+    {
+        uint8_t *block = linker_reserve(count);
+        if (!block)
+        {
+            report_error(DIAG_CODE_FULL, line_number, token);
+            return;
+        }
+        memset(block, 0, count);
+    }
+    *pc += count;
+}
+
+// Section named by a directive word, or -1
+static int8_t section_kind(const char *word)
+{
+    if (strcasecmp(word, ".text") == 0)
+        return SECTION_TEXT;
+    if (strcasecmp(word, ".data") == 0)
+        return SECTION_DATA;
+    if (strcasecmp(word, ".bss") == 0)
+        return SECTION_BSS;
+    return -1;
+}
+
+// Bytes of a .db argument list: strings and numbers separated by commas,
+// up to a ; comment. Stores at most cap bytes and returns the full count;
+// bad, when given, is set to the first item that is not a number or NULL.
+static uint16_t db_parse(const char *p, uint8_t *out, uint16_t cap, const char **bad)
+{
+    uint16_t n = 0;
+    if (bad)
+        *bad = NULL;
+    for (;;)
+    {
+        while (*p == ' ' || *p == '\t' || *p == ',')
+            p++;
+        if (*p == '\0' || *p == ';')
+            return n;
+        if (*p == '"' || *p == '\'')
+        {
+            char quote = *p++;
+            for (; *p && *p != quote; p++, n++)
+            {
+                if (n < cap)
+                    out[n] = (uint8_t)*p;
+            }
+        }
+        else
+        {
+            char *end;
+            unsigned long value = strtoul(p, &end, 0);
+            while (*end == ' ' || *end == '\t')
+                end++;
+            if (bad && !*bad && (end == p || (*end && *end != ',' && *end != ';')))
+                *bad = p;
+            if (n < cap)
+                out[n] = (uint8_t)value;
+            n++;
+        }
+        while (*p && *p != ',' && *p != ';')
+            p++;
+    }
+}
+
+// Whether text is a .db line; points args at its arguments
+static bool is_db_line(const char *text, const char **args)
+{
+    while (*text == ' ' || *text == '\t')
+        text++;
+    if (*text == '.')
+        text++;
+    if (strncasecmp(text, "db", 2) != 0 || (text[2] != ' ' && text[2] != '\t' && text[2] != '\0'))
+        return false;
+    *args = text + 2;
+    return true;
+}
+
+// --pool: bytes of the data block labelled on line, i.e. the label line
+// and the lines after it as long as they hold .db (or nothing but a
+// comment). Returns 0 if there is no data or it is too long to pool.
+static uint16_t data_block(uint16_t line, uint8_t *out, uint16_t *last_line)
+{
+    char text[256];
+    uint16_t count = 0;
+    for (uint16_t i = line; i < stored_count; i++)
+    {
+        strncpy(text, stored_lines[i], sizeof(text));
+        text[255] = '\0';
+        char *p = text;
+        if (i == line)
+            p = strchr(text, ':') + 1;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '\0' || *p == ';')
+            continue;
+
+        const char *args;
+        if (!is_db_line(p, &args))
+            break;
+        const char *bad;
+        count += db_parse(args, out + count, POOL_MAX_BLOCK - count, &bad);
+        if (count > POOL_MAX_BLOCK || bad)
+            return 0;
+        *last_line = i;
+    }
+    return count;
+}
+
+// --pool: leave out the data block labelled name on line if its bytes are
+// already in the program, and point the label at them instead. Only .text
+// blocks take part; .data is writable, so its copies stay apart. Pass 2
+// leaves out the same blocks. Sets pool_skip to the block's last line.
+static bool pool_block(const char *name, uint16_t line, uint24_t pc, bool pass2)
+{
+    uint16_t last = line;
+    if (pass2)
+    {
+        if (!pool_dropped(line, &last))
+            return false;
+        pool_skip = last;
+        return true;
+    }
+
+    static uint8_t bytes[POOL_MAX_BLOCK];
+    uint16_t count = data_block(line, bytes, &last);
+    uint24_t at;
+    if (count == 0)
+        return false;
+    if (!pool_find(bytes, count, &at))
+    {
+        pool_add(bytes, count, pc);
+        return false;
+    }
+    define_label(name, line, origin + at, pc);
+    pool_drop(line, last, count);
+    pool_skip = last;
+    return true;
+}
+
+// .incbin "NAME"[, offset[, length]]: parse args into the AppVar name and
+// the range of its data to include, checked against its size. Only the
+// size is looked at; the data stays where it is until pass 2 copies it.
+static bool incbin_range(char *args, uint24_t line_number, const char *token, char *name, size_t size,
+                         uint16_t *offset, uint16_t *length)
+{
+    while (*args == ' ' || *args == '\t')
+        args++;
+    char quote = (*args == '"' || *args == '\'') ? *args++ : 0;
+    size_t n = quote ? strcspn(args, quote == '"' ? "\"" : "'") : strcspn(args, " \t,;");
+    if (n == 0 || n >= size || (quote && args[n] != quote))
+    {
+        report_error(DIAG_BAD_INCBIN, line_number, token);
+        return false;
+    }
+    memcpy(name, args, n);
+    name[n] = '\0';
+    args += n + (quote ? 1 : 0);
+
+    unsigned long range[2] = {0, 0};
+    uint8_t given = 0;
+    char *arg;
+    while (given < 2 && (arg = strtok(args, ",;")) != NULL)
+    {
+        args = NULL;
+        trim(arg);
+        while (*arg == ' ' || *arg == '\t')
+            arg++;
+        if (*arg == '\0')
+            continue;
+        if (!resolve_operand(arg, true, line_number, &range[given], NULL))
+            return false;
+        given++;
+    }
+
+    ti_var_t f = ti_Open(name, "r");
+    if (!f)
+    {
+        report_error(DIAG_BAD_INCBIN, line_number, token);
+        return false;
+    }
+    uint16_t total = ti_GetSize(f);
+    ti_Close(f);
+    if (given < 2)
+        range[1] = range[0] <= total ? total - range[0] : 0;
+    if (range[0] > total || range[1] > total - range[0])
+    {
+        report_error(DIAG_BAD_INCBIN, line_number, token);
+        return false;
+    }
+    *offset = (uint16_t)range[0];
+    *length = (uint16_t)range[1];
+    return true;
+}
+
+// Register code of a .switch operand (as in ld r,r'), or -1
+static int8_t switch_register(const char *name)
+{
+    static const char *const names[] = {"b", "c", "d", "e", "h", "l", NULL, "a"};
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        if (names[i] && strcasecmp(name, names[i]) == 0)
+            return (int8_t)i;
+    }
+    return -1;
+}
+
+// .endswitch: lay out the dispatch for the cases collected since .switch.
+// Pass 2 resolves the case labels, emits it and reports the strategy.
+static void emit_switch(uint24_t *pc, bool pass2, uint24_t line_number)
+{
+    uint16_t size = switch_build();
+    if (!pass2)
+    {
+        *pc += size;
+        return;
+    }
+
+    static uint24_t addresses[SWITCH_MAX_LABELS];
+    for (uint8_t i = 0; i < switch_label_count(); i++)
+    {
+        unsigned long value;
+        if (!resolve_operand(switch_label(i), true, line_number, &value, NULL))
+            return;
+        addresses[i] = value;
+    }
+    uint24_t base = origin + *pc;
+    for (uint16_t i = 0; i < switch_op_count(); i++)
+    {
+        uint8_t bytes[4];
+        bool address;
+        uint24_t target;
+        uint8_t length = switch_encode(i, base, base + size, addresses, bytes, &address, &target);
+        if (!emit_item(bytes, length, address, 3))
+        {
+            report_error(DIAG_CODE_FULL, line_number, NULL);
+            return;
+        }
+        uint8_t decoded;
+        const Instruction *inst = disasm_decode(bytes, length, true, &decoded);
+        if (timing_wanted() && !switch_op_is_entry(i) && inst && decoded == length)
+            timing_add(origin + *pc, length, inst, true, target, 0);
+        *pc += length;
+    }
+
+    char buf[48];
+    uint16_t line = switch_line();
+    snprintf(buf, sizeof(buf), "%s:%u .switch %s %u cyc", diag_file_name(stored_files[line]),
+             stored_numbers[line], switch_strategy_name(), switch_worst());
+    console_print(buf);
+    console_newline();
+}
+
 void assemble_line(const char *line, uint24_t *pc, bool pass2, uint24_t line_number)
 {
-    char *line_copy = line;
+    // work on a copy: strtok() would otherwise cut the stored line before pass 2.
+    // Static because line_start keeps pointing into it for diagnostics.
+    static char line_copy[256];
+    strncpy(line_copy, line, sizeof(line_copy));
+    line_copy[255] = '\0';
     trim(line_copy);
+    line_start = line_copy;
 
     if (line_copy[0] == '\0')
         return;
@@ -357,14 +1423,32 @@ void assemble_line(const char *line, uint24_t *pc, bool pass2, uint24_t line_num
     if (!first)
         return;
 
+    // between .switch and .endswitch there are only cases
+    if (switch_open() && first[0] != ';' && strcasecmp(first, ".case") != 0 &&
+        strcasecmp(first, ".default") != 0 && strcasecmp(first, ".endswitch") != 0)
+    {
+        report_error(DIAG_BAD_SWITCH, line_number, first);
+        return;
+    }
+
     // Label definition
     size_t len = strlen(first);
     if (first[len - 1] == ':')
     {
         first[len - 1] = '\0';
+        bool local = is_local_name(first);
+        if (!local)
+            open_scope((uint16_t)line_number);
+        if (build_options.pool && current_section == SECTION_TEXT && pool_block(first, line_number, *pc, pass2))
+            return;
         if (!pass2)
-            add_label(first, *pc);
-        first = strtok(NULL, " ");
+            define_label(first, line_number, origin + *pc, *pc);
+        else if (!local && timing_wanted())
+            timing_routine(origin + *pc);
+        char *next = strtok(NULL, " ");
+        if (build_options.profile && !local && current_section == SECTION_TEXT && label_starts_routine(next, line_number))
+            emit_profile_stub(first, pc, pass2, line_number);
+        first = next;
         if (!first)
             return;
     }
@@ -375,303 +1459,1748 @@ void assemble_line(const char *line, uint24_t *pc, bool pass2, uint24_t line_num
         return;
     }
 
-    // --- Handle .db directive ---
-    if (strcasecmp(first, ".db") == 0 || strcasecmp(first, "db") == 0)
+    // --- Handle .equ directive: .equ NAME, value ---
+    if (strcasecmp(first, ".equ") == 0)
+    {
+        char *name = strtok(NULL, " ,");
+        char *arg = strtok(NULL, ",");
+        if (!name || !arg)
+        {
+            report_error(DIAG_MISSING_OPERAND, line_number, first);
+            return;
+        }
+        trim(arg);
+        while (*arg == ' ' || *arg == '\t')
+            arg++;
+        // constants must resolve when defined so .if sees the same value in both passes
+        unsigned long value;
+        if (!pass2 && resolve_operand(arg, true, line_number, &value, NULL) && !add_label(name, value, true))
+            report_error(DIAG_TOO_MANY_LABELS, line_number, name);
+        return;
+    }
+
+    // --- Handle .export directive: keep library routines tree shaking can't see used ---
+    if (strcasecmp(first, ".export") == 0)
+    {
+        char *name;
+        while ((name = strtok(NULL, " ,")) != NULL)
+        {
+            if (!pass2)
+                shake_export(name);
+        }
+        return;
+    }
+
+    // --- Handle section directives: .text / .data / .bss ---
+    int8_t section = section_kind(first);
+    if (section >= 0)
+    {
+        shake_note_flow(false); // nothing runs on into another section
+        section_pc[current_section] = *pc;
+        current_section = (uint8_t)section;
+        section_used[section] = true;
+        *pc = section_pc[section];
+        if (pass2 && section != SECTION_BSS)
+            linker_seek(*pc);
+        return;
+    }
+
+    // --- Handle .ds directive: .ds count (zeros, or reserved space in .bss) ---
+    if (strcasecmp(first, ".ds") == 0)
+    {
+        shake_note_flow(false);
+        char *arg = strtok(NULL, ",");
+        unsigned long count;
+        if (arg)
+        {
+            trim(arg);
+            while (*arg == ' ' || *arg == '\t')
+                arg++;
+        }
+        if (!arg || !resolve_operand(arg, true, line_number, &count, NULL))
+        {
+            if (!arg)
+                report_error(DIAG_MISSING_OPERAND, line_number, first);
+            return;
+        }
+        reserve_space(count, pc, pass2, line_number, first);
+        return;
+    }
+
+    // --- Handle .org directive: .org address ---
+    if (strcasecmp(first, ".org") == 0)
+    {
+        char *arg = strtok(NULL, " ,;");
+        unsigned long addr;
+        if (!arg || !resolve_operand(arg, true, line_number, &addr, NULL))
+        {
+            if (!arg)
+                report_error(DIAG_MISSING_OPERAND, line_number, first);
+            return;
+        }
+        // before anything is placed it sets where the program runs,
+        // later it skips ahead to addr. Pass 1 may still see a stale
+        // layout, so only pass 2 reports going backwards.
+        if (current_section == SECTION_TEXT && *pc == section_base[SECTION_TEXT])
+            org_request = addr;
+        else if (addr >= origin + *pc)
+            reserve_space(addr - (origin + *pc), pc, pass2, line_number, first);
+        else if (pass2)
+            report_error(DIAG_BAD_ORG, line_number, arg);
+        return;
+    }
+
+    // --- Handle .align directive: .align boundary (pass 1 may pack blocks into the gap) ---
+    if (strcasecmp(first, ".align") == 0)
+    {
+        char *arg = strtok(NULL, " ,;");
+        unsigned long boundary;
+        if (!arg || !resolve_operand(arg, true, line_number, &boundary, NULL))
+        {
+            if (!arg)
+                report_error(DIAG_MISSING_OPERAND, line_number, first);
+            return;
+        }
+        if (boundary == 0 || boundary > ALIGN_MAX_BOUNDARY || (boundary & (boundary - 1)) != 0)
+        {
+            report_error(DIAG_RANGE, line_number, arg);
+            return;
+        }
+        if (!pass2)
+            align_mark((uint16_t)line_number, *pc, (uint16_t)boundary, current_section, adl_mode);
+        reserve_space(align_gap(origin + *pc, (uint16_t)boundary), pc, pass2, line_number, first);
+        return;
+    }
+
+    // --- Handle .adl directive: .adl 0|1 ---
+    if (strcasecmp(first, ".adl") == 0)
+    {
+        char *arg = strtok(NULL, " ,;");
+        unsigned long mode;
+        if (!arg || !resolve_operand(arg, true, line_number, &mode, NULL))
+        {
+            if (!arg)
+                report_error(DIAG_MISSING_OPERAND, line_number, first);
+            return;
+        }
+        adl_mode = mode != 0;
+        return;
+    }
+
+    // .bss only reserves addresses: anything below would store bytes
+    if (current_section == SECTION_BSS)
+    {
+        report_error(DIAG_BSS_CONTENT, line_number, first);
+        return;
+    }
+
+    // --- Handle .db directive ---
+    if (strcasecmp(first, ".db") == 0 || strcasecmp(first, "db") == 0)
+    {
+        shake_note_flow(false); // data: nothing runs on into the next label
+        char *args = strtok(NULL, "");
+        uint8_t bytes[256]; // a line holds fewer
+        const char *bad = NULL;
+        uint16_t count = args ? db_parse(args, bytes, sizeof(bytes), &bad) : 0;
+        if (bad)
+        {
+            report_error(DIAG_BAD_OPERAND, line_number, bad);
+            return;
+        }
+        if (pass2 && count > 0)
+        {
+            uint8_t *out = linker_reserve(count);
+            if (out)
+                memcpy(out, bytes, count);
+            else
+                report_error(DIAG_CODE_FULL, line_number, first);
+        }
+        *pc += count;
+        return;
+    }
+
+    // --- Handle .incbin directive: .incbin "NAME"[, offset[, length]] ---
+    if (strcasecmp(first, ".incbin") == 0)
+    {
+        shake_note_flow(false);
+        char *args = strtok(NULL, "");
+        char name[64]; // host builds take paths
+        uint16_t offset, length;
+        if (!args)
+        {
+            report_error(DIAG_MISSING_OPERAND, line_number, first);
+            return;
+        }
+        if (!incbin_range(args, line_number, first, name, sizeof(name), &offset, &length))
+            return;
+        if (!pass2)
+            record_stamp(name);
+        else if (length > 0)
+        {
+            // one copy straight from the AppVar, archived or not
+            ti_var_t f = ti_Open(name, "r");
+            const uint8_t *data = f ? ti_GetDataPtr(f) : NULL;
+            uint8_t *out = data ? linker_reserve(length) : NULL;
+            if (out)
+                memcpy(out, data + offset, length);
+            else
+                report_error(data ? DIAG_CODE_FULL : DIAG_BAD_INCBIN, line_number, first);
+            if (f)
+                ti_Close(f);
+        }
+        *pc += length;
+        return;
+    }
+
+    // --- Handle .dw directive ---
+    if (strcasecmp(first, ".dw") == 0 || strcasecmp(first, "dw") == 0)
+    {
+        shake_note_flow(false);
+        char *arg;
+        while ((arg = strtok(NULL, ",")) != NULL)
+        {
+            trim(arg);
+            unsigned long value;
+            bool address;
+            if (!resolve_operand(arg, pass2, line_number, &value, &address))
+                return;
+
+            if (pass2)
+            {
+                uint8_t bytes[2];
+                bytes[0] = value & 0xFF;        // low byte
+                bytes[1] = (value >> 8) & 0xFF; // high byte
+                emit_item(bytes, 2, address, 2);
+            }
+            (*pc) += 2;
+        }
+        return;
+    }
+
+    // --- Handle .dl directive (24-bit words) ---
+    if (strcasecmp(first, ".dl") == 0 || strcasecmp(first, "dl") == 0)
+    {
+        shake_note_flow(false);
+        char *arg;
+        while ((arg = strtok(NULL, ",")) != NULL)
+        {
+            trim(arg);
+            while (*arg == ' ' || *arg == '\t')
+                arg++;
+            unsigned long value;
+            bool address;
+            if (!resolve_operand(arg, pass2, line_number, &value, &address))
+                return;
+
+            if (pass2)
+            {
+                uint8_t bytes[3];
+                bytes[0] = value & 0xFF;
+                bytes[1] = (value >> 8) & 0xFF;
+                bytes[2] = (value >> 16) & 0xFF;
+                emit_item(bytes, 3, address, 3);
+            }
+            (*pc) += 3;
+        }
+        return;
+    }
+
+    // --- Handle .table directive: .table kind[, count, param] ---
+    if (strcasecmp(first, ".table") == 0)
+    {
+        shake_note_flow(false);
+        char *kind_str = strtok(NULL, " ,");
+        TableKind kind = kind_str ? table_kind(kind_str) : TABLE_NONE;
+        if (kind == TABLE_NONE)
+        {
+            report_error(DIAG_UNKNOWN_TABLE, line_number, kind_str ? kind_str : first);
+            return;
+        }
+
+        // count and parameter size the table, so they must resolve in pass 1
+        unsigned long args[2] = {0, 0};
+        for (uint8_t n = 0; n < 2 && kind != TABLE_BITREV8; n++)
+        {
+            char *arg = strtok(NULL, ",");
+            if (!arg)
+            {
+                report_error(DIAG_MISSING_OPERAND, line_number, first);
+                return;
+            }
+            trim(arg);
+            while (*arg == ' ' || *arg == '\t')
+                arg++;
+            if (!resolve_operand(arg, true, line_number, &args[n], NULL))
+                return;
+        }
+
+        size_t size = table_size(kind, args[0], args[1]);
+        if (pass2)
+        {
+            uint8_t *block = linker_reserve(size);
+            if (!block)
+            {
+                report_error(DIAG_CODE_FULL, line_number, first);
+                return;
+            }
+            table_generate(kind, args[0], args[1], block);
+        }
+        *pc += size;
+        return;
+    }
+
+    // --- Handle .bench directive: .bench label, iterations ---
+    if (strcasecmp(first, ".bench") == 0)
+    {
+        char *name = strtok(NULL, " ,");
+        char *arg = strtok(NULL, ",");
+        unsigned long iterations = 0;
+        if (arg)
+        {
+            trim(arg);
+            while (*arg == ' ' || *arg == '\t')
+                arg++;
+        }
+        if (!name || !arg || !resolve_operand(arg, true, line_number, &iterations, NULL) ||
+            iterations == 0 || iterations > 0xFFFFFF)
+        {
+            report_error(DIAG_BAD_BENCH, line_number, first);
+            return;
+        }
+
+        uint24_t harness_addr = origin + *pc;
+        if (!pass2)
+        {
+            shake_note_reference(name);
+            shake_note_flow(true);
+            if (!bench_add(name, iterations, harness_addr))
+            {
+                report_error(DIAG_TOO_MANY_BENCH, line_number, first);
+                return;
+            }
+        }
+        else
+        {
+            unsigned long routine;
+            if (!resolve_operand(name, true, line_number, &routine, NULL))
+                return;
+            uint8_t *harness = linker_reserve(BENCH_HARNESS_SIZE);
+            if (!harness)
+            {
+                report_error(DIAG_CODE_FULL, line_number, first);
+                return;
+            }
+            bench_harness(harness, harness_addr, routine, iterations);
+        }
+        *pc += BENCH_HARNESS_SIZE;
+        return;
+    }
+
+    // --- Handle .trips directive: .trips count, for the loop branch or repeat that follows ---
+    if (strcasecmp(first, ".trips") == 0)
+    {
+        char *arg = strtok(NULL, " ,;");
+        unsigned long trips;
+        if (!arg || !resolve_operand(arg, true, line_number, &trips, NULL))
+        {
+            if (!arg)
+                report_error(DIAG_MISSING_OPERAND, line_number, first);
+            return;
+        }
+        if (trips == 0 || trips > 0xFFFF)
+        {
+            report_error(DIAG_RANGE, line_number, arg);
+            return;
+        }
+        pending_trips = (uint16_t)trips;
+        return;
+    }
+
+    // --- Handle .assert_cycles directive: .assert_cycles label, max ---
+    if (strcasecmp(first, ".assert_cycles") == 0)
+    {
+        char *name = strtok(NULL, " ,");
+        char *arg = strtok(NULL, ",;");
+        unsigned long max = 0;
+        if (arg)
+        {
+            trim(arg);
+            while (*arg == ' ' || *arg == '\t')
+                arg++;
+        }
+        if (!name || !arg || !resolve_operand(arg, true, line_number, &max, NULL))
+        {
+            report_error(DIAG_BAD_ASSERT, line_number, first);
+            return;
+        }
+        if (!pass2)
+        {
+            shake_note_reference(name);
+            timing_want();
+            return;
+        }
+        unsigned long routine;
+        if (!resolve_operand(name, true, line_number, &routine, NULL))
+            return;
+        if (!timing_expect(name, routine, max, stored_files[line_number], stored_numbers[line_number]))
+            report_error(DIAG_BAD_ASSERT, line_number, first);
+        return;
+    }
+
+    // --- Handle .switch reg / .case value[, value...], label / .default label / .endswitch ---
+    if (strcasecmp(first, ".switch") == 0)
+    {
+        char *arg = strtok(NULL, " ,;");
+        int8_t reg = arg ? switch_register(arg) : -1;
+        if (reg < 0 || !adl_mode)
+        {
+            report_error(DIAG_BAD_SWITCH, line_number, arg ? arg : first);
+            return;
+        }
+        switch_begin((uint8_t)reg, (uint16_t)line_number);
+        return;
+    }
+    if (strcasecmp(first, ".case") == 0 || strcasecmp(first, ".default") == 0)
+    {
+        char *args = strtok(NULL, ";");
+        char *label = args ? strrchr(args, ',') : NULL;
+        bool is_case = strcasecmp(first, ".case") == 0;
+        if (!switch_open() || !args || (is_case && !label))
+        {
+            report_error(DIAG_BAD_SWITCH, line_number, first);
+            return;
+        }
+        if (is_case)
+            *label++ = '\0';
+        else
+            label = args;
+        trim(label);
+        while (*label == ' ' || *label == '\t')
+            label++;
+        unsigned long ignored;
+        if (!pass2)
+            resolve_operand(label, false, line_number, &ignored, NULL); // note the reference for tree shaking
+        if (!is_case)
+        {
+            if (!switch_default(label))
+                report_error(DIAG_BAD_SWITCH, line_number, label);
+            return;
+        }
+        char *value_text;
+        while ((value_text = strtok(args, ",")) != NULL)
+        {
+            args = NULL;
+            trim(value_text);
+            while (*value_text == ' ' || *value_text == '\t')
+                value_text++;
+            unsigned long value;
+            if (!resolve_operand(value_text, true, line_number, &value, NULL))
+                return;
+            if (value > 0xFF)
+                report_error(DIAG_RANGE, line_number, value_text);
+            else if (!switch_case((uint8_t)value, label))
+                report_error(DIAG_BAD_SWITCH, line_number, value_text);
+        }
+        return;
+    }
+    if (strcasecmp(first, ".endswitch") == 0)
+    {
+        if (!switch_open())
+        {
+            report_error(DIAG_BAD_SWITCH, line_number, first);
+            return;
+        }
+        emit_switch(pc, pass2, line_number);
+        shake_note_flow(true);
+        return;
+    }
+
+    // --- Normal instruction handling ---
+    // an eZ80 suffix (ld.sis, call.il) sets the operand width for this one
+    bool wide = adl_mode;
+    uint8_t suffix = 0;
+    char *dot = strchr(first, '.');
+    if (dot && dot != first)
+    {
+        *dot = '\0';
+        suffix = suffix_prefix(dot + 1, adl_mode, &wide);
+        if (!suffix)
+        {
+            report_error(DIAG_UNKNOWN_INSTRUCTION, line_number, first);
+            return;
+        }
+    }
+
+    char *operands = strtok(NULL, "");
+    if (operands)
+    {
+        while (*operands == ' ' || *operands == '\t')
+            operands++;
+        if (operands[0] == '\0' || operands[0] == ';')
+            operands = NULL;
+    }
+    if (!pass2)
+        shake_note_flow(!instruction_ends_flow(first, operands));
+
+    Match matches[MAX_MATCHES];
+    uint8_t count = match_instructions(first, operands, matches, MAX_MATCHES);
+    // --relax: a jp whose target is close enough becomes a jr
+    if (build_options.relax && !suffix && strcasecmp(first, "jp") == 0)
+        count += match_instructions("jr", operands, matches + count, MAX_MATCHES - count);
+    if (count == 0)
+    {
+        if (!is_mnemonic(first))
+            report_error(DIAG_UNKNOWN_INSTRUCTION, line_number, first);
+        else if (operands)
+            report_error(DIAG_BAD_OPERAND, line_number, operands);
+        else
+            report_error(DIAG_MISSING_OPERAND, line_number, first);
+        return;
+    }
+
+    // pass 2 must emit the size pass 1 laid out
+    uint8_t pick;
+    if (!pass2)
+    {
+        pick = choose_match(matches, count, wide, suffix ? 1 : 0, *pc, (uint16_t)line_number);
+        line_choice[line_number] = pick;
+    }
+    else
+    {
+        pick = line_choice[line_number] < count ? line_choice[line_number] : 0;
+    }
+    const Match *match = &matches[pick];
+    uint8_t size = (suffix ? 1 : 0) + instruction_size(match->inst, wide);
+
+    unsigned long value = 0;
+    bool address = false; // operand is a code address
+    if (match->hole != HOLE_NONE && !resolve_operand(match->expr, pass2, line_number, &value, &address))
+        return;
+
+    if (pass2)
+    {
+        uint24_t next = origin + *pc + size;
+        if (!operand_fits(match->hole, value, next))
+        {
+            report_error(DIAG_RANGE, line_number, operands);
+            return;
+        }
+        unsigned long target = value;
+        if (match->hole == HOLE_REL)
+            value -= next;
+
+        uint8_t buffer[8];
+        uint8_t length = 0;
+        if (suffix)
+            buffer[length++] = suffix;
+        length += instruction_encode(match->inst, wide, value, buffer + length);
+        // an address squeezed into 8 bits can't be moved
+        if (!emit_item(buffer, length, address && match->hole == HOLE_ADDR, wide ? 3 : 2))
+        {
+            report_error(DIAG_CODE_FULL, line_number, first);
+        }
+        else if (build_options.verify)
+        {
+            disasm_expect(*pc, match->inst, length, adl_mode, stored_files[line_number], stored_numbers[line_number]);
+        }
+        if (timing_wanted())
+            timing_add(origin + *pc, length, match->inst, wide, target, pending_trips);
+    }
+    pending_trips = 0;
+
+    *pc += size;
+}
+
+// Skip a false block starting at line i. Returns the index of the matching
+// .endif (or .else when stop_at_else is set), or stored_count if unterminated.
+static uint16_t skip_conditional(uint16_t i, bool stop_at_else)
+{
+    uint16_t nest = 0;
+    for (; i < stored_count; i++)
+    {
+        CondKind kind = cond_kind(stored_lines[i], NULL);
+        if (kind == COND_IF || kind == COND_IFDEF || kind == COND_IFNDEF)
+        {
+            nest++;
+        }
+        else if (kind == COND_ENDIF)
+        {
+            if (nest == 0)
+                return i;
+            nest--;
+        }
+        else if (kind == COND_ELSE && nest == 0 && stop_at_else)
+        {
+            return i;
+        }
+    }
+    return stored_count;
+}
+
+// Evaluate the operand of .if/.ifdef/.ifndef. .if accepts the same constants
+// as instruction operands; any symbol it names must already be defined.
+static bool eval_condition(CondKind kind, const char *rest, uint24_t line_number, bool *out)
+{
+    // copy the whole line so columns of the operand match the source
+    const char *line = stored_lines[line_number];
+    static char tmp[256];
+    strncpy(tmp, line, sizeof(tmp));
+    tmp[255] = '\0';
+    line_start = tmp;
+    char *arg = tmp + (rest - line);
+    char *comment = strchr(arg, ';');
+    if (comment)
+        *comment = '\0';
+    trim(arg);
+    while (*arg == ' ' || *arg == '\t')
+        arg++;
+    if (arg[0] == '\0')
+    {
+        report_error(DIAG_MISSING_OPERAND, line_number, tmp + (rest - line));
+        return false;
+    }
+
+    if (kind == COND_IF)
+    {
+        unsigned long value;
+        if (!resolve_operand(arg, true, line_number, &value, NULL))
+            return false;
+        *out = value != 0;
+    }
+    else
+    {
+        uint24_t addr;
+        bool defined = find_label(arg, &addr);
+        *out = (kind == COND_IFDEF) ? defined : !defined;
+    }
+    return true;
+}
+
+// Can a line go elsewhere without changing how the lines after it assemble?
+static bool line_movable(const char *line)
+{
+    static const char *const fixed[] = {".text", ".data", ".bss", ".org", ".adl", ".align"};
+    while (*line == ' ' || *line == '\t')
+        line++;
+    if (cond_kind(line, NULL) != COND_NONE)
+        return false;
+    for (uint8_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++)
+    {
+        size_t n = strlen(fixed[i]);
+        if (strncasecmp(line, fixed[i], n) == 0 && (line[n] == '\0' || line[n] == ' ' || line[n] == '\t' || line[n] == ';'))
+            return false;
+    }
+    return true;
+}
+
+// Lines a dead routine must keep: they define no code but affect the rest
+// of the program (conditionals, .equ, .export and the layout directives)
+static bool keeps_line(const char *line)
+{
+    if (!line_movable(line))
+        return true;
+    while (*line == ' ' || *line == '\t')
+        line++;
+    return (strncasecmp(line, ".equ", 4) == 0 && (line[4] == ' ' || line[4] == '\t')) ||
+           (strncasecmp(line, ".export", 7) == 0 && (line[7] == ' ' || line[7] == '\t'));
+}
+
+// Drop the lines of routines shake_run() found unreachable
+static void remove_dead_routines(void)
+{
+    uint8_t count = shake_routine_count();
+    uint8_t r = 0;
+    bool dead = false;
+    uint16_t out = 0;
+    for (uint16_t i = 0; i < stored_count; i++)
+    {
+        uint16_t start;
+        if (r < count)
+        {
+            bool routine_dead = shake_routine_dead(r, &start);
+            if (start == i)
+            {
+                dead = routine_dead;
+                r++;
+            }
+        }
+        if (dead && !keeps_line(stored_lines[i]))
+        {
+            free(stored_lines[i]);
+            continue;
+        }
+        stored_lines[out] = stored_lines[i];
+        stored_files[out] = stored_files[i];
+        stored_numbers[out] = stored_numbers[i];
+        out++;
+    }
+    stored_count = out;
+}
+
+// Forget everything pass 1 collected so it can run again
+static void reset_pass1_state(void)
+{
+    label_count = 0;
+    profile_reset();
+    bench_reset();
+    shake_reset();
+    pool_reset();
+    timing_reset();
+    align_reset();
+    size_guess = false;
+}
+
+// Run one assembly pass. Conditional blocks are resolved here so that lines in
+// a false branch are jumped over by skip_conditional() in both passes.
+static bool assemble_pass(bool pass2, uint24_t *end_pc)
+{
+    for (uint8_t s = 0; s < SECTION_COUNT; s++)
+    {
+        section_pc[s] = section_base[s];
+        section_used[s] = false;
+    }
+    current_section = SECTION_TEXT;
+    org_request = ORIGIN_DEFAULT;
+    adl_mode = true;
+    pending_trips = 0;
+    open_scope(0);
+    uint24_t pc = section_base[SECTION_TEXT];
+    if (pass2)
+        linker_seek(pc);
+    pool_skip = 0;
+    uint8_t depth = 0;       // open blocks whose taken branch we are inside
+    uint16_t cond_index = 0; // evaluated conditions so far, for pass 2 replay
+    bool unterminated = false;
+
+    for (uint16_t i = 0; i < stored_count; i++)
+    {
+        const char *rest;
+        CondKind kind = cond_kind(stored_lines[i], &rest);
+
+        if (kind == COND_NONE)
+        {
+            uint24_t line_pc = pc;
+            uint8_t line_section = current_section;
+            assemble_line(stored_lines[i], &pc, pass2, i);
+            // the source map covers .text, whose addresses only go up
+            if (pass2 && pc != line_pc && line_section == SECTION_TEXT && current_section == SECTION_TEXT)
+                srcmap_add(origin + line_pc, stored_files[i], stored_numbers[i]);
+            if (pool_skip > i)
+                i = pool_skip; // the .db lines of a pooled block
+            continue;
+        }
+
+        if (kind == COND_ELSE || kind == COND_ENDIF)
+        {
+            if (depth == 0)
+            {
+                line_start = NULL;
+                report_error(kind == COND_ELSE ? DIAG_UNMATCHED_ELSE : DIAG_UNMATCHED_ENDIF, i, NULL);
+                return false;
+            }
+            depth--;
+            // end of a taken branch: jump over the alternative
+            if (kind == COND_ELSE)
+            {
+                i = skip_conditional(i + 1, false);
+                if (i >= stored_count)
+                {
+                    unterminated = true;
+                    break;
+                }
+            }
+            continue;
+        }
+
+        // .if / .ifdef / .ifndef
+        if (depth >= MAX_COND_DEPTH || cond_index >= MAX_CONDITIONALS)
+        {
+            line_start = NULL;
+            report_error(DIAG_TOO_MANY_IF, i, NULL);
+            return false;
+        }
+        bool taken;
+        if (!pass2)
+        {
+            if (!eval_condition(kind, rest, i, &taken))
+                return false;
+            if (taken)
+                cond_taken[cond_index >> 3] |= (uint8_t)(1 << (cond_index & 7));
+            else
+                cond_taken[cond_index >> 3] &= (uint8_t)~(1 << (cond_index & 7));
+        }
+        else
+        {
+            taken = (cond_taken[cond_index >> 3] >> (cond_index & 7)) & 1;
+        }
+        cond_index++;
+
+        if (taken)
+        {
+            depth++;
+            continue;
+        }
+        i = skip_conditional(i + 1, true);
+        if (i >= stored_count)
+        {
+            unterminated = true;
+            break;
+        }
+        if (cond_kind(stored_lines[i], NULL) == COND_ELSE)
+            depth++;
+    }
+
+    if (depth > 0 || unterminated)
+    {
+        diag_error(DIAG_MISSING_ENDIF, 0, DIAG_NO_LINE, 0);
+        return false;
+    }
+    if (switch_open())
+    {
+        line_start = NULL;
+        report_error(DIAG_BAD_SWITCH, switch_line(), NULL);
+        switch_build(); // closes it for the next pass
+        return false;
+    }
+    section_pc[current_section] = pc;
+    *end_pc = pc;
+    // errors on single lines don't stop the pass, so all of them get reported
+    return diag_error_count() == 0;
+}
+
+void print_version(void)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "ON-CALC ASSEMBLER %d.%d ", VER_MAJOR, VER_MINOR);
+    console_print(buf);
+    console_newline();
+    delay(10);
+    while (!os_GetCSC())
+    {
+    };
+}
+
+// --- Pass 0: read the source AppVar into stored_lines and splice in includes ---
+static bool load_source(const char *name)
+{
+    ti_var_t file;
+    uint8_t ch;
+    uint8_t pos = 0;
+    char line_buf[256]; // temp buffer for reading a line
+    uint16_t number = 1; // line number in the file, empty lines included
+    stored_lines = NULL;
+    stored_files = NULL;
+    stored_numbers = NULL;
+    stored_count = 0;
+    capacity = 0;
+    source_stamp_count = 0;
+    source_stamps_full = false;
+
+    // Open the file (AppVar named "ASRC" unless building a batch)
+    file = ti_Open(name, "r");
+    if (!file)
+    {
+        console_print("File not found");
+        console_newline();
+        return false;
+    }
+    record_stamp(name);
+    diag_name_file(0, name);
+
+    // --- Pass 0: read lines into dynamically growing array ---
+    while (ti_Read(&ch, 1, 1, file) == 1)
+    {
+        if (ch == '\n' || ch == '\r')
+        {
+            if (pos > 0)
+            {
+                line_buf[pos] = '\0';
+
+                // Allocate more space if needed
+                if (stored_count >= capacity && !grow_lines(stored_count + 1))
+                {
+                    os_ThrowError(OS_E_MEMORY); // Shows ERR:MEMORY and halts
+                    return false;
+                }
+
+                // Allocate space for this line
+                size_t len = strlen(line_buf) + 1;
+                stored_lines[stored_count] = malloc(len);
+                if (!stored_lines[stored_count])
+                {
+                    os_ThrowError(OS_E_MEMORY);
+                    return false;
+                }
+                memcpy(stored_lines[stored_count], line_buf, len);
+                stored_files[stored_count] = 0;
+                stored_numbers[stored_count] = number;
+                stored_count++;
+
+                pos = 0;
+            }
+            if (ch == '\n')
+                number++;
+        }
+        else if (pos < sizeof(line_buf) - 1)
+        {
+            line_buf[pos++] = ch;
+        }
+    }
+
+    // Handle last line if no newline at EOF
+    if (pos > 0)
+    {
+        line_buf[pos] = '\0';
+        if (stored_count >= capacity && !grow_lines(stored_count + 1))
+        {
+            os_ThrowError(OS_E_MEMORY); // Shows ERR:MEMORY and halts
+            return false;
+        }
+        size_t len = strlen(line_buf) + 1;
+        stored_lines[stored_count] = malloc(len);
+        if (!stored_lines[stored_count])
+        {
+            os_ThrowError(OS_E_MEMORY);
+            return false;
+        }
+        memcpy(stored_lines[stored_count], line_buf, len);
+        stored_files[stored_count] = 0;
+        stored_numbers[stored_count] = number;
+        stored_count++;
+    }
+
+    ti_Close(file);
+
+    if (!process_includes()) // expands INCLUDE/.include directives
+        return false;
+    if (!splice_runtime())
+    {
+        console_print("Memory error adding runtime\n");
+        return false;
+    }
+    return true;
+}
+
+static void free_source(void)
+{
+    for (uint16_t i = 0; i < stored_count; i++)
+        free(stored_lines[i]);
+    free(stored_lines);
+    free(stored_files);
+    free(stored_numbers);
+    free(line_choice);
+    free(line_address);
+    stored_lines = NULL;
+    stored_files = NULL;
+    stored_numbers = NULL;
+    line_choice = NULL;
+    line_address = NULL;
+    stored_count = 0;
+    capacity = 0;
+}
+
+// Place the sections after a pass 1 and set data_end to the end of .data.
+// Returns true if the origin or a section that is in use moved, so labels
+// are stale and pass 1 has to run again.
+static bool layout_sections(uint24_t *data_end)
+{
+    uint24_t size[SECTION_COUNT];
+    uint24_t base[SECTION_COUNT];
+    for (uint8_t s = 0; s < SECTION_COUNT; s++)
+        size[s] = section_pc[s] - section_base[s];
+
+    // a 1-byte .bss still gets a 2-byte clear so ldir never sees bc = 0
+    bss_size = size[SECTION_BSS] == 1 ? 2 : size[SECTION_BSS];
+    uint24_t counters = build_options.profile ? (uint24_t)profile_routine_count() * PROFILE_COUNTER_SIZE : 0;
+    base[SECTION_TEXT] = bss_size > 0 ? BSS_STUB_SIZE : 0;
+    base[SECTION_DATA] = base[SECTION_TEXT] + size[SECTION_TEXT];
+    *data_end = base[SECTION_DATA] + size[SECTION_DATA];
+    base[SECTION_BSS] = *data_end + counters;
+
+    bool moved = org_request != origin;
+    origin = org_request;
+    for (uint8_t s = 0; s < SECTION_COUNT; s++)
+    {
+        if ((s == SECTION_TEXT || section_used[s]) && base[s] != section_base[s])
+            moved = true;
+        section_base[s] = base[s];
+    }
+    return moved;
+}
+
+// Keep the labels of this pass 1 for the next one. Returns true if any
+// differ from those kept last time.
+static bool keep_labels(void)
+{
+    bool changed = label_count != prev_label_count;
+    for (uint8_t i = 0; i < label_count && !changed; i++)
+        changed = labels[i].address != prev_labels[i].address || strcmp(labels[i].name, prev_labels[i].name) != 0;
+    memcpy(prev_labels, labels, label_count * sizeof(Label));
+    prev_label_count = label_count;
+    return changed;
+}
+
+// Pass 1, repeated until the layout stops moving and, when an instruction
+// size was picked by a label not seen yet, until labels stop moving. .org
+// padding settles after a run or two; --relax takes a few more.
+static bool run_pass1(uint24_t *code_end)
+{
+    uint8_t *choice = realloc(line_choice, stored_count ? stored_count : 1);
+    if (choice)
+        line_choice = choice;
+    uint24_t *addresses = choice ? realloc(line_address, (stored_count ? stored_count : 1) * sizeof(uint24_t)) : NULL;
+    if (!addresses)
+    {
+        diag_error(DIAG_CODE_FULL, 0, DIAG_NO_LINE, 0);
+        return false;
+    }
+    line_address = addresses;
+    memset(line_address, 0, stored_count * sizeof(uint24_t));
+    prev_label_count = 0;
+    for (uint8_t tries = 0; tries < MAX_LAYOUT_PASSES; tries++)
+    {
+        reset_pass1_state();
+        if (!assemble_pass(false, code_end))
+            return false;
+        bool moved = layout_sections(code_end);
+        bool relabelled = keep_labels();
+        if (!moved && !(size_guess && relabelled))
+            break;
+    }
+
+    // the stub clears .bss in place: it must end inside the code buffer
+    // and fit in the free RAM behind the program
+    uint24_t bss_end = section_base[SECTION_BSS] + bss_size;
+    if (bss_size > 0 && (bss_end > CODE_MAX_SIZE || bss_end - *code_end > os_MemChk(NULL)))
+    {
+        diag_error(DIAG_BSS_FULL, 0, DIAG_NO_LINE, 0);
+        return false;
+    }
+    return true;
+}
+
+// Size of block b of the last pass 1 if it can move: nothing runs into it
+// or out of it and none of its lines are fixed in place. 0 if it can't.
+static uint24_t movable_size(uint8_t b, uint8_t count)
+{
+    const AlignPoint *block = align_get_block(b);
+    if (b == 0 || shake_routine_falls_through(b - 1) || shake_routine_falls_through(b))
+        return 0;
+    uint16_t end_line = b + 1 < count ? align_get_block(b + 1)->line : stored_count;
+    for (uint16_t i = block->line; i < end_line; i++)
+    {
+        if (!line_movable(stored_lines[i]))
+            return 0;
+    }
+    uint24_t end = b + 1 < count ? align_get_block(b + 1)->pc : section_pc[block->section];
+    return end > block->pc ? end - block->pc : 0;
+}
+
+// Is block b the first one after an .align? Those stay where they are.
+static bool block_pinned(uint8_t b, uint8_t count)
+{
+    for (uint8_t m = 0; m < align_mark_count(); m++)
     {
-        char *arg;
-        while ((arg = strtok(NULL, ",")) != NULL)
+        for (uint8_t i = 0; i < count; i++)
         {
-            trim(arg);
-            if (arg[0] == '"' || arg[0] == '\'')
-            {
-                // String literal
-                char quote = arg[0];
-                char *p = arg + 1;
-                while (*p && *p != quote)
-                {
-                    if (pass2)
-                        linker_emit((uint8_t *)p, 1);
-                    (*pc)++;
-                    p++;
-                }
-            }
-            else
+            if (align_get_block(i)->line > align_get_mark(m)->line)
             {
-                // Numeric literal
-                unsigned long value = strtoul(arg, NULL, 0);
-                if (pass2)
-                {
-                    uint8_t b = (uint8_t)value;
-                    linker_emit(&b, 1);
-                }
-                (*pc)++;
+                if (i == b)
+                    return true;
+                break;
             }
         }
-        return;
     }
+    return false;
+}
+
+// Swap stored lines first..last-1 end for end
+static void reverse_lines(uint16_t first, uint16_t last)
+{
+    while (first + 1 < last)
+    {
+        last--;
+        char *line = stored_lines[first];
+        uint8_t file = stored_files[first];
+        uint16_t number = stored_numbers[first];
+        stored_lines[first] = stored_lines[last];
+        stored_files[first] = stored_files[last];
+        stored_numbers[first] = stored_numbers[last];
+        stored_lines[last] = line;
+        stored_files[last] = file;
+        stored_numbers[last] = number;
+        first++;
+    }
+}
 
-    // --- Handle .dw directive ---
-    if (strcasecmp(first, ".dw") == 0 || strcasecmp(first, "dw") == 0)
+// Fill the padding in front of each aligned block with blocks from further
+// down that fit, largest first, and assemble the new order. packed counts
+// the bytes of padding saved. False if pass 1 fails.
+static bool pack_aligned_blocks(uint24_t *code_end, uint24_t *packed)
+{
+    static bool chosen[ALIGN_MAX_BLOCKS];
+    for (uint8_t k = 0; k < align_mark_count(); k++)
     {
-        char *arg;
-        while ((arg = strtok(NULL, ",")) != NULL)
+        const AlignPoint *mark = align_get_mark(k);
+        uint8_t count = align_block_count();
+        uint24_t gap = align_gap(origin + mark->pc, mark->boundary);
+        if (gap == 0 || count == 0 || count != shake_routine_count())
+            continue;
+
+        // the block holding the .align must not run on into the padding
+        int16_t owner = -1;
+        uint8_t aligned = count;
+        for (uint8_t b = 0; b < count; b++)
         {
-            trim(arg);
-            unsigned long value;
+            if (align_get_block(b)->line < mark->line)
+                owner = b;
+            else if (aligned == count)
+                aligned = b;
+        }
+        if (owner < 0 || shake_routine_falls_through((uint8_t)owner))
+            continue;
 
-            // Label reference
-            if (isalpha((unsigned char)arg[0]))
+        memset(chosen, 0, sizeof(chosen));
+        uint24_t left = gap;
+        for (;;)
+        {
+            int16_t best = -1;
+            uint24_t best_size = 0;
+            for (uint8_t b = aligned + 1; b < count; b++)
             {
-                uint24_t addr;
-                if (!find_label(arg, &addr))
+                const AlignPoint *block = align_get_block(b);
+                if (chosen[b] || block_pinned(b, count) || block->section != mark->section || block->adl != mark->adl)
+                    continue;
+                uint24_t size = movable_size(b, count);
+                if (size > 0 && size <= left && size > best_size)
                 {
-                    if (pass2)
-                    {
-                        char errbuf[32];
-                        snprintf(errbuf, sizeof(errbuf), "Undefined label at line:%u\n", (unsigned)line_number);
-                        os_PutStrFull(errbuf);
-                        return;
-                    }
-                    addr = 0; // placeholder in pass1
+                    best = b;
+                    best_size = size;
                 }
-                value = addr;
-            }
-            else
-            {
-                value = strtoul(arg, NULL, 0);
             }
+            if (best < 0)
+                break;
+            chosen[best] = true;
+            left -= best_size;
+        }
+        if (left == gap)
+            continue;
 
-            if (pass2)
-            {
-                uint8_t bytes[2];
-                bytes[0] = value & 0xFF;        // low byte
-                bytes[1] = (value >> 8) & 0xFF; // high byte
-                linker_emit(bytes, 2);
-            }
-            (*pc) += 2;
+        // move the chosen blocks, in source order, to just before the .align
+        uint16_t to = mark->line;
+        for (uint8_t b = aligned + 1; b < count; b++)
+        {
+            if (!chosen[b])
+                continue;
+            uint16_t first = align_get_block(b)->line;
+            uint16_t last = b + 1 < count ? align_get_block(b + 1)->line : stored_count;
+            reverse_lines(to, first);
+            reverse_lines(first, last);
+            reverse_lines(to, last);
+            to += last - first;
         }
-        return;
+        *packed += gap - left;
+        if (!run_pass1(code_end))
+            return false;
     }
+    return true;
+}
 
-    // --- Normal instruction handling ---
-    const Instruction *inst = lookup_instruction(first);
-    if (!inst)
+// Rank of a block for --hot: 0 listed with a weight, 1 not listed, 2 weight 0
+static uint8_t hot_rank(uint8_t b, uint24_t *weight)
+{
+    char name[LABEL_NAME_LEN];
+    *weight = 0;
+    if (!line_label(align_get_block(b)->line, name, sizeof(name)) || !hot_weight(name, weight))
+        return 1;
+    return *weight > 0 ? 0 : 2;
+}
+
+// --hot: reorder the movable .text blocks so the listed routines come
+// first, heaviest first, and the weight 0 ones last. Blocks only trade
+// places with blocks of the same ADL mode; the rest keep their order.
+// Labels resolve again in the next pass 1, so nothing needs patching.
+// hot and cold count the blocks put first and last. False if pass 1 fails.
+static bool apply_hot_layout(uint24_t *code_end, uint8_t *hot, uint8_t *cold)
+{
+    static uint8_t slots[ALIGN_MAX_BLOCKS];
+    static uint8_t order[ALIGN_MAX_BLOCKS];
+    static uint8_t ranks[ALIGN_MAX_BLOCKS];
+    static uint24_t weights[ALIGN_MAX_BLOCKS];
+    static uint8_t sorted[ALIGN_MAX_BLOCKS];
+    static uint8_t place[ALIGN_MAX_BLOCKS];
+    uint8_t count = align_block_count();
+    if (count == 0 || count != shake_routine_count())
+        return true;
+
+    uint8_t slot_count = 0;
+    for (uint8_t b = 0; b < count; b++)
     {
-        char errbuf[32];
-        snprintf(errbuf, sizeof(errbuf), "Unknown instruction:%s at line:%u\n", first, (unsigned)line_number);
-        os_PutStrFull("Unknown instruction\n");
-        return;
+        if (align_get_block(b)->section != SECTION_TEXT || block_pinned(b, count) || movable_size(b, count) == 0)
+            continue;
+        ranks[slot_count] = hot_rank(b, &weights[slot_count]);
+        *hot += ranks[slot_count] == 0;
+        *cold += ranks[slot_count] == 2;
+        slots[slot_count++] = b;
     }
 
-    uint8_t buffer[8];
-    memcpy(buffer, inst->opcode, inst->length);
-
-    if (inst->type != OP_NOARG &&
-        (inst->type == OP_IMM8 || inst->type == OP_IMM16 || inst->type == OP_IMM24))
+    // stable insertion sort of each ADL mode's slots, written back in place
+    bool changed = false;
+    for (uint8_t mode = 0; mode < 2; mode++)
     {
-        char *arg_str = strtok(NULL, " ,");
-        if (!arg_str)
+        uint8_t n = 0;
+        for (uint8_t i = 0; i < slot_count; i++)
         {
-            char errbuf[32];
-            snprintf(errbuf, sizeof(errbuf), "Missing operand at line:%u\n", (unsigned)line_number);
-            os_PutStrFull(errbuf);
-            return;
+            if (align_get_block(slots[i])->adl == (mode == 1))
+                place[n++] = i;
         }
-
-        unsigned long value;
-        if (isalpha((unsigned char)arg_str[0]))
+        for (uint8_t i = 0; i < n; i++)
         {
-            uint24_t addr;
-            if (!find_label(arg_str, &addr))
+            uint8_t key = place[i];
+            uint8_t j = i;
+            for (; j > 0; j--)
             {
-                if (pass2)
-                {
-                    char errbuf[32];
-                    snprintf(errbuf, sizeof(errbuf), "Undefined label at line:%u\n", (unsigned)line_number);
-                    os_PutStrFull(errbuf);
-                    return;
-                }
-                addr = 0;
+                uint8_t prev = sorted[j - 1];
+                bool hotter = ranks[key] < ranks[prev] || (ranks[key] == 0 && ranks[prev] == 0 && weights[key] > weights[prev]);
+                if (!hotter)
+                    break;
+                sorted[j] = prev;
             }
-            value = addr;
+            sorted[j] = key;
         }
-        else
+        for (uint8_t i = 0; i < n; i++)
+        {
+            order[place[i]] = slots[sorted[i]];
+            changed |= sorted[i] != place[i];
+        }
+    }
+    if (!changed)
+        return true;
+
+    // copy the lines block by block, each slot taking its new block
+    char **lines = malloc(stored_count * sizeof(char *));
+    uint8_t *files = malloc(stored_count);
+    uint16_t *numbers = malloc(stored_count * sizeof(uint16_t));
+    if (!lines || !files || !numbers)
+    {
+        free(lines);
+        free(files);
+        free(numbers);
+        return true;
+    }
+    uint16_t out = align_get_block(0)->line;
+    memcpy(lines, stored_lines, out * sizeof(char *));
+    memcpy(files, stored_files, out);
+    memcpy(numbers, stored_numbers, out * sizeof(uint16_t));
+    uint8_t k = 0;
+    for (uint8_t b = 0; b < count; b++)
+    {
+        uint8_t from = b;
+        if (k < slot_count && slots[k] == b)
+            from = order[k++];
+        uint16_t first = align_get_block(from)->line;
+        uint16_t last = from + 1 < count ? align_get_block(from + 1)->line : stored_count;
+        memcpy(lines + out, stored_lines + first, (last - first) * sizeof(char *));
+        memcpy(files + out, stored_files + first, last - first);
+        memcpy(numbers + out, stored_numbers + first, (last - first) * sizeof(uint16_t));
+        out += last - first;
+    }
+    memcpy(stored_lines, lines, stored_count * sizeof(char *));
+    memcpy(stored_files, files, stored_count);
+    memcpy(stored_numbers, numbers, stored_count * sizeof(uint16_t));
+    free(lines);
+    free(files);
+    free(numbers);
+    return run_pass1(code_end);
+}
+
+// ld hl,start / ld (hl),0 / ld de,start+1 / ld bc,size-1 / ldir. out is in
+// the code buffer; the two addresses are recorded for relocation.
+static void emit_bss_stub(uint8_t *out, uint24_t start, uint24_t size)
+{
+    uint24_t words[3] = {start, start + 1, size - 1};
+    const uint8_t ops[3] = {0x21, 0x11, 0x01};
+    uint8_t *p = out;
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        *p++ = ops[i];
+        if (i < 2)
+            linker_reloc_at(p, 3);
+        *p++ = words[i] & 0xFF;
+        *p++ = (words[i] >> 8) & 0xFF;
+        *p++ = (words[i] >> 16) & 0xFF;
+        if (i == 0)
         {
-            value = strtoul(arg_str, NULL, 0);
+            *p++ = 0x36; // ld (hl),0
+            *p++ = 0x00;
         }
+    }
+    *p++ = 0xED; // ldir
+    *p = 0xB0;
+}
+
+// Put the code labels of the last pass 1 into the symbol map
+static void collect_symbols(void)
+{
+    symmap_reset();
+    for (uint8_t i = 0; i < label_count; i++)
+    {
+        if (!labels[i].constant)
+            symmap_add(labels[i].name, labels[i].address);
+    }
+}
+
+// Assemble stored_lines into the code buffer. With reuse_pass1 the labels
+// and other pass 1 results from the previous build are kept and only
+// pass 2 runs again.
+static bool build_program(bool reuse_pass1)
+{
+    uint24_t code_end = pass1_end;
+    bool ok = true;
+    linker_reset();
+    diag_reset();
+
+    if (!reuse_pass1)
+    {
+        // --- Pass 1: collect labels ---
+        ok = run_pass1(&code_end);
 
-        if (inst->type == OP_IMM8)
+        // --- Tree shaking: drop unreachable include routines, then redo pass 1 ---
+        if (ok && !build_options.no_shake)
+        {
+            uint24_t removed = shake_run(code_end);
+            if (removed > 0)
+            {
+                char buf[32];
+                remove_dead_routines();
+                snprintf(buf, sizeof(buf), "Shaken: %lu bytes", (unsigned long)removed);
+                console_print(buf);
+                console_newline();
+                ok = run_pass1(&code_end);
+            }
+        }
+        if (ok && build_options.hot[0])
         {
-            buffer[inst->length - 1] = (uint8_t)value;
+            char buf[40];
+            uint8_t hot = 0;
+            uint8_t cold = 0;
+            if (!hot_load(build_options.hot))
+                snprintf(buf, sizeof(buf), "Hot list missing: %s", build_options.hot);
+            else
+            {
+                ok = apply_hot_layout(&code_end, &hot, &cold);
+                snprintf(buf, sizeof(buf), "Hot layout: %u first, %u last", hot, cold);
+            }
+            console_print(buf);
+            console_newline();
         }
-        else if (inst->type == OP_IMM16)
+        if (ok && align_mark_count() > 0)
         {
-            buffer[inst->length - 2] = value & 0xFF;
-            buffer[inst->length - 1] = (value >> 8) & 0xFF;
+            char buf[64];
+            uint24_t packed = 0;
+            ok = pack_aligned_blocks(&code_end, &packed);
+            snprintf(buf, sizeof(buf), "Align padding: %lu bytes (%lu packed)", (unsigned long)align_padding(origin),
+                     (unsigned long)packed);
+            console_print(buf);
+            console_newline();
         }
-        else if (inst->type == OP_IMM24)
+        if (ok && pool_saved() > 0)
         {
-            buffer[inst->length - 3] = value & 0xFF;
-            buffer[inst->length - 2] = (value >> 8) & 0xFF;
-            buffer[inst->length - 1] = (value >> 16) & 0xFF;
+            char buf[32];
+            snprintf(buf, sizeof(buf), "Pooled: %lu bytes", (unsigned long)pool_saved());
+            console_print(buf);
+            console_newline();
         }
+        pass1_end = code_end;
     }
 
-    if (pass2)
+    // --- Pass 2: emit code, only when pass 1 found no errors ---
+    profile_base = pass1_end;
+    profile_next = 0;
+    srcmap_reset();
+    disasm_reset();
+    timing_start();
+    linker_set_origin(origin);
+    linker_set_compress(build_options.compress);
+    ok = ok && assemble_pass(true, &code_end);
+    srcmap_end(origin + section_pc[SECTION_TEXT]);
+
+    // .bss: the stub in front of .text clears it before the program runs
+    if (ok && bss_size > 0)
+    {
+        uint8_t *stub = linker_seek(0) ? linker_reserve(BSS_STUB_SIZE) : NULL;
+        if (stub)
+            emit_bss_stub(stub, origin + section_base[SECTION_BSS], bss_size);
+    }
+
+    // --profile: zeroed counter block after .data
+    if (ok && build_options.profile)
     {
-        if (!linker_emit(buffer, inst->length))
+        size_t counters = (size_t)profile_routine_count() * PROFILE_COUNTER_SIZE;
+        uint8_t *block = linker_seek(pass1_end) ? linker_reserve(counters) : NULL;
+        if (block)
+            memset(block, 0, counters);
+        else
         {
-            os_PutStrFull("Code buffer full\n");
+            diag_error(DIAG_CODE_FULL, 0, DIAG_NO_LINE, 0);
+            ok = false;
         }
     }
 
-    *pc += inst->length;
+    // .assert_cycles: every asserted routine must fit its budget
+    if (ok && timing_wanted())
+        ok = timing_check();
+
+    // --verify: the finished image must disassemble to what was emitted
+    if (ok && build_options.verify)
+        ok = disasm_verify(linker_image(), linker_size());
+
+    if (!ok)
+        diag_report();
+    else
+        collect_symbols();
+    return ok;
 }
 
-void print_version(void)
+// Assemble one source AppVar and save the result under output, without
+// launching it. The source and symbol maps stay available to save.
+// Used by --batch and the host command line.
+bool assemble_file(const char *source, const char *output)
+{
+    bool ok = load_source(source) && build_program(false) && linker_save(output);
+    free_source();
+    return ok;
+}
+
+// Run the program just built and save what its --profile counters and
+// .bench harnesses recorded. The host build runs it in its eZ80 stand-in
+// (ezasm -r), whose timer 1 always counts.
+bool run_program(void)
+{
+    if (bench_count() > 0)
+        bench_timer_enable();
+    if (!linker_run())
+        return false;
+
+    // the program has returned: save what its counters recorded
+    if (build_options.profile)
+        profile_dump(PROFILE_APPVAR, linker_image() + profile_base);
+    if (bench_count() > 0)
+        bench_report(BENCH_APPVAR, linker_image(), origin);
+    return true;
+}
+
+#ifndef HOST_BUILD
+// Save and run the program, then collect what instrumentation recorded
+static void launch_program(void)
+{
+    srcmap_save(SRCMAP_APPVAR);
+    symmap_save(SYMMAP_APPVAR);
+    run_program();
+}
+
+static void wait_key(void)
 {
-    char buf[32];
-    snprintf(buf, sizeof(buf), "ON-CALC ASSEMBLER %d.%d ", VER_MAJOR, VER_MINOR);
-    os_PutStrFull(buf);
-    os_NewLine();
-    delay(10);
     while (!os_GetCSC())
     {
     };
 }
 
-int main(void)
+// Print one line of a view, waiting for a key after each full screen.
+// Returns false once CLEAR is pressed.
+static bool view_print(const char *text, uint8_t *rows)
 {
-    ti_var_t file;
-    stored_lines = NULL;
-    uint8_t ch;
-    uint8_t pos = 0;
-    uint24_t pc = 0;
-    stored_count = 0;
-    capacity = 0;
-    char line_buf[256]; // temp buffer for reading a line
-
-    os_ClrHome();
-    print_version();
-    linker_reset();
-
-    // Open the file (AppVar named "ASRC")
-    file = ti_Open("ASRC", "r");
-    if (!file)
+    char line[VIEW_COLUMNS + 1];
+    if (*rows == VIEW_ROWS)
     {
-        os_PutStrFull("File not found");
-        os_NewLine();
-        while (!os_GetCSC())
+        uint8_t key;
+        while (!(key = os_GetCSC()))
         {
         };
-        return 0;
+        if (key == sk_Clear)
+            return false;
+        os_ClrHome();
+        *rows = 0;
     }
+    snprintf(line, sizeof(line), "%s", text);
+    console_print(line);
+    console_newline();
+    (*rows)++;
+    return true;
+}
 
-    // --- Pass 0: read lines into dynamically growing array ---
-    while (ti_Read(&ch, 1, 1, file) == 1)
+// Page through the disassembly of image, which runs at base, with the
+// labels from the ASYM AppVar. Any key shows the next page, CLEAR stops.
+static void view_image(const uint8_t *image, size_t size, uint24_t base)
+{
+    ti_var_t sym = ti_Open(SYMMAP_APPVAR, "r");
+    const uint8_t *symbols = sym ? ti_GetDataPtr(sym) : NULL;
+    size_t symbols_size = sym ? ti_GetSize(sym) : 0;
+    char text[32];
+    char line[48];
+    uint8_t rows = 0;
+    bool more = true;
+
+    os_ClrHome();
+    for (size_t offset = 0; more && offset < size;)
     {
-        if (ch == '\n' || ch == '\r')
+        const char *name;
+        uint24_t from;
+        if (symbols && symmap_lookup(symbols, symbols_size, base + offset, &name, &from) && from == 0)
         {
-            if (pos > 0)
-            {
-                line_buf[pos] = '\0';
+            snprintf(line, sizeof(line), "%.24s:", name);
+            more = view_print(line, &rows);
+        }
+        uint8_t used = disasm_line(image + offset, size - offset, base + offset, true, text, sizeof(text));
+        snprintf(line, sizeof(line), "%06lX %s", (unsigned long)(base + offset), text);
+        more = more && view_print(line, &rows);
+        offset += used;
+    }
+    if (sym)
+        ti_Close(sym);
+    if (more)
+        wait_key();
+}
 
-                // Allocate more space if needed
-                if (stored_count >= capacity)
-                {
-                    // Grow capacity in chunks of at least MIN_ALLOC_SIZE
-                    size_t new_cap = capacity + (MIN_ALLOC_SIZE / sizeof(char *));
-                    char **new_mem = realloc(stored_lines, new_cap * sizeof(char *));
-                    if (!new_mem)
-                    {
-                        os_ThrowError(OS_E_MEMORY); // Shows ERR:MEMORY and halts
-                        return 0;
-                    }
-                    stored_lines = new_mem;
-                    capacity = new_cap;
-                }
+// --view: show BUILT as a program at userMem, unpacked if it was saved
+// with --compress, or as an AppVar image from offset 0
+static void view_built(void)
+{
+    uint24_t base = USER_MEM;
+    ti_var_t f = ti_OpenVar("BUILT", "r", TI_PPRGM_TYPE);
+    if (!f)
+    {
+        f = ti_Open("BUILT", "r");
+        base = 0;
+    }
+    if (!f)
+    {
+        console_print("No BUILT");
+        console_newline();
+        wait_key();
+        return;
+    }
 
-                // Allocate space for this line
-                size_t len = strlen(line_buf) + 1;
-                stored_lines[stored_count] = malloc(len);
-                if (!stored_lines[stored_count])
-                {
-                    os_ThrowError(OS_E_MEMORY);
-                    return 0;
-                }
-                memcpy(stored_lines[stored_count], line_buf, len);
-                stored_count++;
+    const uint8_t *data = ti_GetDataPtr(f);
+    size_t size = ti_GetSize(f);
+    if (base && size >= 2)
+    {
+        data += 2; // tExtTok, tAsm84CeCmp
+        size -= 2;
+    }
+    if (base && pack_detect(data, size))
+    {
+        uint8_t *image = linker_reserve(CODE_MAX_SIZE);
+        size = image ? pack_unpack(data, size, image, CODE_MAX_SIZE) : 0;
+        data = image;
+    }
+    view_image(data, size, base);
+    ti_Close(f);
+}
 
-                pos = 0;
+// --session: menu shown whenever the program returns. Sources, labels and
+// the opcode index stay loaded; a rebuild with unchanged inputs only redoes
+// pass 2, and changed sources reuse the cached lines of unchanged includes.
+static void session_loop(bool built)
+{
+    char buf[32];
+    uint16_t builds = 1;
+
+    if (built)
+    {
+        launch_program();
+        wait_key();
+    }
+    for (;;)
+    {
+        os_ClrHome();
+        console_print("1:Rebuild 2:Run");
+        console_newline();
+        console_print("3:Stats 4:View");
+        console_newline();
+        console_print("CLEAR:Quit");
+        console_newline();
+
+        uint8_t key;
+        while (!(key = os_GetCSC()))
+        {
+        };
+        if (key == sk_Clear)
+            return;
+
+        if (key == sk_1)
+        {
+            os_ClrHome();
+            if (!built || sources_changed())
+            {
+                free_source();
+                built = load_source(SOURCE_APPVAR) && build_program(false);
             }
+            else
+            {
+                built = build_program(true);
+            }
+            builds++;
+            if (built)
+            {
+                console_print("Build complete");
+                console_newline();
+                launch_program();
+            }
+            wait_key();
         }
-        else if (pos < sizeof(line_buf) - 1)
+        else if (key == sk_2 && built)
         {
-            line_buf[pos++] = ch;
+            // re-emit so the program starts from a clean image
+            os_ClrHome();
+            if (build_program(true))
+                launch_program();
+            wait_key();
+        }
+        else if (key == sk_3)
+        {
+            os_ClrHome();
+            snprintf(buf, sizeof(buf), "Builds: %u %s", (unsigned)builds, built ? "OK" : "FAILED");
+            console_print(buf);
+            console_newline();
+            snprintf(buf, sizeof(buf), "Lines: %u", (unsigned)stored_count);
+            console_print(buf);
+            console_newline();
+            snprintf(buf, sizeof(buf), "Labels: %u", (unsigned)label_count);
+            console_print(buf);
+            console_newline();
+            snprintf(buf, sizeof(buf), "Code: %u bytes", (unsigned)linker_size());
+            console_print(buf);
+            console_newline();
+            snprintf(buf, sizeof(buf), "Cached includes: %u", (unsigned)include_cache_count);
+            console_print(buf);
+            console_newline();
+            wait_key();
+        }
+        else if (key == sk_4 && built)
+        {
+            // re-emit: a run leaves the image moved to the code buffer
+            os_ClrHome();
+            if (build_program(true))
+                view_image(linker_image(), linker_size(), origin);
         }
     }
+}
 
-    // Handle last line if no newline at EOF
-    if (pos > 0)
+// --batch=MANIFEST: build every "SOURCE OUTPUT" line of the manifest back to
+// back without waiting, printing or launching. Includes and the opcode
+// index are shared between builds. One result line per job goes to ASTAT:
+// "OUTPUT OK|FAIL size ms messages", messages separated by '|'.
+static void run_batch(const char *manifest)
+{
+    static char log[128];
+    char line[64];
+    LinesResult jobs = read_appvar_lines(manifest);
+
+    ti_Delete(STATUS_APPVAR);
+    ti_var_t status = ti_Open(STATUS_APPVAR, "w");
+    if (!status)
     {
-        line_buf[pos] = '\0';
-        if (stored_count >= capacity)
-        {
-            size_t new_cap = capacity + (MIN_ALLOC_SIZE / sizeof(char *));
-            char **new_mem = realloc(stored_lines, new_cap * sizeof(char *));
-            if (!new_mem)
-            {
-                os_ThrowError(OS_E_MEMORY);
-                return 0;
-            }
-            stored_lines = new_mem;
-            capacity = new_cap;
-        }
-        size_t len = strlen(line_buf) + 1;
-        stored_lines[stored_count] = malloc(len);
-        if (!stored_lines[stored_count])
+        free_lines(&jobs);
+        return;
+    }
+
+    for (uint16_t j = 0; j < jobs.count; j++)
+    {
+        char *src = strtok(jobs.lines[j], " \t,");
+        const char *out = strtok(NULL, " \t,");
+        if (!src || src[0] == ';')
+            continue;
+        if (!out)
+            out = "BUILT";
+
+        console_capture(log, sizeof(log));
+        clock_t start = clock();
+        bool ok = assemble_file(src, out);
+        unsigned long ms = (unsigned long)(clock() - start) * 1000 / CLOCKS_PER_SEC;
+        console_capture(NULL, 0);
+
+        for (char *c = log; *c; c++)
         {
-            os_ThrowError(OS_E_MEMORY);
-            return 0;
+            if (*c == '\n')
+                *c = '|';
         }
-        memcpy(stored_lines[stored_count], line_buf, len);
-        stored_count++;
+        snprintf(line, sizeof(line), "%s %s %u %lu ", out, ok ? "OK" : "FAIL",
+                 ok ? (unsigned)linker_size() : 0, ms);
+        ti_Write(line, 1, strlen(line), status);
+        ti_Write(log, 1, strlen(log), status);
+        ti_Write("\n", 1, 1, status);
     }
 
-    ti_Close(file);
+    ti_Close(status);
+    free_lines(&jobs);
+}
 
-    process_includes(); // new function that expands INCLUDE/.include directives
+int main(void)
+{
+    os_ClrHome();
+    options_load(OPTIONS_APPVAR);
 
-    // --- Pass 1: collect labels ---
-    pc = 0;
-    for (uint16_t i = 0; i < stored_count; i++)
+    // --batch: headless, no version screen or key waits
+    if (build_options.batch[0])
     {
-        assemble_line(stored_lines[i], &pc, false, i);
+        run_batch(build_options.batch);
+        return 0;
     }
 
-    // --- Pass 2: emit code ---
-    pc = 0;
-    for (uint16_t i = 0; i < stored_count; i++)
+    print_version();
+    linker_reset();
+
+    // --index=LIB_NAME: tool mode, index the library and stop
+    if (build_options.index_lib[0])
+    {
+        libindex_build(build_options.index_lib);
+        wait_key();
+        return 0;
+    }
+
+    // --view: tool mode, look at the last saved program
+    if (build_options.view)
+    {
+        view_built();
+        return 0;
+    }
+
+    // --profile: report on the previous instrumented run before rebuilding
+    if (build_options.profile)
+        profile_report(PROFILE_APPVAR);
+
+    bool ok = load_source(SOURCE_APPVAR) && build_program(false);
+
+    if (build_options.session)
     {
-        assemble_line(stored_lines[i], &pc, true, i);
+        session_loop(ok);
+        free_source();
+        return 0;
+    }
+
+    if (!ok)
+    {
+        free_source();
+        wait_key();
+        return 0;
     }
 
-    os_PutStrFull("Build complete");
-    os_NewLine();
+    console_print("Build complete");
+    console_newline();
     delay(100);
-    os_PutStrFull("Collecting Memory...");
-    os_NewLine();
+    console_print("Collecting Memory...");
+    console_newline();
     // --- Cleanup ---
-    for (uint16_t i = 0; i < stored_count; i++)
-        free(stored_lines[i]);
-    free(stored_lines);
-    os_PutStrFull("Collected Memory.");
-    os_NewLine();
+    free_source();
+    console_print("Collected Memory.");
+    console_newline();
     delay(10);
-    os_PutStrFull("Launching Program...");
-    os_NewLine();
+    console_print("Launching Program...");
+    console_newline();
     delay(10);
-    linker_run();
+    launch_program();
 
     return 0;
 }
+#endif
\ No newline at end of file
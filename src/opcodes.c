@@ -1,5 +1,6 @@
 #include "opcodes.h"
 #include <string.h>
+#include <ctype.h>
 
 // ~256 Z80-compatible instructions
 const Instruction instruction_table[INSTRUCTION_COUNT] = {
@@ -18,6 +19,7 @@ const Instruction instruction_table[INSTRUCTION_COUNT] = {
     {"and", {0xE6, 0x00}, 2, OP_IMM8},
     {"or", {0xF6, 0x00}, 2, OP_IMM8},
     {"xor", {0xEE, 0x00}, 2, OP_IMM8},
+    {"cp", {0xFE, 0x00}, 2, OP_IMM8},
 
     // INC/DEC
     {"inc a", {0x3C}, 1, OP_NOARG},
@@ -293,7 +295,6 @@ const Instruction instruction_table[INSTRUCTION_COUNT] = {
     {"mlt sp", {0xED, 0x7C}, 2, OP_NOARG},
 
     // Swap bytes in register (eZ80 only)
-    {"swapnib a", {0xED, 0x23}, 2, OP_NOARG},
 
     // 24-bit block transfer (ADL mode)
     {"ldirx", {0xED, 0xB4}, 2, OP_NOARG}, // LDIR but with IX/IY in ADL
@@ -355,15 +356,17 @@ const Instruction instruction_table[INSTRUCTION_COUNT] = {
     {"ld hl,(nn)", {0x2A, 0x00, 0x00}, 3, OP_IMM16},
     {"ld (nn),hl", {0x22, 0x00, 0x00}, 3, OP_IMM16},
 
-    // eZ80 LEA instructions (24-bit displacement)
-    {"lea bc,ix+nn", {0xDD, 0x01, 0x00, 0x00}, 4, OP_IMM16},
-    {"lea bc,iy+nn", {0xFD, 0x01, 0x00, 0x00}, 4, OP_IMM16},
-    {"lea de,ix+nn", {0xDD, 0x11, 0x00, 0x00}, 4, OP_IMM16},
-    {"lea de,iy+nn", {0xFD, 0x11, 0x00, 0x00}, 4, OP_IMM16},
-    {"lea hl,ix+nn", {0xDD, 0x21, 0x00, 0x00}, 4, OP_IMM16},
-    {"lea hl,iy+nn", {0xFD, 0x21, 0x00, 0x00}, 4, OP_IMM16},
-    {"lea sp,ix+nn", {0xDD, 0x31, 0x00, 0x00}, 4, OP_IMM16},
-    {"lea sp,iy+nn", {0xFD, 0x31, 0x00, 0x00}, 4, OP_IMM16},
+    // eZ80 LEA instructions (signed 8-bit displacement)
+    {"lea bc,ix+nn", {0xED, 0x02, 0x00}, 3, OP_IMM8},
+    {"lea bc,iy+nn", {0xED, 0x03, 0x00}, 3, OP_IMM8},
+    {"lea de,ix+nn", {0xED, 0x12, 0x00}, 3, OP_IMM8},
+    {"lea de,iy+nn", {0xED, 0x13, 0x00}, 3, OP_IMM8},
+    {"lea hl,ix+nn", {0xED, 0x22, 0x00}, 3, OP_IMM8},
+    {"lea hl,iy+nn", {0xED, 0x23, 0x00}, 3, OP_IMM8},
+    {"lea ix,ix+nn", {0xED, 0x32, 0x00}, 3, OP_IMM8},
+    {"lea iy,iy+nn", {0xED, 0x33, 0x00}, 3, OP_IMM8},
+    {"lea ix,iy+nn", {0xED, 0x55, 0x00}, 3, OP_IMM8},
+    {"lea iy,ix+nn", {0xED, 0x54, 0x00}, 3, OP_IMM8},
 
     // eZ80 push/pop in ADL mode (24-bit regs)
     {"push bc", {0xC5}, 1, OP_NOARG},
@@ -456,9 +459,9 @@ const Instruction instruction_table[INSTRUCTION_COUNT] = {
     {"lea de,sp+nn", {0xED, 0x11, 0x00, 0x00}, 4, OP_IMM16},
     {"lea hl,sp+nn", {0xED, 0x21, 0x00, 0x00}, 4, OP_IMM16},
 
-    {"ld u,nnnnnn", {0xED, 0x6D, 0x00, 0x00, 0x00}, 5, OP_IMM24}, // Load 24-bit user reg
+    {"ld mb,a", {0xED, 0x6D}, 2, OP_NOARG}, // MBASE, the upper address byte in Z80 mode
     {"ld (nnnnnn),u", {0xED, 0x65, 0x00, 0x00, 0x00}, 5, OP_IMM24},
-    {"ld u,(nnnnnn)", {0xED, 0x6F, 0x00, 0x00, 0x00}, 5, OP_IMM24},
+    {"ld a,mb", {0xED, 0x6E}, 2, OP_NOARG},
 
     {"push u", {0xED, 0x75}, 2, OP_NOARG},
     {"pop u",  {0xED, 0x7D}, 2, OP_NOARG},
@@ -466,10 +469,12 @@ const Instruction instruction_table[INSTRUCTION_COUNT] = {
     {"mlt ix", {0xED, 0xDC}, 2, OP_NOARG}, // Multiply IXH*IXL
     {"mlt iy", {0xED, 0xFC}, 2, OP_NOARG}, // Multiply IYH*IYL
 
-    {"tst bc", {0xED, 0x04}, 2, OP_NOARG}, // Test BC (sets flags, no store)
-    {"tst de", {0xED, 0x14}, 2, OP_NOARG},
-    {"tst hl", {0xED, 0x24}, 2, OP_NOARG},
-    {"tst sp", {0xED, 0x34}, 2, OP_NOARG},
+    {"tst d", {0xED, 0x14}, 2, OP_NOARG}, // A AND r, flags only
+    {"tst e", {0xED, 0x1C}, 2, OP_NOARG},
+    {"tst h", {0xED, 0x24}, 2, OP_NOARG},
+    {"tst l", {0xED, 0x2C}, 2, OP_NOARG},
+    {"tst (hl)", {0xED, 0x34}, 2, OP_NOARG},
+    {"tst n", {0xED, 0x64, 0x00}, 3, OP_IMM8},
 
     {"lddrx", {0xED, 0xBC}, 2, OP_NOARG},
     {"cpirx", {0xED, 0xB5}, 2, OP_NOARG},
@@ -511,17 +516,485 @@ const Instruction instruction_table[INSTRUCTION_COUNT] = {
     {"dec iyh", {0xFD, 0x25}, 2, OP_NOARG},
     {"dec iyl", {0xFD, 0x2D}, 2, OP_NOARG},
 
+    // Core Z80 forms the runtime library (and most hand-written code) needs
+    // LD r, r' (ld b,b / c,c / d,d / e,e are the .sis/.lis/.sil/.lil prefixes)
+    {"ld b,c", {0x41}, 1, OP_NOARG},
+    {"ld b,d", {0x42}, 1, OP_NOARG},
+    {"ld b,e", {0x43}, 1, OP_NOARG},
+    {"ld b,h", {0x44}, 1, OP_NOARG},
+    {"ld b,l", {0x45}, 1, OP_NOARG},
+    {"ld b,a", {0x47}, 1, OP_NOARG},
+    {"ld c,b", {0x48}, 1, OP_NOARG},
+    {"ld c,d", {0x4A}, 1, OP_NOARG},
+    {"ld c,e", {0x4B}, 1, OP_NOARG},
+    {"ld c,h", {0x4C}, 1, OP_NOARG},
+    {"ld c,l", {0x4D}, 1, OP_NOARG},
+    {"ld c,a", {0x4F}, 1, OP_NOARG},
+    {"ld d,b", {0x50}, 1, OP_NOARG},
+    {"ld d,c", {0x51}, 1, OP_NOARG},
+    {"ld d,e", {0x53}, 1, OP_NOARG},
+    {"ld d,h", {0x54}, 1, OP_NOARG},
+    {"ld d,l", {0x55}, 1, OP_NOARG},
+    {"ld d,a", {0x57}, 1, OP_NOARG},
+    {"ld e,b", {0x58}, 1, OP_NOARG},
+    {"ld e,c", {0x59}, 1, OP_NOARG},
+    {"ld e,d", {0x5A}, 1, OP_NOARG},
+    {"ld e,h", {0x5C}, 1, OP_NOARG},
+    {"ld e,l", {0x5D}, 1, OP_NOARG},
+    {"ld e,a", {0x5F}, 1, OP_NOARG},
+    {"ld h,b", {0x60}, 1, OP_NOARG},
+    {"ld h,c", {0x61}, 1, OP_NOARG},
+    {"ld h,d", {0x62}, 1, OP_NOARG},
+    {"ld h,e", {0x63}, 1, OP_NOARG},
+    {"ld h,h", {0x64}, 1, OP_NOARG},
+    {"ld h,l", {0x65}, 1, OP_NOARG},
+    {"ld h,a", {0x67}, 1, OP_NOARG},
+    {"ld l,b", {0x68}, 1, OP_NOARG},
+    {"ld l,c", {0x69}, 1, OP_NOARG},
+    {"ld l,d", {0x6A}, 1, OP_NOARG},
+    {"ld l,e", {0x6B}, 1, OP_NOARG},
+    {"ld l,h", {0x6C}, 1, OP_NOARG},
+    {"ld l,l", {0x6D}, 1, OP_NOARG},
+    {"ld l,a", {0x6F}, 1, OP_NOARG},
+    {"ld a,a", {0x7F}, 1, OP_NOARG},
+    // LD r, (HL) / LD (HL), r
+    {"ld b,(hl)", {0x46}, 1, OP_NOARG},
+    {"ld c,(hl)", {0x4E}, 1, OP_NOARG},
+    {"ld d,(hl)", {0x56}, 1, OP_NOARG},
+    {"ld e,(hl)", {0x5E}, 1, OP_NOARG},
+    {"ld h,(hl)", {0x66}, 1, OP_NOARG},
+    {"ld l,(hl)", {0x6E}, 1, OP_NOARG},
+    {"ld (hl),b", {0x70}, 1, OP_NOARG},
+    {"ld (hl),c", {0x71}, 1, OP_NOARG},
+    {"ld (hl),d", {0x72}, 1, OP_NOARG},
+    {"ld (hl),e", {0x73}, 1, OP_NOARG},
+    {"ld (hl),h", {0x74}, 1, OP_NOARG},
+    {"ld (hl),l", {0x75}, 1, OP_NOARG},
+    // LD r, (IX+d) / LD (IX+d), r
+    {"ld b,(ix+0)", {0xDD, 0x46, 0x00}, 3, OP_IMM8},
+    {"ld (ix+0),b", {0xDD, 0x70, 0x00}, 3, OP_IMM8},
+    {"ld c,(ix+0)", {0xDD, 0x4E, 0x00}, 3, OP_IMM8},
+    {"ld (ix+0),c", {0xDD, 0x71, 0x00}, 3, OP_IMM8},
+    {"ld d,(ix+0)", {0xDD, 0x56, 0x00}, 3, OP_IMM8},
+    {"ld (ix+0),d", {0xDD, 0x72, 0x00}, 3, OP_IMM8},
+    {"ld e,(ix+0)", {0xDD, 0x5E, 0x00}, 3, OP_IMM8},
+    {"ld (ix+0),e", {0xDD, 0x73, 0x00}, 3, OP_IMM8},
+    {"ld h,(ix+0)", {0xDD, 0x66, 0x00}, 3, OP_IMM8},
+    {"ld (ix+0),h", {0xDD, 0x74, 0x00}, 3, OP_IMM8},
+    {"ld l,(ix+0)", {0xDD, 0x6E, 0x00}, 3, OP_IMM8},
+    {"ld (ix+0),l", {0xDD, 0x75, 0x00}, 3, OP_IMM8},
+    // INC / DEC
+    {"inc bc", {0x03}, 1, OP_NOARG},
+    {"inc de", {0x13}, 1, OP_NOARG},
+    {"inc hl", {0x23}, 1, OP_NOARG},
+    {"inc sp", {0x33}, 1, OP_NOARG},
+    {"dec bc", {0x0B}, 1, OP_NOARG},
+    {"dec de", {0x1B}, 1, OP_NOARG},
+    {"dec hl", {0x2B}, 1, OP_NOARG},
+    {"dec sp", {0x3B}, 1, OP_NOARG},
+    {"inc d", {0x14}, 1, OP_NOARG},
+    {"inc e", {0x1C}, 1, OP_NOARG},
+    {"inc h", {0x24}, 1, OP_NOARG},
+    {"inc l", {0x2C}, 1, OP_NOARG},
+    {"dec d", {0x15}, 1, OP_NOARG},
+    {"dec e", {0x1D}, 1, OP_NOARG},
+    {"dec h", {0x25}, 1, OP_NOARG},
+    {"dec l", {0x2D}, 1, OP_NOARG},
+    // ALU with A and (HL)
+    {"and a", {0xA7}, 1, OP_NOARG},
+    {"xor a", {0xAF}, 1, OP_NOARG},
+    {"or a", {0xB7}, 1, OP_NOARG},
+    {"add a,(hl)", {0x86}, 1, OP_NOARG},
+    {"adc a,(hl)", {0x8E}, 1, OP_NOARG},
+    {"sub (hl)", {0x96}, 1, OP_NOARG},
+    {"sbc a,(hl)", {0x9E}, 1, OP_NOARG},
+    {"and (hl)", {0xA6}, 1, OP_NOARG},
+    {"xor (hl)", {0xAE}, 1, OP_NOARG},
+    {"or (hl)", {0xB6}, 1, OP_NOARG},
+    {"cp (hl)", {0xBE}, 1, OP_NOARG},
+    {"adc a,b", {0x88}, 1, OP_NOARG},
+    {"adc a,c", {0x89}, 1, OP_NOARG},
+    {"adc a,d", {0x8A}, 1, OP_NOARG},
+    {"adc a,e", {0x8B}, 1, OP_NOARG},
+    {"adc a,h", {0x8C}, 1, OP_NOARG},
+    {"adc a,l", {0x8D}, 1, OP_NOARG},
+    {"adc a,a", {0x8F}, 1, OP_NOARG},
+    {"adc a,n", {0xCE, 0x00}, 2, OP_IMM8},
+    // 16/24-bit arithmetic
+    {"sbc hl,bc", {0xED, 0x42}, 2, OP_NOARG},
+    {"sbc hl,de", {0xED, 0x52}, 2, OP_NOARG},
+    {"sbc hl,hl", {0xED, 0x62}, 2, OP_NOARG},
+    {"ld hl,(hl)", {0xED, 0x27}, 2, OP_NOARG},
+    {"add ix,bc", {0xDD, 0x09}, 2, OP_NOARG},
+    {"add ix,de", {0xDD, 0x19}, 2, OP_NOARG},
+    {"add ix,ix", {0xDD, 0x29}, 2, OP_NOARG},
+    {"add ix,sp", {0xDD, 0x39}, 2, OP_NOARG},
+    // Jumps
+    {"djnz e", {0x10, 0x00}, 2, OP_IMM8},
+    {"jp (hl)", {0xE9}, 1, OP_NOARG},
+    {"jp (ix)", {0xDD, 0xE9}, 2, OP_NOARG},
+    {"jp (iy)", {0xFD, 0xE9}, 2, OP_NOARG},
 };
 
-// Lookup function: case-insensitive match
-const Instruction *lookup_instruction(const char *mnemonic)
+// Indices of instruction_table sorted by mnemonic. Built on the first lookup
+// and kept for the life of the program, so session rebuilds reuse it.
+static uint16_t sorted_index[INSTRUCTION_COUNT];
+static bool index_built = false;
+
+static void build_index(void)
 {
-    for (int i = 0; i < INSTRUCTION_COUNT; i++)
+    // insertion sort; equal mnemonics keep table order so the first entry wins
+    for (uint16_t i = 0; i < INSTRUCTION_COUNT; i++)
     {
-        if (strcasecmp(mnemonic, instruction_table[i].mnemonic) == 0)
+        uint16_t j = i;
+        while (j > 0 && strcasecmp(instruction_table[sorted_index[j - 1]].mnemonic,
+                                   instruction_table[i].mnemonic) > 0)
         {
-            return &instruction_table[i];
+            sorted_index[j] = sorted_index[j - 1];
+            j--;
         }
+        sorted_index[j] = i;
+    }
+    index_built = true;
+}
+
+// Lookup function: case-insensitive match, binary search over sorted_index
+const Instruction *lookup_instruction(const char *mnemonic)
+{
+    if (!index_built)
+        build_index();
+
+    uint16_t lo = 0;
+    uint16_t hi = INSTRUCTION_COUNT;
+    while (lo < hi)
+    {
+        uint16_t mid = (lo + hi) / 2;
+        if (strcasecmp(instruction_table[sorted_index[mid]].mnemonic, mnemonic) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
+    if (lo < INSTRUCTION_COUNT && strcasecmp(instruction_table[sorted_index[lo]].mnemonic, mnemonic) == 0)
+        return &instruction_table[sorted_index[lo]];
     return NULL;
-}
\ No newline at end of file
+}
+
+// Unconditional ret/jp/jr: execution cannot run on into the next statement.
+// operands is NULL when the instruction has none.
+bool instruction_ends_flow(const char *mnemonic, const char *operands)
+{
+    if (strcasecmp(mnemonic, "ret") == 0 || strcasecmp(mnemonic, "reti") == 0 ||
+        strcasecmp(mnemonic, "retn") == 0)
+        return operands == NULL;
+    if (strcasecmp(mnemonic, "jp") == 0 || strcasecmp(mnemonic, "jr") == 0)
+        return operands != NULL && strchr(operands, ',') == NULL;
+    return false;
+}
+
+static uint8_t declared_operand_size(OperandType type)
+{
+    switch (type)
+    {
+    case OP_IMM8:
+        return 1;
+    case OP_IMM16:
+        return 2;
+    case OP_IMM24:
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+static bool is_relative(const char *mnemonic)
+{
+    return strncasecmp(mnemonic, "jr", 2) == 0 || strncasecmp(mnemonic, "djnz", 4) == 0;
+}
+
+// Kind of operand an entry takes and, when its mnemonic shows where it
+// goes, the placeholder's position and length there
+HoleKind instruction_hole(const Instruction *inst, const char **at, uint8_t *length)
+{
+    *at = NULL;
+    *length = 0;
+    if (inst->type != OP_IMM8 && inst->type != OP_IMM16 && inst->type != OP_IMM24)
+        return HOLE_NONE;
+
+    const char *m = inst->mnemonic;
+    const char *rest = strchr(m, ' ');
+    for (const char *p = rest ? rest + 1 : ""; *p; p++)
+    {
+        // a run of n's that is a word of its own
+        if (*p == 'n' && !isalpha((unsigned char)p[-1]))
+        {
+            size_t n = strspn(p, "n");
+            if (!isalpha((unsigned char)p[n]))
+            {
+                *at = p;
+                *length = (uint8_t)n;
+                if (p[-1] == '+')
+                    return HOLE_DISP;
+                return inst->type == OP_IMM8 ? HOLE_BYTE : HOLE_ADDR;
+            }
+            p += n - 1;
+        }
+        else if (*p == '0' && p[-1] == '+' && p[1] == ')')
+        {
+            *at = p;
+            *length = 1;
+            return HOLE_DISP;
+        }
+    }
+    if (is_relative(m))
+    {
+        size_t len = strlen(m);
+        if (m[len - 1] == 'e' && !isalpha((unsigned char)m[len - 2]))
+        {
+            *at = m + len - 1;
+            *length = 1;
+        }
+        return HOLE_REL;
+    }
+    return inst->type == OP_IMM8 ? HOLE_BYTE : HOLE_ADDR;
+}
+
+// Opcode bytes before the operand
+uint8_t instruction_key_length(const Instruction *inst)
+{
+    return inst->length - declared_operand_size(inst->type);
+}
+
+// Encoded length; wide when addresses are 24 bits (ADL mode or an .il suffix)
+uint8_t instruction_size(const Instruction *inst, bool wide)
+{
+    const char *at;
+    uint8_t len;
+    HoleKind hole = instruction_hole(inst, &at, &len);
+    uint8_t key = instruction_key_length(inst);
+    if (hole == HOLE_NONE)
+        return key;
+    if (hole == HOLE_ADDR)
+        return key + (wide ? 3 : 2);
+    return key + 1;
+}
+
+// Write the entry with its operand (for jr, the offset already computed)
+uint8_t instruction_encode(const Instruction *inst, bool wide, unsigned long value, uint8_t *out)
+{
+    uint8_t key = instruction_key_length(inst);
+    uint8_t size = instruction_size(inst, wide);
+    memcpy(out, inst->opcode, key);
+    for (uint8_t i = key; i < size; i++)
+    {
+        out[i] = value & 0xFF;
+        value >>= 8;
+    }
+    return size;
+}
+
+#define HOLE_MARK '\x01'
+
+// An entry's operands with spaces removed and HOLE_MARK at the operand
+static HoleKind entry_pattern(const Instruction *inst, char *pat, size_t size)
+{
+    const char *at;
+    uint8_t len;
+    HoleKind hole = instruction_hole(inst, &at, &len);
+    const char *rest = strchr(inst->mnemonic, ' ');
+    size_t n = 0;
+    for (const char *p = rest ? rest + 1 : ""; *p && n + 3 < size; p++)
+    {
+        if (p == at)
+        {
+            pat[n++] = HOLE_MARK;
+            p += len - 1;
+        }
+        else if (*p != ' ')
+        {
+            pat[n++] = *p;
+        }
+    }
+    if (hole != HOLE_NONE && !at)
+    {
+        if (n)
+            pat[n++] = ',';
+        pat[n++] = HOLE_MARK;
+    }
+    pat[n] = '\0';
+    return hole;
+}
+
+// Register and condition names can never be an operand value, nor start one
+static bool is_register(const char *s)
+{
+    char word[8];
+    uint8_t n = 0;
+    while ((isalnum((unsigned char)s[n]) || s[n] == '\'') && n < sizeof(word) - 1)
+    {
+        word[n] = s[n];
+        n++;
+    }
+    word[n] = '\0';
+    s = word;
+    static const char *const names[] = {
+        "a", "b", "c", "d", "e", "h", "l", "i", "r", "af", "af'", "bc", "de", "hl", "sp",
+        "ix", "iy", "ixh", "ixl", "iyh", "iyl", "mb", "u", "nz", "z", "nc", "po", "pe", "p", "m",
+    };
+    for (uint8_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if (strcasecmp(s, names[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+// Match operands (spaces removed) against a pattern; the text at the hole
+// goes to expr. An index displacement may be left out, (ix), or negative.
+static bool match_pattern(const char *p, const char *s, HoleKind hole, char *expr)
+{
+    expr[0] = '\0';
+    while (*p)
+    {
+        if (hole == HOLE_DISP && p[0] == '+' && p[1] == HOLE_MARK)
+        {
+            if (*s == ')')
+            {
+                strcpy(expr, "0");
+                p += 2;
+                continue;
+            }
+            if (*s == '+')
+                s++;
+            else if (*s != '-')
+                return false;
+            p++;
+            continue;
+        }
+        if (*p == HOLE_MARK)
+        {
+            size_t n = 0;
+            while (s[n] && s[n] != p[1])
+                n++;
+            if (n == 0 || n >= MATCH_EXPR_LEN)
+                return false;
+            memcpy(expr, s, n);
+            expr[n] = '\0';
+            if (strpbrk(expr, "(),") || is_register(expr))
+                return false;
+            s += n;
+            p++;
+            continue;
+        }
+        if (tolower((unsigned char)*p) != tolower((unsigned char)*s))
+            return false;
+        p++;
+        s++;
+    }
+    return *s == '\0';
+}
+
+// strcasecmp of an entry's first word against word
+static int compare_word(const char *mnemonic, const char *word)
+{
+    for (;; mnemonic++, word++)
+    {
+        int a = *mnemonic == ' ' ? 0 : tolower((unsigned char)*mnemonic);
+        int b = tolower((unsigned char)*word);
+        if (a != b || a == 0)
+            return a - b;
+    }
+}
+
+// Position in sorted_index of the first entry whose first word is word
+static uint16_t first_entry(const char *word)
+{
+    if (!index_built)
+        build_index();
+    uint16_t lo = 0;
+    uint16_t hi = INSTRUCTION_COUNT;
+    while (lo < hi)
+    {
+        uint16_t mid = (lo + hi) / 2;
+        if (compare_word(instruction_table[sorted_index[mid]].mnemonic, word) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// True if some entry starts with word, whatever its operands
+bool is_mnemonic(const char *word)
+{
+    uint16_t i = first_entry(word);
+    return i < INSTRUCTION_COUNT && compare_word(instruction_table[sorted_index[i]].mnemonic, word) == 0;
+}
+
+// Every entry for mnemonic word that fits operands (NULL or text up to a
+// ; comment). Entries that differ only in the declared operand width, like
+// ld hl,nn and ld hl,nnnnnn, count once: the mode decides the width.
+uint8_t match_instructions(const char *word, const char *operands, Match *out, uint8_t max)
+{
+    char src[48];
+    uint8_t n = 0;
+    for (const char *p = operands ? operands : ""; *p && *p != ';' && n < sizeof(src) - 1; p++)
+    {
+        if (*p != ' ' && *p != '\t')
+            src[n++] = *p;
+    }
+    src[n] = '\0';
+
+    uint8_t count = 0;
+    for (uint16_t lo = first_entry(word); lo < INSTRUCTION_COUNT && count < max; lo++)
+    {
+        const Instruction *inst = &instruction_table[sorted_index[lo]];
+        if (compare_word(inst->mnemonic, word) != 0)
+            break;
+        char pat[32];
+        HoleKind hole = entry_pattern(inst, pat, sizeof(pat));
+        if (!match_pattern(pat, src, hole, out[count].expr))
+            continue;
+
+        bool duplicate = false;
+        uint8_t key = instruction_key_length(inst);
+        for (uint8_t i = 0; i < count && !duplicate; i++)
+        {
+            duplicate = out[i].hole == hole && instruction_key_length(out[i].inst) == key &&
+                        memcmp(out[i].inst->opcode, inst->opcode, key) == 0;
+        }
+        if (duplicate)
+            continue;
+        out[count].inst = inst;
+        out[count].hole = hole;
+        count++;
+    }
+    return count;
+}
+
+// Prefix byte for an eZ80 mode suffix (.s .l .is .il or the full .sis
+// .lis .sil .lil), or 0 if unknown. Short forms complete from the current
+// mode. wide is set when the suffix makes immediates 24 bits.
+uint8_t suffix_prefix(const char *suffix, bool adl, bool *wide)
+{
+    uint8_t code;
+    if (strcasecmp(suffix, "sis") == 0)
+        code = SUFFIX_SIS;
+    else if (strcasecmp(suffix, "lis") == 0)
+        code = SUFFIX_LIS;
+    else if (strcasecmp(suffix, "sil") == 0)
+        code = SUFFIX_SIL;
+    else if (strcasecmp(suffix, "lil") == 0)
+        code = SUFFIX_LIL;
+    else if (strcasecmp(suffix, "s") == 0)
+        code = adl ? SUFFIX_SIL : SUFFIX_SIS;
+    else if (strcasecmp(suffix, "l") == 0)
+        code = adl ? SUFFIX_LIL : SUFFIX_LIS;
+    else if (strcasecmp(suffix, "is") == 0)
+        code = adl ? SUFFIX_LIS : SUFFIX_SIS;
+    else if (strcasecmp(suffix, "il") == 0)
+        code = adl ? SUFFIX_LIL : SUFFIX_SIL;
+    else
+        return 0;
+    *wide = code == SUFFIX_SIL || code == SUFFIX_LIL;
+    return code;
+}
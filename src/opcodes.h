@@ -2,6 +2,7 @@
 #define OPCODES_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 typedef enum {
     OP_NONE,
@@ -18,10 +19,44 @@ typedef struct {
     OperandType type;
 } Instruction;
 
-#define INSTRUCTION_COUNT 335
+#define INSTRUCTION_COUNT 451
+
+// Where an entry's operand goes and how wide it is. The n/nn/nnnnnn, +0
+// or e in a mnemonic marks its place; without one it follows the mnemonic.
+typedef enum {
+    HOLE_NONE,
+    HOLE_BYTE, // 8-bit immediate
+    HOLE_DISP, // signed 8-bit index displacement
+    HOLE_REL,  // jr target, stored as a signed 8-bit offset
+    HOLE_ADDR  // 16 bits in Z80 mode, 24 in ADL mode, whichever the table says
+} HoleKind;
+
+// eZ80 mode suffix prefixes
+#define SUFFIX_SIS 0x40
+#define SUFFIX_LIS 0x49
+#define SUFFIX_SIL 0x52
+#define SUFFIX_LIL 0x5B
+
+#define MAX_MATCHES 8
+#define MATCH_EXPR_LEN 24
+
+// An entry that fits a source line, with the operand text at its hole
+typedef struct {
+    const Instruction *inst;
+    HoleKind hole;
+    char expr[MATCH_EXPR_LEN];
+} Match;
 
 extern const Instruction instruction_table[INSTRUCTION_COUNT];
 
 const Instruction *lookup_instruction(const char *mnemonic);
+bool instruction_ends_flow(const char *mnemonic, const char *operands);
+HoleKind instruction_hole(const Instruction *inst, const char **at, uint8_t *length);
+uint8_t instruction_key_length(const Instruction *inst);
+uint8_t instruction_size(const Instruction *inst, bool wide);
+uint8_t instruction_encode(const Instruction *inst, bool wide, unsigned long value, uint8_t *out);
+bool is_mnemonic(const char *word);
+uint8_t match_instructions(const char *word, const char *operands, Match *out, uint8_t max);
+uint8_t suffix_prefix(const char *suffix, bool adl, bool *wide);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,102 @@
+#include "options.h"
+#include <fileioc.h>
+#include <string.h>
+#include <ctype.h>
+
+BuildOptions build_options;
+
+// Apply one option; returns false if it is not recognized
+bool options_parse_arg(const char *arg)
+{
+    if (strcmp(arg, "--profile") == 0)
+    {
+        build_options.profile = true;
+        return true;
+    }
+    if (strcmp(arg, "--no-shake") == 0)
+    {
+        build_options.no_shake = true;
+        return true;
+    }
+    if (strcmp(arg, "--session") == 0)
+    {
+        build_options.session = true;
+        return true;
+    }
+    if (strcmp(arg, "--compress") == 0)
+    {
+        build_options.compress = true;
+        return true;
+    }
+    if (strcmp(arg, "--verify") == 0)
+    {
+        build_options.verify = true;
+        return true;
+    }
+    if (strcmp(arg, "--pool") == 0)
+    {
+        build_options.pool = true;
+        return true;
+    }
+    if (strcmp(arg, "--relax") == 0)
+    {
+        build_options.relax = true;
+        return true;
+    }
+    if (strcmp(arg, "--view") == 0)
+    {
+        build_options.view = true;
+        return true;
+    }
+    if (strncmp(arg, "--batch=", 8) == 0)
+    {
+        strncpy(build_options.batch, arg + 8, sizeof(build_options.batch) - 1);
+        return true;
+    }
+    if (strncmp(arg, "--hot=", 6) == 0)
+    {
+        strncpy(build_options.hot, arg + 6, sizeof(build_options.hot) - 1);
+        return true;
+    }
+    if (strncmp(arg, "--index=", 8) == 0)
+    {
+        strncpy(build_options.index_lib, arg + 8, sizeof(build_options.index_lib) - 1);
+        return true;
+    }
+    return false;
+}
+
+// Read options from an AppVar. A missing AppVar leaves the defaults.
+void options_load(const char *name)
+{
+    memset(&build_options, 0, sizeof(build_options));
+
+    ti_var_t f = ti_Open(name, "r");
+    if (!f)
+        return;
+    char buf[32];
+    uint8_t pos = 0;
+    uint8_t ch;
+    bool more = true;
+    bool in_value = false;
+    while (more)
+    {
+        more = ti_Read(&ch, 1, 1, f) == 1;
+        if (!more || ch == '\n' || ch == '\r' || ch == ' ')
+        {
+            buf[pos] = '\0';
+            if (pos > 0)
+                options_parse_arg(buf);
+            pos = 0;
+            in_value = false;
+        }
+        else if (pos < sizeof(buf) - 1)
+        {
+            // flags are case-insensitive, values (AppVar names) are kept as written
+            buf[pos++] = (char)(in_value ? ch : tolower(ch));
+            if (ch == '=')
+                in_value = true;
+        }
+    }
+    ti_Close(f);
+}
@@ -0,0 +1,28 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <stdbool.h>
+
+// Build options, one "--flag" per line in the AOPT AppVar
+#define OPTIONS_APPVAR "AOPT"
+
+typedef struct {
+    bool profile;  // --profile: count entries to each global routine
+    bool no_shake; // --no-shake: keep unreferenced include routines
+    bool session;  // --session: stay resident and offer rebuild/run after each run
+    bool compress; // --compress: save BUILT packed behind a self-extracting stub
+    bool verify;   // --verify: disassemble the image and check it against what was emitted
+    bool view;     // --view: page through a disassembly of BUILT instead of building
+    bool pool;     // --pool: merge identical labelled .db blocks and shared string tails
+    bool relax;    // --relax: assemble jp as jr where the target is in range
+    char index_lib[9]; // --index=LIB_NAME: write the library's index instead of building
+    char batch[9];     // --batch=MANIFEST: headless builds listed in an AppVar
+    char hot[9];       // --hot=LIST: put the routines a hot-list AppVar names first
+} BuildOptions;
+
+extern BuildOptions build_options;
+
+bool options_parse_arg(const char *arg);
+void options_load(const char *name);
+
+#endif
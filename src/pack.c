@@ -0,0 +1,258 @@
+#include "pack.h"
+#include "linker.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Packed stream, one token at a time:
+//   0x00..0x7E  literal run of token+1 bytes, which follow
+//   0x7F        end of stream
+//   0x80..0xFF  copy (token & 0x7F)+3 bytes from distance d back in the
+//               output; d (16) follows
+// Byte tokens keep the decoder short enough to write by hand and fast to
+// run; matches are found greedily through hash chains.
+#define HASH_SIZE 1024
+#define MAX_CHAIN 32
+
+// OS routines and RAM used by the stub
+#define OS_INSERT_MEM 0x020514
+#define OS_ENOUGH_MEM 0x02051C
+#define ASM_PRGM_SIZE 0xD0118C
+
+static uint16_t head[HASH_SIZE]; // most recent position + 1 for each hash
+
+// Runs at userMem. Checks for and inserts GROW bytes after the loaded
+// program, moves stream and decoder up by GROW and enters the decoder
+static const uint8_t stub_head[PACK_HEAD_SIZE] = {
+    0x21, 0, 0, 0,                          //  0 ld hl,GROW
+    0xE5,                                   //  4 push hl
+    0xCD, 0x1C, 0x05, 0x02,                 //  5 call _EnoughMem
+    0xE1,                                   //  9 pop hl
+    0xD8,                                   // 10 ret c
+    0x11, 0, 0, 0,                          // 11 ld de,LOADED_END
+    0xCD, 0x14, 0x05, 0x02,                 // 15 call _InsertMem
+    0x2A, 0x8C, 0x11, 0xD0,                 // 19 ld hl,(asm_prgm_size)
+    0x11, 0, 0, 0,                          // 23 ld de,GROW
+    0x19,                                   // 27 add hl,de
+    0x22, 0x8C, 0x11, 0xD0,                 // 28 ld (asm_prgm_size),hl
+    0x21, 0, 0, 0,                          // 32 ld hl,LOADED_END-1
+    0x11, 0, 0, 0,                          // 36 ld de,NEW_END-1
+    0x01, 0, 0, 0,                          // 40 ld bc,stream+decoder size
+    0xED, 0xB8,                             // 44 lddr
+    0x21, 0, 0, 0,                          // 46 ld hl,stream
+    0x11, 0x81, 0xA8, 0xD1,                 // 50 ld de,userMem
+    0xC3, 0, 0, 0,                          // 54 jp decoder
+};
+
+// HL = stream, DE = output
+static const uint8_t stub_loop[PACK_LOOP_SIZE] = {
+    0x7E,                                   //  0 loop: ld a,(hl)
+    0x23,                                   //  1 inc hl
+    0xFE, PACK_END,                         //  2 cp PACK_END
+    0x28, 0x29,                             //  4 jr z,done
+    0x30, 0x0A,                             //  6 jr nc,match
+    0x01, 0, 0, 0,                          //  8 ld bc,0
+    0x4F,                                   // 12 ld c,a
+    0x03,                                   // 13 inc bc
+    0xED, 0xB0,                             // 14 ldir
+    0x18, 0xEE,                             // 16 jr loop
+    0xE6, 0x7F,                             // 18 match: and 0x7F
+    0xC6, PACK_MIN_MATCH,                   // 20 add a,3
+    0x01, 0, 0, 0,                          // 22 ld bc,0
+    0x4E,                                   // 26 ld c,(hl)
+    0x23,                                   // 27 inc hl
+    0x46,                                   // 28 ld b,(hl)
+    0x23,                                   // 29 inc hl
+    0xE5,                                   // 30 push hl
+    0xD5,                                   // 31 push de
+    0xEB,                                   // 32 ex de,hl
+    0xB7,                                   // 33 or a
+    0xED, 0x42,                             // 34 sbc hl,bc
+    0xD1,                                   // 36 pop de
+    0x01, 0, 0, 0,                          // 37 ld bc,0
+    0x4F,                                   // 41 ld c,a
+    0xED, 0xB0,                             // 42 ldir
+    0xE1,                                   // 44 pop hl
+    0x18, 0xD1,                             // 45 jr loop
+    0xC3, 0x81, 0xA8, 0xD1,                 // 47 done: jp userMem
+};
+
+static void write24(uint8_t *p, uint24_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+}
+
+static uint16_t hash3(const uint8_t *p)
+{
+    return ((p[0] << 6) ^ (p[1] << 3) ^ p[2]) & (HASH_SIZE - 1);
+}
+
+// Largest program pack_program can produce for an image of size bytes
+size_t pack_bound(size_t size)
+{
+    return PACK_HEAD_SIZE + size + size / PACK_MAX_LITERALS + 2 + PACK_LOOP_SIZE;
+}
+
+// Compress image, assembled for userMem, into a self-extracting program.
+// Returns its size, or 0 if it does not fit in cap or memory ran out.
+size_t pack_program(const uint8_t *image, size_t size, uint8_t *out, size_t cap)
+{
+    if (size == 0 || size > 0xFFFF || cap < PACK_HEAD_SIZE + PACK_LOOP_SIZE + 1)
+        return 0;
+    uint16_t *prev = malloc(size * sizeof(uint16_t));
+    if (!prev)
+        return 0;
+    memset(head, 0, sizeof(head));
+
+    uint8_t *stream = out + PACK_HEAD_SIZE;
+    size_t room = cap - PACK_HEAD_SIZE - PACK_LOOP_SIZE - 1; // keep the end token
+    size_t n = 0;      // stream bytes written
+    size_t lit = 0;    // first image byte not yet written
+    size_t pos = 0;
+    size_t margin = 0; // how far output runs ahead of input, at worst
+    bool ok = true;
+
+    while (ok && lit < size)
+    {
+        size_t best_len = 0;
+        size_t best_dist = 0;
+        if (pos + PACK_MIN_MATCH <= size)
+        {
+            size_t limit = size - pos < PACK_MAX_MATCH ? size - pos : PACK_MAX_MATCH;
+            uint16_t h = hash3(image + pos);
+            uint16_t cand = head[h];
+            for (uint8_t chain = 0; cand && chain < MAX_CHAIN; chain++)
+            {
+                size_t c = cand - 1;
+                size_t len = 0;
+                while (len < limit && image[c + len] == image[pos + len])
+                    len++;
+                if (len > best_len)
+                {
+                    best_len = len;
+                    best_dist = pos - c;
+                    if (len == limit)
+                        break;
+                }
+                cand = prev[c];
+            }
+            prev[pos] = head[h];
+            head[h] = pos + 1;
+        }
+
+        if (best_len < PACK_MIN_MATCH && pos < size)
+        {
+            pos++;
+            continue;
+        }
+
+        // flush the literals before the match (or the tail)
+        while (ok && lit < pos)
+        {
+            size_t run = pos - lit < PACK_MAX_LITERALS ? pos - lit : PACK_MAX_LITERALS;
+            if (n + 1 + run > room)
+            {
+                ok = false;
+                break;
+            }
+            stream[n++] = (uint8_t)(run - 1);
+            memcpy(stream + n, image + lit, run);
+            n += run;
+            lit += run;
+            if (lit > n && lit - n > margin)
+                margin = lit - n;
+        }
+        if (!ok || best_len < PACK_MIN_MATCH)
+            break;
+
+        if (n + 3 > room)
+        {
+            ok = false;
+            break;
+        }
+        stream[n++] = (uint8_t)(0x80 | (best_len - PACK_MIN_MATCH));
+        stream[n++] = best_dist & 0xFF;
+        stream[n++] = (best_dist >> 8) & 0xFF;
+
+        // index the positions the match covers so later matches can use them
+        for (size_t i = 1; i < best_len && pos + i + PACK_MIN_MATCH <= size; i++)
+        {
+            uint16_t h = hash3(image + pos + i);
+            prev[pos + i] = head[h];
+            head[h] = pos + i + 1;
+        }
+        pos += best_len;
+        lit = pos;
+        if (lit > n && lit - n > margin)
+            margin = lit - n;
+    }
+    free(prev);
+    if (!ok)
+        return 0;
+    stream[n++] = PACK_END;
+
+    // The stream must sit far enough above userMem that unpacking never
+    // overwrites bytes it has not read yet, and above the stub
+    size_t start = margin > PACK_HEAD_SIZE ? margin : PACK_HEAD_SIZE + 1;
+    size_t moved = n + PACK_LOOP_SIZE;
+    uint24_t grow = start - PACK_HEAD_SIZE;
+    uint24_t loaded_end = USER_MEM + PACK_HEAD_SIZE + moved;
+    uint24_t new_end = USER_MEM + start + moved;
+
+    memcpy(out, stub_head, PACK_HEAD_SIZE);
+    write24(out + 1, grow);
+    write24(out + 12, loaded_end);
+    write24(out + 24, grow);
+    write24(out + 33, loaded_end - 1);
+    write24(out + 37, new_end - 1);
+    write24(out + 41, moved);
+    write24(out + 47, USER_MEM + start);
+    write24(out + 55, USER_MEM + start + n);
+    memcpy(stream + n, stub_loop, PACK_LOOP_SIZE);
+    return PACK_HEAD_SIZE + moved;
+}
+
+// Whether program (without the OS header) starts with the stub
+bool pack_detect(const uint8_t *program, size_t size)
+{
+    // compare the parts that do not depend on the image
+    return size > PACK_HEAD_SIZE + PACK_LOOP_SIZE &&
+           memcmp(program + 4, stub_head + 4, 8) == 0 &&
+           memcmp(program + 15, stub_head + 15, 8) == 0;
+}
+
+// Unpack a program made by pack_program (without the OS header), the way
+// the stub does. Returns the image size, or 0 if it is malformed.
+size_t pack_unpack(const uint8_t *program, size_t size, uint8_t *out, size_t cap)
+{
+    size_t in = PACK_HEAD_SIZE;
+    size_t n = 0;
+    while (in < size)
+    {
+        uint8_t token = program[in++];
+        if (token == PACK_END)
+            return n;
+        if (token < PACK_END)
+        {
+            size_t run = token + 1;
+            if (in + run > size || n + run > cap)
+                return 0;
+            memcpy(out + n, program + in, run);
+            in += run;
+            n += run;
+            continue;
+        }
+        if (in + 2 > size)
+            return 0;
+        size_t len = (token & 0x7F) + PACK_MIN_MATCH;
+        size_t dist = program[in] | (program[in + 1] << 8);
+        in += 2;
+        if (dist == 0 || dist > n || n + len > cap)
+            return 0;
+        for (size_t i = 0; i < len; i++, n++)
+            out[n] = out[n - dist];
+    }
+    return 0;
+}
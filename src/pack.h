@@ -0,0 +1,27 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __INTELLISENSE__
+typedef unsigned long uint24_t;
+#endif
+
+// Compressed programs: a small stub at userMem grows the program's memory,
+// moves the packed stream and its decoder to the top and unpacks the image
+// back down to userMem before jumping to it.
+#define PACK_HEAD_SIZE 58    // stub bytes before the stream
+#define PACK_LOOP_SIZE 51    // decoder after the stream
+#define PACK_MAX_LITERALS 127
+#define PACK_MIN_MATCH 3
+#define PACK_MAX_MATCH 130
+#define PACK_END 0x7F        // token that ends the stream
+
+size_t pack_bound(size_t size);
+size_t pack_program(const uint8_t *image, size_t size, uint8_t *out, size_t cap);
+bool pack_detect(const uint8_t *program, size_t size);
+size_t pack_unpack(const uint8_t *program, size_t size, uint8_t *out, size_t cap);
+
+#endif
@@ -0,0 +1,112 @@
+#include "pool.h"
+#include <string.h>
+
+typedef struct
+{
+    uint16_t hash;
+    uint16_t length;
+    uint16_t bytes; // offset in store
+    uint24_t pc;
+} Block;
+
+typedef struct
+{
+    uint16_t first_line; // the label's line
+    uint16_t last_line;  // its last .db line
+} Dropped;
+
+static Block blocks[POOL_MAX_BLOCKS];
+static uint8_t block_count = 0;
+static uint8_t store[POOL_BYTES];
+static uint16_t store_used = 0;
+static Dropped dropped[POOL_MAX_DROPPED];
+static uint8_t dropped_count = 0;
+static uint24_t saved = 0;
+
+static uint16_t block_hash(const uint8_t *bytes, uint16_t length)
+{
+    uint16_t h = 0x811C;
+    for (uint16_t i = 0; i < length; i++)
+        h = (uint16_t)((h ^ bytes[i]) * 0x0193);
+    return h;
+}
+
+// Start of each pass 1: blocks are collected again in source order
+void pool_reset(void)
+{
+    block_count = 0;
+    store_used = 0;
+    dropped_count = 0;
+    saved = 0;
+}
+
+// Pass 1: where an earlier block already holds these bytes. Identical
+// blocks are found by hash; a zero-terminated block may also share the
+// tail of a longer zero-terminated one.
+bool pool_find(const uint8_t *bytes, uint16_t length, uint24_t *pc)
+{
+    if (length == 0 || dropped_count >= POOL_MAX_DROPPED)
+        return false;
+    uint16_t hash = block_hash(bytes, length);
+    bool string = bytes[length - 1] == 0;
+    for (uint8_t i = 0; i < block_count; i++)
+    {
+        const Block *b = &blocks[i];
+        const uint8_t *kept = store + b->bytes;
+        if (b->length == length && b->hash == hash && memcmp(kept, bytes, length) == 0)
+        {
+            *pc = b->pc;
+            return true;
+        }
+        if (string && b->length > length && kept[b->length - 1] == 0 &&
+            memcmp(kept + b->length - length, bytes, length) == 0)
+        {
+            *pc = b->pc + (b->length - length);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Pass 1: a block that was emitted at pc; later blocks may share it
+void pool_add(const uint8_t *bytes, uint16_t length, uint24_t pc)
+{
+    if (length == 0 || block_count >= POOL_MAX_BLOCKS || store_used + length > POOL_BYTES)
+        return;
+    Block *b = &blocks[block_count++];
+    b->hash = block_hash(bytes, length);
+    b->length = length;
+    b->bytes = store_used;
+    b->pc = pc;
+    memcpy(store + store_used, bytes, length);
+    store_used += length;
+}
+
+// Pass 1: the block on these lines is not emitted
+void pool_drop(uint16_t first_line, uint16_t last_line, uint16_t length)
+{
+    Dropped *d = &dropped[dropped_count++];
+    d->first_line = first_line;
+    d->last_line = last_line;
+    saved += length;
+}
+
+// Pass 2: whether the block labelled on line was dropped in pass 1
+bool pool_dropped(uint16_t line, uint16_t *last_line)
+{
+    for (uint8_t i = 0; i < dropped_count; i++)
+    {
+        if (dropped[i].first_line == line)
+        {
+            *last_line = dropped[i].last_line;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Bytes not emitted in the last pass 1
+uint24_t pool_saved(void)
+{
+    return saved;
+}
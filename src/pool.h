@@ -0,0 +1,27 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __INTELLISENSE__
+typedef unsigned long uint24_t;
+#endif
+
+// Constant pool (--pool): a label followed only by .db lines is a data
+// block. A block identical to an earlier one, or a zero-terminated block
+// that is the tail of an earlier one, is not emitted; its label points
+// into the earlier copy instead.
+#define POOL_MAX_BLOCKS 64
+#define POOL_MAX_DROPPED 64
+#define POOL_BYTES 2048     // bytes of kept blocks held for comparison
+#define POOL_MAX_BLOCK 256  // longer blocks are never pooled
+
+void pool_reset(void);
+bool pool_find(const uint8_t *bytes, uint16_t length, uint24_t *pc);
+void pool_add(const uint8_t *bytes, uint16_t length, uint24_t pc);
+void pool_drop(uint16_t first_line, uint16_t last_line, uint16_t length);
+bool pool_dropped(uint16_t line, uint16_t *last_line);
+uint24_t pool_saved(void);
+
+#endif
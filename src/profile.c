@@ -0,0 +1,137 @@
+#include "profile.h"
+#include "console.h"
+#include "linker.h"
+#include <tice.h>
+#include <fileioc.h>
+#include <string.h>
+#include <stdio.h>
+
+// Instrumented routine names, in counter order. Filled in pass 1.
+static char routine_names[PROFILE_MAX_ROUTINES][PROFILE_NAME_LEN];
+static uint8_t routine_count = 0;
+
+void profile_reset(void)
+{
+    routine_count = 0;
+}
+
+// Register a routine in pass 1; returns its counter index or -1 when full
+int profile_add_routine(const char *name)
+{
+    if (routine_count >= PROFILE_MAX_ROUTINES)
+        return -1;
+    strncpy(routine_names[routine_count], name, PROFILE_NAME_LEN);
+    routine_names[routine_count][PROFILE_NAME_LEN - 1] = '\0';
+    return routine_count++;
+}
+
+uint8_t profile_routine_count(void)
+{
+    return routine_count;
+}
+
+// Write the entry counter sequence for a counter at counter_addr.
+// Preserves all registers and flags (inc hl does not touch flags).
+void profile_stub(uint8_t *out, uint24_t counter_addr)
+{
+    uint8_t lo = counter_addr & 0xFF;
+    uint8_t mid = (counter_addr >> 8) & 0xFF;
+    uint8_t hi = (counter_addr >> 16) & 0xFF;
+
+    out[0] = 0xE5; // push hl
+    out[1] = 0x2A; // ld hl,(counter)
+    out[2] = lo;
+    out[3] = mid;
+    out[4] = hi;
+    out[5] = 0x23; // inc hl
+    out[6] = 0x22; // ld (counter),hl
+    out[7] = lo;
+    out[8] = mid;
+    out[9] = hi;
+    out[10] = 0xE1; // pop hl
+    linker_reloc_at(out + 2, 3);
+    linker_reloc_at(out + 7, 3);
+}
+
+// Save the counters the program left behind, paired with their routine names
+bool profile_dump(const char *appvar, const uint8_t *counters)
+{
+    ti_Delete(appvar);
+    ti_var_t f = ti_Open(appvar, "w");
+    if (!f)
+        return false;
+    ti_Write("PRF", 1, 3, f);
+    ti_Write(&routine_count, 1, 1, f);
+    for (uint8_t i = 0; i < routine_count; i++)
+    {
+        ti_Write(routine_names[i], 1, PROFILE_NAME_LEN, f);
+        ti_Write(counters + i * PROFILE_COUNTER_SIZE, 1, PROFILE_COUNTER_SIZE, f);
+    }
+    ti_Close(f);
+    return true;
+}
+
+// Read the entries of a previous profile run (at most PROFILE_MAX_ROUTINES).
+// Returns how many were read, 0 if the AppVar is missing or not a profile.
+uint8_t profile_read(const char *appvar, ProfileEntry *entries)
+{
+    ti_var_t f = ti_Open(appvar, "r");
+    if (!f)
+        return 0;
+
+    char magic[3];
+    uint8_t count = 0;
+    if (ti_Read(magic, 1, 3, f) != 3 || memcmp(magic, "PRF", 3) != 0 ||
+        ti_Read(&count, 1, 1, f) != 1)
+    {
+        ti_Close(f);
+        return 0;
+    }
+    if (count > PROFILE_MAX_ROUTINES)
+        count = PROFILE_MAX_ROUTINES;
+
+    uint8_t n = 0;
+    for (; n < count; n++)
+    {
+        uint8_t raw[PROFILE_COUNTER_SIZE];
+        if (ti_Read(entries[n].name, 1, PROFILE_NAME_LEN, f) != PROFILE_NAME_LEN ||
+            ti_Read(raw, 1, PROFILE_COUNTER_SIZE, f) != PROFILE_COUNTER_SIZE)
+            break;
+        entries[n].name[PROFILE_NAME_LEN - 1] = '\0';
+        entries[n].count = raw[0] | ((uint24_t)raw[1] << 8) | ((uint24_t)raw[2] << 16);
+    }
+    ti_Close(f);
+    return n;
+}
+
+// Print the routines from a previous profile run, hottest first
+void profile_report(const char *appvar)
+{
+    static ProfileEntry entries[PROFILE_MAX_ROUTINES];
+    uint8_t n = profile_read(appvar, entries);
+    if (n == 0)
+        return;
+
+    // insertion sort by count, descending; n is at most PROFILE_MAX_ROUTINES
+    for (uint8_t i = 1; i < n; i++)
+    {
+        ProfileEntry e = entries[i];
+        uint8_t j = i;
+        while (j > 0 && entries[j - 1].count < e.count)
+        {
+            entries[j] = entries[j - 1];
+            j--;
+        }
+        entries[j] = e;
+    }
+
+    console_print("Hot routines:");
+    console_newline();
+    char buf[PROFILE_NAME_LEN + 24]; // name, a space and the widest %lu
+    for (uint8_t i = 0; i < n; i++)
+    {
+        snprintf(buf, sizeof(buf), "%-15.15s %lu", entries[i].name, (unsigned long)entries[i].count);
+        console_print(buf);
+        console_newline();
+    }
+}
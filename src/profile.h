@@ -0,0 +1,35 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __INTELLISENSE__
+typedef unsigned long uint24_t;
+#endif
+
+// push hl / ld hl,(counter) / inc hl / ld (counter),hl / pop hl  (ADL mode)
+#define PROFILE_STUB_SIZE 11
+#define PROFILE_COUNTER_SIZE 3
+#define PROFILE_MAX_ROUTINES 64
+#define PROFILE_NAME_LEN 16
+
+#define PROFILE_APPVAR "APROF"
+
+// Profile AppVar layout: "PRF" magic, entry count, then per entry the
+// routine name (PROFILE_NAME_LEN bytes) and a 24-bit little-endian count
+typedef struct
+{
+    char name[PROFILE_NAME_LEN];
+    uint24_t count;
+} ProfileEntry;
+
+void profile_reset(void);
+int profile_add_routine(const char *name);
+uint8_t profile_routine_count(void);
+void profile_stub(uint8_t *out, uint24_t counter_addr);
+bool profile_dump(const char *appvar, const uint8_t *counters);
+uint8_t profile_read(const char *appvar, ProfileEntry *entries);
+void profile_report(const char *appvar);
+
+#endif
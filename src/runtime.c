@@ -0,0 +1,348 @@
+#include "runtime.h"
+#include <string.h>
+#include <ctype.h>
+
+typedef struct
+{
+    const char *name;
+    const char *source; // one line per '\n', starting with the label
+} Routine;
+
+// Cycle counts in the comments are the analyzer's (.assert_cycles) with
+// zero wait states: best-worst, or fixed + per byte for the block routines.
+static const Routine routines[] = {
+    // HL = A * E, 16-bit result. 14 cycles.
+    {"__mul8",
+     "__mul8:\n"
+     "    ld hl,0\n"
+     "    ld h,a\n"
+     "    ld l,e\n"
+     "    mlt hl\n"
+     "    ret\n"},
+
+    // HL = HL * DE, low 16 bits (HLU = 0). A and F destroyed. 35 cycles.
+    {"__mul16",
+     "__mul16:\n"
+     "    push bc\n"
+     "    ld b,h\n"
+     "    ld c,e\n"
+     "    mlt bc\n"
+     "    ld a,c\n"
+     "    ld b,l\n"
+     "    ld c,d\n"
+     "    mlt bc\n"
+     "    add a,c\n"
+     "    ld c,l\n"
+     "    ld hl,0\n"
+     "    ld h,c\n"
+     "    ld l,e\n"
+     "    mlt hl\n"
+     "    add a,h\n"
+     "    ld h,a\n"
+     "    pop bc\n"
+     "    ret\n"},
+
+    // HL = HL * DE, low 24 bits, from six mlt partial products. A and F
+    // destroyed, BC, DE and IX kept. 141 cycles.
+    {"__mul24",
+     "__mul24:\n"
+     "    push ix\n"
+     "    push bc\n"
+     "    push de\n"
+     "    push hl\n"
+     "    ld ix,0\n"
+     "    add ix,sp\n"
+     "    ld b,(ix+0)\n"
+     "    ld c,(ix+5)\n"
+     "    mlt bc\n"
+     "    ld d,c\n"
+     "    ld b,(ix+1)\n"
+     "    ld c,(ix+4)\n"
+     "    mlt bc\n"
+     "    ld a,c\n"
+     "    add a,d\n"
+     "    ld d,a\n"
+     "    ld b,(ix+2)\n"
+     "    ld c,(ix+3)\n"
+     "    mlt bc\n"
+     "    ld a,c\n"
+     "    add a,d\n"
+     "    ld d,a\n"
+     "    ld b,(ix+0)\n"
+     "    ld c,(ix+4)\n"
+     "    mlt bc\n"
+     "    ld e,c\n"
+     "    ld a,b\n"
+     "    add a,d\n"
+     "    ld d,a\n"
+     "    ld b,(ix+1)\n"
+     "    ld c,(ix+3)\n"
+     "    mlt bc\n"
+     "    ld a,c\n"
+     "    add a,e\n"
+     "    ld e,a\n"
+     "    ld a,d\n"
+     "    adc a,b\n"
+     "    ld d,a\n"
+     "    ld b,(ix+0)\n"
+     "    ld c,(ix+3)\n"
+     "    mlt bc\n"
+     "    ld (ix+0),c\n"
+     "    ld a,b\n"
+     "    add a,e\n"
+     "    ld (ix+1),a\n"
+     "    ld a,d\n"
+     "    adc a,0\n"
+     "    ld (ix+2),a\n"
+     "    pop hl\n"
+     "    pop de\n"
+     "    pop bc\n"
+     "    pop ix\n"
+     "    ret\n"},
+
+    // HL = HL / DE, DE = HL % DE, unsigned, one quotient bit per trip.
+    // Dividing by zero gives 0xFFFFFF. A and F destroyed. 412-508 cycles.
+    {"__divu24",
+     "__divu24:\n"
+     "    push bc\n"
+     "    push de\n"
+     "    pop bc\n"
+     "    ex de,hl\n"
+     "    or a\n"
+     "    sbc hl,hl\n"
+     "    ld a,24\n"
+     ".loop:\n"
+     "    ex de,hl\n"
+     "    add hl,hl\n"
+     "    ex de,hl\n"
+     "    adc hl,hl\n"
+     "    jr c,.over\n"
+     "    or a\n"
+     "    sbc hl,bc\n"
+     "    jr nc,.fits\n"
+     "    add hl,bc\n"
+     "    jr .next\n"
+     ".over:\n"
+     "    or a\n"
+     "    sbc hl,bc\n"
+     ".fits:\n"
+     "    inc de\n"
+     ".next:\n"
+     "    dec a\n"
+     "    .trips 24\n"
+     "    jr nz,.loop\n"
+     "    ex de,hl\n"
+     "    pop bc\n"
+     "    ret\n"},
+
+    // Fill BC bytes at HL with A (BC may be 0). DE and BC destroyed.
+    // 47 cycles + 3 per byte (19 for none).
+    {"__memset",
+     "__memset:\n"
+     "    push hl\n"
+     "    or a\n"
+     "    sbc hl,hl\n"
+     "    adc hl,bc\n"
+     "    pop hl\n"
+     "    ret z\n"
+     "    ld (hl),a\n"
+     "    dec bc\n"
+     "    push hl\n"
+     "    pop de\n"
+     "    inc de\n"
+     "    push hl\n"
+     "    or a\n"
+     "    sbc hl,hl\n"
+     "    adc hl,bc\n"
+     "    pop hl\n"
+     "    ret z\n"
+     "    ldir\n"
+     "    ret\n"},
+
+    // Copy BC bytes from HL to DE (BC may be 0); the regions must not
+    // overlap with DE above HL. 23 cycles + 3 per byte (19 for none).
+    {"__memcpy",
+     "__memcpy:\n"
+     "    push hl\n"
+     "    or a\n"
+     "    sbc hl,hl\n"
+     "    adc hl,bc\n"
+     "    pop hl\n"
+     "    ret z\n"
+     "    ldir\n"
+     "    ret\n"},
+
+    // Copy BC bytes from HL to DE, regions may overlap: backwards with
+    // lddr when DE is above HL, else through __memcpy.
+    // At most 43 cycles + 3 per byte.
+    {"__memmove",
+     "__memmove:\n"
+     "    push hl\n"
+     "    or a\n"
+     "    sbc hl,de\n"
+     "    pop hl\n"
+     "    jr c,.back\n"
+     "    jp __memcpy\n"
+     ".back:\n"
+     "    push hl\n"
+     "    or a\n"
+     "    sbc hl,hl\n"
+     "    adc hl,bc\n"
+     "    pop hl\n"
+     "    ret z\n"
+     "    add hl,bc\n"
+     "    dec hl\n"
+     "    ex de,hl\n"
+     "    add hl,bc\n"
+     "    dec hl\n"
+     "    ex de,hl\n"
+     "    lddr\n"
+     "    ret\n"},
+
+    // BC = length of the zero-terminated string at HL, with one cpir.
+    // A = 0, F destroyed. 37 cycles + 2 per character.
+    {"__strlen",
+     "__strlen:\n"
+     "    push hl\n"
+     "    xor a\n"
+     "    ld bc,0\n"
+     "    cpir\n"
+     "    scf\n"
+     "    sbc hl,hl\n"
+     "    or a\n"
+     "    sbc hl,bc\n"
+     "    push hl\n"
+     "    pop bc\n"
+     "    pop hl\n"
+     "    ret\n"},
+
+    // Copy the zero-terminated string at HL to DE, terminator included.
+    // HL and DE end past the terminators, A = 0. 15 cycles + 10 per
+    // character.
+    {"__strcpy",
+     "__strcpy:\n"
+     "    ld a,(hl)\n"
+     "    ld (de),a\n"
+     "    inc hl\n"
+     "    inc de\n"
+     "    or a\n"
+     "    jr nz,__strcpy\n"
+     "    ret\n"},
+
+    // Compare the strings at HL and DE: Z if equal, else C if HL's sorts
+    // first. HL and DE end at the first difference. 12-15 cycles + 16 per
+    // matching character.
+    {"__strcmp",
+     "__strcmp:\n"
+     "    ld a,(hl)\n"
+     "    ex de,hl\n"
+     "    cp (hl)\n"
+     "    ex de,hl\n"
+     "    ret nz\n"
+     "    or a\n"
+     "    ret z\n"
+     "    inc hl\n"
+     "    inc de\n"
+     "    jr __strcmp\n"},
+};
+
+#define ROUTINE_COUNT (sizeof(routines) / sizeof(routines[0]))
+
+uint8_t runtime_count(void)
+{
+    return ROUTINE_COUNT;
+}
+
+const char *runtime_name(uint8_t routine)
+{
+    return routines[routine].name;
+}
+
+const char *runtime_source(uint8_t routine)
+{
+    return routines[routine].source;
+}
+
+// Line number of a routine's label in the runtime as one file, from 1
+uint16_t runtime_first_line(uint8_t routine)
+{
+    uint16_t number = 1;
+    for (uint8_t r = 0; r < routine; r++)
+    {
+        for (const char *p = routines[r].source; *p; p++)
+        {
+            if (*p == '\n')
+                number++;
+        }
+    }
+    return number;
+}
+
+int runtime_find(const char *name)
+{
+    for (uint8_t r = 0; r < ROUTINE_COUNT; r++)
+    {
+        if (strcmp(routines[r].name, name) == 0)
+            return r;
+    }
+    return -1;
+}
+
+// Select every routine named in text, skipping strings and ';' comments
+static void select_named(const char *text, bool *selected)
+{
+    const char *p = text;
+    while (*p)
+    {
+        if (*p == ';')
+        {
+            while (*p && *p != '\n')
+                p++;
+            continue;
+        }
+        if (*p == '"' || *p == '\'')
+        {
+            char quote = *p++;
+            while (*p && *p != quote && *p != '\n')
+                p++;
+            if (*p == quote)
+                p++;
+            continue;
+        }
+        if (!isalpha((unsigned char)*p) && *p != '_')
+        {
+            p++;
+            continue;
+        }
+        char word[16];
+        uint8_t n = 0;
+        while (isalnum((unsigned char)*p) || *p == '_')
+        {
+            if (n < sizeof(word) - 1)
+                word[n++] = *p;
+            p++;
+        }
+        word[n] = '\0';
+        if (word[0] != '_' || word[1] != '_')
+            continue;
+        int routine = runtime_find(word);
+        if (routine >= 0)
+            runtime_select(routine, selected);
+    }
+}
+
+// Select a routine and the routines it calls. A routine already selected
+// (or one the program defines itself, marked selected by the caller) is
+// not scanned again.
+void runtime_select(uint8_t routine, bool *selected)
+{
+    if (selected[routine])
+        return;
+    selected[routine] = true;
+    select_named(routines[routine].source, selected);
+}
+
+void runtime_select_referenced(const char *line, bool *selected)
+{
+    select_named(line, selected);
+}
@@ -0,0 +1,21 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Built-in runtime library: ADL routines named __name (__mul24, __memcpy,
+// ...) that a program can call without an include. Only the routines the
+// program names, plus the ones those call, are added after its last line.
+#define RUNTIME_MAX_ROUTINES 16
+#define RUNTIME_FILE "RUNTIME" // file name in diagnostics
+
+uint8_t runtime_count(void);
+const char *runtime_name(uint8_t routine);
+const char *runtime_source(uint8_t routine);
+uint16_t runtime_first_line(uint8_t routine);
+int runtime_find(const char *name);
+void runtime_select(uint8_t routine, bool *selected);
+void runtime_select_referenced(const char *line, bool *selected);
+
+#endif
@@ -0,0 +1,178 @@
+#include "shake.h"
+#include <string.h>
+
+#define SHAKE_ENTRY 0xFF // references made before the first label
+
+typedef struct
+{
+    uint16_t hash;
+    uint16_t line;
+    uint24_t pc;
+    bool library;       // defined in an included file
+    bool falls_through; // last statement can continue into the next routine
+    bool live;
+} Routine;
+
+typedef struct
+{
+    uint8_t from;
+    uint16_t hash;
+} Ref;
+
+static Routine routines[SHAKE_MAX_ROUTINES];
+static uint8_t routine_count = 0;
+static Ref refs[SHAKE_MAX_REFS];
+static uint16_t ref_count = 0;
+static uint16_t exports[SHAKE_MAX_EXPORTS];
+static uint8_t export_count = 0;
+static bool overflow = false;
+static bool analyzed = false; // later passes must not add to the graph
+
+// Names are kept as 16-bit hashes; a collision only keeps an extra routine
+static uint16_t name_hash(const char *name)
+{
+    uint16_t h = 0x811C;
+    while (*name)
+        h = (uint16_t)((h ^ (uint8_t)*name++) * 0x0193);
+    return h;
+}
+
+void shake_reset(void)
+{
+    routine_count = 0;
+    ref_count = 0;
+    export_count = 0;
+    overflow = false;
+    analyzed = false;
+}
+
+// Pass 1: a label starts a new routine
+void shake_begin_routine(const char *name, uint16_t line, uint24_t pc, bool library)
+{
+    if (analyzed)
+        return;
+    if (routine_count >= SHAKE_MAX_ROUTINES)
+    {
+        overflow = true;
+        return;
+    }
+    Routine *r = &routines[routine_count++];
+    r->hash = name_hash(name);
+    r->line = line;
+    r->pc = pc;
+    r->library = library;
+    r->falls_through = true;
+    r->live = false;
+}
+
+// Pass 1: the current routine references a label
+void shake_note_reference(const char *name)
+{
+    if (analyzed)
+        return;
+    if (ref_count >= SHAKE_MAX_REFS)
+    {
+        overflow = true;
+        return;
+    }
+    refs[ref_count].from = routine_count ? routine_count - 1 : SHAKE_ENTRY;
+    refs[ref_count].hash = name_hash(name);
+    ref_count++;
+}
+
+// Pass 1: called after each statement; the last one decides fall-through
+void shake_note_flow(bool falls_through)
+{
+    if (!analyzed && routine_count)
+        routines[routine_count - 1].falls_through = falls_through;
+}
+
+void shake_export(const char *name)
+{
+    if (analyzed)
+        return;
+    if (export_count >= SHAKE_MAX_EXPORTS)
+    {
+        overflow = true;
+        return;
+    }
+    exports[export_count++] = name_hash(name);
+}
+
+static bool mark_hash(uint16_t hash)
+{
+    bool changed = false;
+    for (uint8_t i = 0; i < routine_count; i++)
+    {
+        if (!routines[i].live && routines[i].hash == hash)
+        {
+            routines[i].live = true;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// After pass 1: mark live routines. Returns the bytes that dropping the dead
+// ones saves (0 when nothing can be dropped).
+uint24_t shake_run(uint24_t code_end)
+{
+    analyzed = true;
+    if (overflow)
+        return 0;
+
+    // roots: everything in the main source, plus exports
+    for (uint8_t i = 0; i < routine_count; i++)
+        routines[i].live = !routines[i].library;
+    for (uint8_t e = 0; e < export_count; e++)
+        mark_hash(exports[e]);
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (uint16_t r = 0; r < ref_count; r++)
+        {
+            if (refs[r].from == SHAKE_ENTRY || routines[refs[r].from].live)
+                changed |= mark_hash(refs[r].hash);
+        }
+        for (uint8_t i = 0; i + 1 < routine_count; i++)
+        {
+            if (routines[i].live && routines[i].falls_through && !routines[i + 1].live)
+            {
+                routines[i + 1].live = true;
+                changed = true;
+            }
+        }
+    }
+
+    uint24_t removed = 0;
+    for (uint8_t i = 0; i < routine_count; i++)
+    {
+        if (!routines[i].live)
+        {
+            uint24_t end = (i + 1 < routine_count) ? routines[i + 1].pc : code_end;
+            if (end > routines[i].pc) // routines in other sections are not contiguous
+                removed += end - routines[i].pc;
+        }
+    }
+    return removed;
+}
+
+uint8_t shake_routine_count(void)
+{
+    return routine_count;
+}
+
+// A routine's lines run from its label line up to the next routine's label
+bool shake_routine_dead(uint8_t index, uint16_t *first_line)
+{
+    *first_line = routines[index].line;
+    return !routines[index].live;
+}
+
+// Pass 1: can the routine's last statement run on into the next routine?
+bool shake_routine_falls_through(uint8_t index)
+{
+    return routines[index].falls_through;
+}
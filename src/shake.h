@@ -0,0 +1,28 @@
+#ifndef SHAKE_H
+#define SHAKE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __INTELLISENSE__
+typedef unsigned long uint24_t;
+#endif
+
+// Tree shaking: a routine is a label up to the next label. Routines from
+// include files are dropped unless reachable from the main source or an
+// exported symbol. Analysis is conservative: on overflow nothing is dropped.
+#define SHAKE_MAX_ROUTINES 64
+#define SHAKE_MAX_REFS 256
+#define SHAKE_MAX_EXPORTS 16
+
+void shake_reset(void);
+void shake_begin_routine(const char *name, uint16_t line, uint24_t pc, bool library);
+void shake_note_reference(const char *name);
+void shake_note_flow(bool falls_through);
+void shake_export(const char *name);
+uint24_t shake_run(uint24_t code_end);
+uint8_t shake_routine_count(void);
+bool shake_routine_dead(uint8_t index, uint16_t *first_line);
+bool shake_routine_falls_through(uint8_t index);
+
+#endif
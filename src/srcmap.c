@@ -0,0 +1,223 @@
+#include "srcmap.h"
+#include "diag.h"
+#include <fileioc.h>
+#include <string.h>
+#include <stdio.h>
+
+// Source map AppVar layout, little-endian:
+//   "SMP", version 1, end address (24), file count (8), checkpoint count (16),
+//   stream size (16)
+//   file names, SRCMAP_NAME_LEN bytes each, NUL padded, by file id
+//   checkpoints: address (24) and stream offset (16) of every SRCMAP_BLOCK-th entry
+//   entry stream
+// Each entry starts a range of code that runs to the next entry's address
+// (or the end address). Entries are deltas from the previous one:
+//   addr_delta (8, 1..255), line_delta (8, signed)  same file
+//   0, address (24), file (8), line (16)           absolute, starts each block
+static uint8_t stream[SRCMAP_STREAM_SIZE];
+static uint16_t stream_size = 0;
+static uint8_t checkpoints[SRCMAP_MAX_BLOCKS][SRCMAP_CHECKPOINT_SIZE];
+static uint16_t entry_count = 0;
+static uint24_t end_addr = 0;
+static bool full = false;
+static uint8_t max_file = 0;
+
+static uint24_t last_addr;
+static uint8_t last_file;
+static uint16_t last_line;
+
+static uint24_t read24(const uint8_t *p)
+{
+    return p[0] | ((uint24_t)p[1] << 8) | ((uint24_t)p[2] << 16);
+}
+
+static uint16_t read16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static void write24(uint8_t *p, uint24_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+}
+
+void srcmap_reset(void)
+{
+    stream_size = 0;
+    entry_count = 0;
+    end_addr = 0;
+    full = false;
+    max_file = 0;
+}
+
+// Record that code from addr on comes from line of file. Called in address order.
+void srcmap_add(uint24_t addr, uint8_t file, uint16_t line)
+{
+    if (full)
+        return;
+
+    uint24_t addr_delta = addr - last_addr;
+    long line_delta = (long)line - (long)last_line;
+    bool absolute = (entry_count % SRCMAP_BLOCK) == 0 || file != last_file || addr_delta == 0 ||
+                    addr_delta > 0xFF || line_delta < -128 || line_delta > 127;
+    uint8_t need = absolute ? 7 : 2;
+    if (stream_size + need > SRCMAP_STREAM_SIZE ||
+        (entry_count % SRCMAP_BLOCK == 0 && entry_count / SRCMAP_BLOCK >= SRCMAP_MAX_BLOCKS))
+    {
+        // out of room: the map covers everything before this address
+        full = true;
+        end_addr = addr;
+        return;
+    }
+
+    uint8_t *p = stream + stream_size;
+    if (entry_count % SRCMAP_BLOCK == 0)
+    {
+        uint8_t *cp = checkpoints[entry_count / SRCMAP_BLOCK];
+        write24(cp, addr);
+        cp[3] = stream_size & 0xFF;
+        cp[4] = stream_size >> 8;
+    }
+    if (absolute)
+    {
+        p[0] = 0;
+        write24(p + 1, addr);
+        p[4] = file;
+        p[5] = line & 0xFF;
+        p[6] = line >> 8;
+    }
+    else
+    {
+        p[0] = (uint8_t)addr_delta;
+        p[1] = (uint8_t)(int8_t)line_delta;
+    }
+    stream_size += need;
+    entry_count++;
+    if (file > max_file)
+        max_file = file;
+    last_addr = addr;
+    last_file = file;
+    last_line = line;
+}
+
+// First address past the mapped code
+void srcmap_end(uint24_t addr)
+{
+    if (!full)
+        end_addr = addr;
+}
+
+bool srcmap_save(const char *appvar)
+{
+    uint8_t header[SRCMAP_HEADER_SIZE] = {'S', 'M', 'P', 1};
+    uint16_t blocks = (entry_count + SRCMAP_BLOCK - 1) / SRCMAP_BLOCK;
+    uint8_t files = entry_count ? max_file + 1 : 0;
+    write24(header + 4, end_addr);
+    header[7] = files;
+    header[8] = blocks & 0xFF;
+    header[9] = blocks >> 8;
+    header[10] = stream_size & 0xFF;
+    header[11] = stream_size >> 8;
+
+    ti_Delete(appvar);
+    ti_var_t f = ti_Open(appvar, "w");
+    if (!f)
+        return false;
+    ti_Write(header, 1, sizeof(header), f);
+    for (uint16_t i = 0; i < files; i++)
+    {
+        char name[SRCMAP_NAME_LEN];
+        const char *known = diag_file_name((uint8_t)i);
+        memset(name, 0, sizeof(name));
+        if (known)
+            memcpy(name, known, strlen(known) < sizeof(name) ? strlen(known) : sizeof(name));
+        ti_Write(name, 1, sizeof(name), f);
+    }
+    ti_Write(checkpoints, SRCMAP_CHECKPOINT_SIZE, blocks, f);
+    ti_Write(stream, 1, stream_size, f);
+    ti_SetArchiveStatus(true, f);
+    ti_Close(f);
+    return true;
+}
+
+// Find the file and line that produced the code at addr in a map read
+// into memory: binary search over the checkpoints, then decode one block
+bool srcmap_lookup(const uint8_t *map, size_t size, uint24_t addr, uint8_t *file, uint16_t *line)
+{
+    if (size < SRCMAP_HEADER_SIZE || memcmp(map, "SMP", 3) != 0 || map[3] != 1)
+        return false;
+    uint24_t end = read24(map + 4);
+    uint8_t files = map[7];
+    uint16_t blocks = read16(map + 8);
+    uint16_t bytes = read16(map + 10);
+    const uint8_t *cps = map + SRCMAP_HEADER_SIZE + (size_t)files * SRCMAP_NAME_LEN;
+    const uint8_t *entries = cps + (size_t)blocks * SRCMAP_CHECKPOINT_SIZE;
+    if (entries + bytes > map + size || blocks == 0 || addr >= end || addr < read24(cps))
+        return false;
+
+    // last checkpoint at or below addr
+    uint16_t lo = 0;
+    uint16_t hi = blocks - 1;
+    while (lo < hi)
+    {
+        uint16_t mid = (lo + hi + 1) / 2;
+        if (read24(cps + mid * SRCMAP_CHECKPOINT_SIZE) <= addr)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    const uint8_t *cp = cps + lo * SRCMAP_CHECKPOINT_SIZE;
+    uint16_t pos = read16(cp + 3);
+    uint16_t stop = (lo + 1 < blocks) ? read16(cp + SRCMAP_CHECKPOINT_SIZE + 3) : bytes;
+    uint24_t cur_addr = 0;
+    uint8_t cur_file = 0;
+    uint16_t cur_line = 0;
+    bool found = false;
+    while (pos < stop)
+    {
+        uint24_t next_addr;
+        uint8_t next_file = cur_file;
+        uint16_t next_line;
+        if (entries[pos] == 0)
+        {
+            next_addr = read24(entries + pos + 1);
+            next_file = entries[pos + 4];
+            next_line = read16(entries + pos + 5);
+            pos += 7;
+        }
+        else
+        {
+            next_addr = cur_addr + entries[pos];
+            next_line = cur_line + (int8_t)entries[pos + 1];
+            pos += 2;
+        }
+        if (next_addr > addr)
+            break;
+        cur_addr = next_addr;
+        cur_file = next_file;
+        cur_line = next_line;
+        found = true;
+    }
+    if (!found)
+        return false;
+    *file = cur_file;
+    *line = cur_line;
+    return true;
+}
+
+// Copy the name of a file id into out (at least SRCMAP_NAME_LEN + 1 bytes)
+void srcmap_file_name(const uint8_t *map, uint8_t file, char *out)
+{
+    if (file < map[7] && map[SRCMAP_HEADER_SIZE + file * SRCMAP_NAME_LEN])
+    {
+        memcpy(out, map + SRCMAP_HEADER_SIZE + file * SRCMAP_NAME_LEN, SRCMAP_NAME_LEN);
+        out[SRCMAP_NAME_LEN] = '\0';
+    }
+    else
+    {
+        sprintf(out, "#%u", (unsigned)file);
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef SRCMAP_H
+#define SRCMAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __INTELLISENSE__
+typedef unsigned long uint24_t;
+#endif
+
+#define SRCMAP_APPVAR "ASMAP"
+
+#define SRCMAP_HEADER_SIZE 12
+#define SRCMAP_NAME_LEN 8
+#define SRCMAP_CHECKPOINT_SIZE 5
+#define SRCMAP_BLOCK 16         // entries per checkpoint
+#define SRCMAP_MAX_BLOCKS 128
+#define SRCMAP_STREAM_SIZE 4096 // encoded entry bytes
+
+void srcmap_reset(void);
+void srcmap_add(uint24_t addr, uint8_t file, uint16_t line);
+void srcmap_end(uint24_t addr);
+bool srcmap_save(const char *appvar);
+bool srcmap_lookup(const uint8_t *map, size_t size, uint24_t addr, uint8_t *file, uint16_t *line);
+void srcmap_file_name(const uint8_t *map, uint8_t file, char *out);
+
+#endif
@@ -0,0 +1,478 @@
+#include "switch.h"
+#include <string.h>
+
+typedef enum
+{
+    OP_LD_A,     // ld a,r when the switch is not on a
+    OP_CP,       // cp n
+    OP_SUB,      // sub n
+    OP_JP,       // jp [cc,]target
+    OP_JR,       // jr c,here
+    OP_LD_HL0,   // the table lookup: ld hl,0 / ld l,a / ld h,3 / mlt hl /
+    OP_LD_LA,    // ld de,table / add hl,de / ld hl,(hl) / jp (hl)
+    OP_LD_H3,
+    OP_MLT,
+    OP_LD_DE,
+    OP_ADD,
+    OP_LD_HLHL,
+    OP_JP_HL,
+    OP_ENTRY     // 24-bit table entry
+} OpKind;
+
+typedef enum
+{
+    COND_ALWAYS,
+    COND_Z,
+    COND_C,
+    COND_NC
+} Cond;
+
+#define TO_DEFAULT 0xFE // .default, or the end of the dispatch
+#define TO_HERE 0xFF    // an offset in the dispatch
+
+typedef struct
+{
+    uint8_t kind;
+    uint8_t cond;
+    uint8_t value; // of cp/sub
+    uint8_t to;    // label index, TO_DEFAULT or TO_HERE
+    uint16_t at;   // offset in the dispatch
+    uint16_t here; // target offset for TO_HERE
+} Op;
+
+typedef struct
+{
+    uint8_t lo;
+    uint8_t hi;
+    uint8_t label;
+} Range;
+
+static const uint8_t op_size[] = {1, 2, 2, 4, 2, 4, 1, 2, 2, 4, 1, 2, 1, 3};
+// cycles when the op falls through (taken jumps cost one more), as the
+// .assert_cycles estimate counts them: bytes fetched plus bytes accessed
+static const uint8_t op_cycles[] = {1, 2, 2, 4, 2, 4, 1, 2, 2, 4, 1, 5, 2, 0};
+
+static bool is_open = false;
+static uint16_t open_line = 0;
+static uint8_t reg = SWITCH_REG_A;
+static uint8_t case_label[256]; // label index per value, 0xFF if none
+static uint8_t case_count = 0;
+static char labels[SWITCH_MAX_LABELS][SWITCH_LABEL_LEN];
+static uint8_t label_count = 0;
+static uint8_t default_label = 0xFF;
+static Range ranges[SWITCH_MAX_CASES];
+static uint8_t range_count = 0;
+static Op ops[SWITCH_MAX_OPS];
+static uint16_t op_count = 0;
+static uint16_t size = 0;
+static SwitchStrategy strategy = SWITCH_CHAIN;
+static uint16_t worst = 0;
+
+static const char *const strategy_names[] = {"chain", "tree", "table"};
+
+void switch_begin(uint8_t r, uint16_t line)
+{
+    is_open = true;
+    open_line = line;
+    reg = r;
+    memset(case_label, 0xFF, sizeof(case_label));
+    case_count = 0;
+    label_count = 0;
+    default_label = 0xFF;
+}
+
+bool switch_open(void)
+{
+    return is_open;
+}
+
+uint16_t switch_line(void)
+{
+    return open_line;
+}
+
+// Index of label in labels[], added if new; 0xFF when full
+static uint8_t label_slot(const char *label)
+{
+    for (uint8_t i = 0; i < label_count; i++)
+    {
+        if (strcmp(labels[i], label) == 0)
+            return i;
+    }
+    if (label_count >= SWITCH_MAX_LABELS)
+        return 0xFF;
+    strncpy(labels[label_count], label, SWITCH_LABEL_LEN);
+    labels[label_count][SWITCH_LABEL_LEN - 1] = '\0';
+    return label_count++;
+}
+
+// False for a value that already has a case, or past the limits
+bool switch_case(uint8_t value, const char *label)
+{
+    if (case_label[value] != 0xFF || case_count >= SWITCH_MAX_CASES)
+        return false;
+    uint8_t slot = label_slot(label);
+    if (slot == 0xFF)
+        return false;
+    case_label[value] = slot;
+    case_count++;
+    return true;
+}
+
+bool switch_default(const char *label)
+{
+    if (default_label != 0xFF)
+        return false;
+    default_label = label_slot(label);
+    return default_label != 0xFF;
+}
+
+static uint16_t add_op(OpKind kind, Cond cond, uint8_t value, uint8_t to)
+{
+    Op *op = &ops[op_count];
+    op->kind = kind;
+    op->cond = cond;
+    op->value = value;
+    op->to = to;
+    op->at = size;
+    op->here = 0;
+    size += op_size[kind];
+    return op_count++;
+}
+
+// Range checks for ranges[first..last] in turn, then a jump to the default
+static void gen_chain(int16_t first, int16_t last)
+{
+    for (int16_t i = first; i <= last; i++)
+    {
+        const Range *r = &ranges[i];
+        if (r->lo == r->hi)
+        {
+            add_op(OP_CP, COND_ALWAYS, r->lo, 0);
+            add_op(OP_JP, COND_Z, 0, r->label);
+        }
+        else if (r->hi == 0xFF)
+        {
+            add_op(OP_CP, COND_ALWAYS, r->lo, 0);
+            add_op(OP_JP, COND_NC, 0, r->label);
+        }
+        else if (r->lo == 0)
+        {
+            add_op(OP_CP, COND_ALWAYS, r->hi + 1, 0);
+            add_op(OP_JP, COND_C, 0, r->label);
+        }
+        else
+        {
+            add_op(OP_CP, COND_ALWAYS, r->lo, 0);
+            uint16_t skip = add_op(OP_JR, COND_C, 0, TO_HERE);
+            add_op(OP_CP, COND_ALWAYS, r->hi + 1, 0);
+            add_op(OP_JP, COND_C, 0, r->label);
+            ops[skip].here = size;
+        }
+    }
+    add_op(OP_JP, COND_ALWAYS, 0, TO_DEFAULT);
+}
+
+// Binary search over ranges[first..last]: compare with the middle range,
+// the ranges above it follow inline and the ones below are jumped to
+static void gen_tree(int16_t first, int16_t last)
+{
+    if (last - first < 2)
+    {
+        gen_chain(first, last);
+        return;
+    }
+    int16_t mid = (first + last) / 2;
+    const Range *r = &ranges[mid];
+    add_op(OP_CP, COND_ALWAYS, r->lo, 0);
+    uint16_t below = add_op(OP_JP, COND_C, 0, TO_HERE);
+    if (r->lo == r->hi)
+    {
+        add_op(OP_JP, COND_Z, 0, r->label);
+    }
+    else
+    {
+        add_op(OP_CP, COND_ALWAYS, r->hi + 1, 0);
+        add_op(OP_JP, COND_C, 0, r->label);
+    }
+    gen_tree(mid + 1, last);
+    ops[below].here = size;
+    gen_tree(first, mid - 1);
+}
+
+// sub lo / cp span / jp nc,default, then a pointer lookup by the value
+static void gen_table(void)
+{
+    uint8_t lo = ranges[0].lo;
+    uint16_t span = ranges[range_count - 1].hi - lo + 1;
+    if (lo > 0)
+        add_op(OP_SUB, COND_ALWAYS, lo, 0);
+    if (span < 256)
+    {
+        add_op(OP_CP, COND_ALWAYS, (uint8_t)span, 0);
+        add_op(OP_JP, COND_NC, 0, TO_DEFAULT);
+    }
+    add_op(OP_LD_HL0, COND_ALWAYS, 0, 0);
+    add_op(OP_LD_LA, COND_ALWAYS, 0, 0);
+    add_op(OP_LD_H3, COND_ALWAYS, 0, 0);
+    add_op(OP_MLT, COND_ALWAYS, 0, 0);
+    uint16_t base = add_op(OP_LD_DE, COND_ALWAYS, 0, TO_HERE);
+    add_op(OP_ADD, COND_ALWAYS, 0, 0);
+    add_op(OP_LD_HLHL, COND_ALWAYS, 0, 0);
+    add_op(OP_JP_HL, COND_ALWAYS, 0, 0);
+    ops[base].here = size;
+    for (uint16_t v = lo; v < lo + span; v++)
+        add_op(OP_ENTRY, COND_ALWAYS, 0, case_label[v] == 0xFF ? TO_DEFAULT : case_label[v]);
+}
+
+static void generate(SwitchStrategy s)
+{
+    op_count = 0;
+    size = 0;
+    if (reg != SWITCH_REG_A)
+        add_op(OP_LD_A, COND_ALWAYS, 0, 0);
+    if (s == SWITCH_TABLE)
+        gen_table();
+    else if (s == SWITCH_TREE)
+        gen_tree(0, range_count - 1);
+    else
+        gen_chain(0, range_count - 1);
+    // without a .default the last jump would only skip to the next byte
+    if (default_label == 0xFF && op_count > 0 && ops[op_count - 1].kind == OP_JP &&
+        ops[op_count - 1].cond == COND_ALWAYS && ops[op_count - 1].to == TO_DEFAULT)
+    {
+        op_count--;
+        size -= op_size[OP_JP];
+    }
+}
+
+static uint16_t op_index_at(uint16_t offset)
+{
+    for (uint16_t i = 0; i < op_count; i++)
+    {
+        if (ops[i].at == offset)
+            return i;
+    }
+    return op_count;
+}
+
+// Cycles from the start of the dispatch until it jumps away for value
+static uint16_t cycles_for(uint8_t value)
+{
+    uint8_t a = value;
+    bool zero = false, carry = false;
+    uint16_t cycles = 0;
+    uint16_t i = 0;
+    while (i < op_count)
+    {
+        const Op *op = &ops[i];
+        cycles += op_cycles[op->kind];
+        bool taken = false;
+        switch (op->kind)
+        {
+        case OP_CP:
+            zero = a == op->value;
+            carry = a < op->value;
+            break;
+        case OP_SUB:
+            carry = a < op->value;
+            a = (uint8_t)(a - op->value);
+            zero = a == 0;
+            break;
+        case OP_JP:
+        case OP_JR:
+            taken = op->cond == COND_ALWAYS || (op->cond == COND_Z && zero) ||
+                    (op->cond == COND_C && carry) || (op->cond == COND_NC && !carry);
+            break;
+        case OP_JP_HL:
+            return cycles;
+        default:
+            break;
+        }
+        if (!taken)
+        {
+            i++;
+            continue;
+        }
+        cycles++;
+        if (op->to != TO_HERE)
+            return cycles;
+        i = op_index_at(op->here);
+    }
+    return cycles;
+}
+
+static uint16_t worst_case(void)
+{
+    uint16_t most = 0;
+    for (uint16_t v = 0; v < 256; v++)
+    {
+        uint16_t c = cycles_for((uint8_t)v);
+        if (c > most)
+            most = c;
+    }
+    return most;
+}
+
+// Close the switch: split the cases into runs of values with the same
+// label, try each strategy and keep the one with the lowest worst case
+// (then the smallest). Returns its size in bytes.
+uint16_t switch_build(void)
+{
+    is_open = false;
+    range_count = 0;
+    for (uint16_t v = 0; v < 256; v++)
+    {
+        if (case_label[v] == 0xFF)
+            continue;
+        Range *last = range_count ? &ranges[range_count - 1] : NULL;
+        if (last && last->hi + 1 == v && last->label == case_label[v])
+        {
+            last->hi = (uint8_t)v;
+            continue;
+        }
+        ranges[range_count].lo = ranges[range_count].hi = (uint8_t)v;
+        ranges[range_count].label = case_label[v];
+        range_count++;
+    }
+
+    uint16_t best_size = 0;
+    worst = 0xFFFF;
+    strategy = SWITCH_CHAIN;
+    for (uint8_t s = SWITCH_CHAIN; s <= SWITCH_TABLE && range_count > 0; s++)
+    {
+        // a table only pays off when at least half its entries are cases
+        if (s == SWITCH_TABLE && (uint16_t)(ranges[range_count - 1].hi - ranges[0].lo + 1) > 2 * case_count)
+            continue;
+        generate((SwitchStrategy)s);
+        uint16_t w = worst_case();
+        if (w < worst || (w == worst && size < best_size))
+        {
+            worst = w;
+            best_size = size;
+            strategy = (SwitchStrategy)s;
+        }
+    }
+    generate(strategy);
+    if (range_count == 0)
+        worst = worst_case();
+    return size;
+}
+
+uint8_t switch_label_count(void)
+{
+    return label_count;
+}
+
+const char *switch_label(uint8_t index)
+{
+    return labels[index];
+}
+
+uint16_t switch_op_count(void)
+{
+    return op_count;
+}
+
+// Is op a table entry rather than an instruction?
+bool switch_op_is_entry(uint16_t index)
+{
+    return ops[index].kind == OP_ENTRY;
+}
+
+// Bytes of an op for a dispatch at base whose next byte is end. Sets
+// address when the last 3 bytes are an address, and target to where a
+// jump goes (0 if it does not).
+uint8_t switch_encode(uint16_t index, uint24_t base, uint24_t end, const uint24_t *label_addresses,
+                      uint8_t *out, bool *address, uint24_t *target)
+{
+    static const uint8_t jp_opcodes[] = {0xC3, 0xCA, 0xDA, 0xD2};
+    const Op *op = &ops[index];
+    uint24_t to = 0;
+    if (op->to == TO_HERE)
+        to = base + op->here;
+    else if (op->to == TO_DEFAULT)
+        to = default_label == 0xFF ? end : label_addresses[default_label];
+    else
+        to = label_addresses[op->to];
+
+    *address = false;
+    *target = 0;
+    uint8_t n = 0;
+    switch (op->kind)
+    {
+    case OP_LD_A:
+        out[n++] = 0x78 | reg;
+        break;
+    case OP_CP:
+        out[n++] = 0xFE;
+        out[n++] = op->value;
+        break;
+    case OP_SUB:
+        out[n++] = 0xD6;
+        out[n++] = op->value;
+        break;
+    case OP_JR:
+        out[n++] = 0x38;
+        out[n++] = (uint8_t)(op->here - (op->at + 2));
+        *target = to;
+        break;
+    case OP_LD_HL0:
+        out[n++] = 0x21;
+        out[n++] = 0;
+        out[n++] = 0;
+        out[n++] = 0;
+        break;
+    case OP_LD_LA:
+        out[n++] = 0x6F;
+        break;
+    case OP_LD_H3:
+        out[n++] = 0x26;
+        out[n++] = 3;
+        break;
+    case OP_MLT:
+        out[n++] = 0xED;
+        out[n++] = 0x6C;
+        break;
+    case OP_ADD:
+        out[n++] = 0x19;
+        break;
+    case OP_LD_HLHL:
+        out[n++] = 0xED;
+        out[n++] = 0x27;
+        break;
+    case OP_JP_HL:
+        out[n++] = 0xE9;
+        break;
+    case OP_JP:
+    case OP_LD_DE:
+    case OP_ENTRY:
+        if (op->kind == OP_JP)
+            out[n++] = jp_opcodes[op->cond];
+        else if (op->kind == OP_LD_DE)
+            out[n++] = 0x11;
+        out[n++] = (uint8_t)to;
+        out[n++] = (uint8_t)(to >> 8);
+        out[n++] = (uint8_t)(to >> 16);
+        *address = true;
+        if (op->kind == OP_JP)
+            *target = to;
+        break;
+    }
+    return n;
+}
+
+SwitchStrategy switch_strategy(void)
+{
+    return strategy;
+}
+
+const char *switch_strategy_name(void)
+{
+    return strategy_names[strategy];
+}
+
+uint16_t switch_worst(void)
+{
+    return worst;
+}
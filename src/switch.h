@@ -0,0 +1,46 @@
+#ifndef SWITCH_H
+#define SWITCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __INTELLISENSE__
+typedef unsigned long uint24_t;
+#endif
+
+// Byte dispatch (.switch reg / .case value, label / .endswitch). The
+// cases are collected up to .endswitch, which emits whichever of three
+// strategies has the lowest worst case: a compare chain (one range check
+// per run of values with the same label), a binary compare tree, or a
+// table of 24-bit pointers indexed by the value.
+#define SWITCH_MAX_CASES 64    // values per switch
+#define SWITCH_MAX_LABELS 16   // distinct case labels, .default included
+#define SWITCH_MAX_OPS 320     // emitted instructions and table entries
+#define SWITCH_LABEL_LEN 16
+#define SWITCH_REG_A 7         // register codes as in ld r,r': b=0 .. l=5, a=7
+
+typedef enum
+{
+    SWITCH_CHAIN,
+    SWITCH_TREE,
+    SWITCH_TABLE
+} SwitchStrategy;
+
+void switch_begin(uint8_t reg, uint16_t line);
+bool switch_open(void);
+uint16_t switch_line(void);
+bool switch_case(uint8_t value, const char *label);
+bool switch_default(const char *label);
+uint16_t switch_build(void);
+
+uint8_t switch_label_count(void);
+const char *switch_label(uint8_t index);
+uint16_t switch_op_count(void);
+bool switch_op_is_entry(uint16_t op);
+uint8_t switch_encode(uint16_t op, uint24_t base, uint24_t end, const uint24_t *label_addresses,
+                      uint8_t *out, bool *address, uint24_t *target);
+SwitchStrategy switch_strategy(void);
+const char *switch_strategy_name(void);
+uint16_t switch_worst(void);
+
+#endif
@@ -0,0 +1,129 @@
+#include "symmap.h"
+#include <fileioc.h>
+#include <string.h>
+#include <stdio.h>
+
+// Symbol map AppVar layout, little-endian:
+//   "SYM", version 1, symbol count (16), name pool size (16)
+//   entries sorted by address: address (24), offset of the name in the pool (16)
+//   name pool: NUL-terminated names
+typedef struct
+{
+    uint24_t addr;
+    uint16_t name;
+} SymbolEntry;
+
+static SymbolEntry symbols[SYMMAP_MAX_SYMBOLS];
+static uint8_t symbol_count = 0;
+static char pool[SYMMAP_POOL_SIZE];
+static uint16_t pool_size = 0;
+
+static uint24_t read24(const uint8_t *p)
+{
+    return p[0] | ((uint24_t)p[1] << 8) | ((uint24_t)p[2] << 16);
+}
+
+void symmap_reset(void)
+{
+    symbol_count = 0;
+    pool_size = 0;
+}
+
+// Add a symbol, kept in address order; equal addresses keep insertion order
+bool symmap_add(const char *name, uint24_t addr)
+{
+    size_t len = strlen(name) + 1;
+    if (symbol_count >= SYMMAP_MAX_SYMBOLS || pool_size + len > SYMMAP_POOL_SIZE)
+        return false;
+    memcpy(pool + pool_size, name, len);
+
+    uint8_t i = symbol_count;
+    while (i > 0 && symbols[i - 1].addr > addr)
+    {
+        symbols[i] = symbols[i - 1];
+        i--;
+    }
+    symbols[i].addr = addr;
+    symbols[i].name = pool_size;
+    symbol_count++;
+    pool_size += len;
+    return true;
+}
+
+bool symmap_save(const char *appvar)
+{
+    uint8_t header[SYMMAP_HEADER_SIZE] = {'S', 'Y', 'M', 1};
+    header[4] = symbol_count;
+    header[5] = 0;
+    header[6] = pool_size & 0xFF;
+    header[7] = pool_size >> 8;
+
+    ti_Delete(appvar);
+    ti_var_t f = ti_Open(appvar, "w");
+    if (!f)
+        return false;
+    ti_Write(header, 1, sizeof(header), f);
+    for (uint8_t i = 0; i < symbol_count; i++)
+    {
+        uint8_t entry[SYMMAP_ENTRY_SIZE];
+        entry[0] = symbols[i].addr & 0xFF;
+        entry[1] = (symbols[i].addr >> 8) & 0xFF;
+        entry[2] = (symbols[i].addr >> 16) & 0xFF;
+        entry[3] = symbols[i].name & 0xFF;
+        entry[4] = symbols[i].name >> 8;
+        ti_Write(entry, 1, sizeof(entry), f);
+    }
+    ti_Write(pool, 1, pool_size, f);
+    ti_SetArchiveStatus(true, f);
+    ti_Close(f);
+    return true;
+}
+
+// Readable form, one "ADDRESS NAME" line per symbol in address order
+bool symmap_save_text(const char *path)
+{
+    ti_Delete(path);
+    ti_var_t f = ti_Open(path, "w");
+    if (!f)
+        return false;
+    for (uint8_t i = 0; i < symbol_count; i++)
+    {
+        char line[32];
+        snprintf(line, sizeof(line), "%06lX %s\n", (unsigned long)symbols[i].addr, pool + symbols[i].name);
+        ti_Write(line, 1, strlen(line), f);
+    }
+    ti_Close(f);
+    return true;
+}
+
+// Find the symbol at or below addr in a map read into memory. name points
+// into the map; offset is how far past the symbol addr lies.
+bool symmap_lookup(const uint8_t *map, size_t size, uint24_t addr, const char **name, uint24_t *offset)
+{
+    if (size < SYMMAP_HEADER_SIZE || memcmp(map, "SYM", 3) != 0 || map[3] != 1)
+        return false;
+    uint16_t count = map[4] | (map[5] << 8);
+    uint16_t pool_bytes = map[6] | (map[7] << 8);
+    const uint8_t *entries = map + SYMMAP_HEADER_SIZE;
+    const char *names = (const char *)entries + (size_t)count * SYMMAP_ENTRY_SIZE;
+    if ((const uint8_t *)names + pool_bytes > map + size || count == 0 || addr < read24(entries))
+        return false;
+
+    uint16_t lo = 0;
+    uint16_t hi = count - 1;
+    while (lo < hi)
+    {
+        uint16_t mid = (lo + hi + 1) / 2;
+        if (read24(entries + mid * SYMMAP_ENTRY_SIZE) <= addr)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    const uint8_t *e = entries + lo * SYMMAP_ENTRY_SIZE;
+    uint16_t name_offset = e[3] | (e[4] << 8);
+    if (name_offset >= pool_bytes)
+        return false;
+    *name = names + name_offset;
+    *offset = addr - read24(e);
+    return true;
+}
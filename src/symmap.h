@@ -0,0 +1,25 @@
+#ifndef SYMMAP_H
+#define SYMMAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __INTELLISENSE__
+typedef unsigned long uint24_t;
+#endif
+
+#define SYMMAP_APPVAR "ASYM"
+
+#define SYMMAP_HEADER_SIZE 8
+#define SYMMAP_ENTRY_SIZE 5 // address (24), name pool offset (16)
+#define SYMMAP_MAX_SYMBOLS 64
+#define SYMMAP_POOL_SIZE 1024
+
+void symmap_reset(void);
+bool symmap_add(const char *name, uint24_t addr);
+bool symmap_save(const char *appvar);
+bool symmap_save_text(const char *path);
+bool symmap_lookup(const uint8_t *map, size_t size, uint24_t addr, const char **name, uint24_t *offset);
+
+#endif
@@ -0,0 +1,97 @@
+#include "tables.h"
+#include <string.h>
+#include <math.h>
+
+#define TWO_PI 6.28318530718f
+
+TableKind table_kind(const char *name)
+{
+    if (strcasecmp(name, "sin") == 0)
+        return TABLE_SIN;
+    if (strcasecmp(name, "cos") == 0)
+        return TABLE_COS;
+    if (strcasecmp(name, "recip") == 0)
+        return TABLE_RECIP;
+    if (strcasecmp(name, "bitrev8") == 0)
+        return TABLE_BITREV8;
+    return TABLE_NONE;
+}
+
+// Smallest little-endian entry (1, 2 or 3 bytes) that holds the table's range
+uint8_t table_entry_size(TableKind kind, unsigned long param)
+{
+    switch (kind)
+    {
+    case TABLE_SIN:
+    case TABLE_COS:
+        // signed range -param..param
+        if (param <= 0x7F)
+            return 1;
+        if (param <= 0x7FFF)
+            return 2;
+        return 3;
+    case TABLE_RECIP:
+        if (param <= 0xFF)
+            return 1;
+        if (param <= 0xFFFF)
+            return 2;
+        return 3;
+    default:
+        return 1;
+    }
+}
+
+// Size in bytes, computed without generating so pass 1 stays cheap
+size_t table_size(TableKind kind, unsigned long count, unsigned long param)
+{
+    if (kind == TABLE_BITREV8)
+        return 256;
+    return (size_t)count * table_entry_size(kind, param);
+}
+
+static uint8_t *put_entry(uint8_t *out, unsigned long value, uint8_t size)
+{
+    *out++ = value & 0xFF;
+    if (size > 1)
+        *out++ = (value >> 8) & 0xFF;
+    if (size > 2)
+        *out++ = (value >> 16) & 0xFF;
+    return out;
+}
+
+// Fill out[] with table_size() bytes
+void table_generate(TableKind kind, unsigned long count, unsigned long param, uint8_t *out)
+{
+    uint8_t size = table_entry_size(kind, param);
+
+    if (kind == TABLE_BITREV8)
+    {
+        for (uint16_t i = 0; i < 256; i++)
+        {
+            uint8_t b = (uint8_t)i;
+            b = (uint8_t)((b & 0xF0) >> 4 | (b & 0x0F) << 4);
+            b = (uint8_t)((b & 0xCC) >> 2 | (b & 0x33) << 2);
+            b = (uint8_t)((b & 0xAA) >> 1 | (b & 0x55) << 1);
+            out[i] = b;
+        }
+        return;
+    }
+
+    for (unsigned long i = 0; i < count; i++)
+    {
+        long value;
+        if (kind == TABLE_RECIP)
+        {
+            unsigned long max = (size == 1) ? 0xFF : (size == 2) ? 0xFFFF : 0xFFFFFF;
+            value = (long)(i ? param / i : max);
+        }
+        else
+        {
+            float angle = TWO_PI * (float)i / (float)count;
+            float s = (kind == TABLE_SIN) ? sinf(angle) : cosf(angle);
+            value = lroundf(s * (float)param);
+        }
+        // negative values wrap to two's complement at the entry width
+        out = put_entry(out, (unsigned long)value, size);
+    }
+}
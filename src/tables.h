@@ -0,0 +1,20 @@
+#ifndef TABLES_H
+#define TABLES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+    TABLE_NONE,
+    TABLE_SIN,    // .table sin, count, amplitude   (signed, one full period)
+    TABLE_COS,    // .table cos, count, amplitude
+    TABLE_RECIP,  // .table recip, count, scale     (scale / i, entry 0 saturates)
+    TABLE_BITREV8 // .table bitrev8                 (256 bytes)
+} TableKind;
+
+TableKind table_kind(const char *name);
+uint8_t table_entry_size(TableKind kind, unsigned long param);
+size_t table_size(TableKind kind, unsigned long count, unsigned long param);
+void table_generate(TableKind kind, unsigned long count, unsigned long param, uint8_t *out);
+
+#endif
@@ -0,0 +1,528 @@
+#include "timing.h"
+#include "console.h"
+#include "diag.h"
+#include <string.h>
+#include <stdio.h>
+
+// How control leaves an instruction
+typedef enum
+{
+    FLOW_NEXT,    // on to the next instruction
+    FLOW_JUMP,    // jp/jr to target
+    FLOW_BRANCH,  // jp cc/jr cc/djnz: target or next
+    FLOW_CALL,    // call/rst, then next
+    FLOW_CALL_IF, // call cc
+    FLOW_RET,     // ret/reti/retn: leaves the routine
+    FLOW_RET_IF,  // ret cc
+    FLOW_REPEAT   // ldir and friends: repeats itself, then next
+} Flow;
+
+typedef struct
+{
+    uint24_t address;
+    uint24_t target; // of a jump, branch or call
+    uint16_t trips;  // .trips before a loop branch or repeat, 0 if none
+    uint8_t length;
+    uint8_t fall;  // cycles when execution goes on to the next instruction
+    uint8_t taken; // cycles when the jump, call or return is taken; per round for a repeat
+    uint8_t flow;
+} TimingNode;
+
+typedef struct
+{
+    uint24_t address;
+    uint16_t first; // its first node
+} TimingRoutine;
+
+typedef struct
+{
+    char name[TIMING_NAME_LEN];
+    uint24_t address;
+    unsigned long max;
+    uint8_t file;
+    uint16_t line;
+} TimingAssert;
+
+static TimingNode nodes[TIMING_MAX_NODES];
+static uint16_t node_count = 0;
+static bool nodes_full = false;
+static TimingRoutine routines[TIMING_MAX_ROUTINES];
+static uint8_t routine_count = 0;
+static TimingAssert asserts[TIMING_MAX_ASSERTS];
+static uint8_t assert_count = 0;
+static bool wanted = false;
+
+// Per routine results, filled callees first
+static unsigned long routine_best[TIMING_MAX_ROUTINES];
+static unsigned long routine_worst[TIMING_MAX_ROUTINES];
+static uint8_t routine_state[TIMING_MAX_ROUTINES]; // 0 not done, 1 in progress, 2 done
+
+// Walk state of the routine being analyzed
+static unsigned long dist_best[TIMING_MAX_NODES];
+static unsigned long dist_worst[TIMING_MAX_NODES];
+static unsigned long mult_best[TIMING_MAX_NODES];
+static unsigned long mult_worst[TIMING_MAX_NODES];
+static bool reached[TIMING_MAX_NODES];
+static unsigned long exit_best;
+static unsigned long exit_worst;
+static bool exits;
+
+// Forget everything, before pass 1
+void timing_reset(void)
+{
+    wanted = false;
+    timing_start();
+}
+
+// Pass 1 saw an .assert_cycles, so pass 2 has to record instructions
+void timing_want(void)
+{
+    wanted = true;
+}
+
+bool timing_wanted(void)
+{
+    return wanted;
+}
+
+// Before pass 2
+void timing_start(void)
+{
+    node_count = 0;
+    nodes_full = false;
+    routine_count = 0;
+    assert_count = 0;
+}
+
+// A global label: the instructions from here on belong to a new routine
+void timing_routine(uint24_t address)
+{
+    if (routine_count >= TIMING_MAX_ROUTINES)
+    {
+        nodes_full = true;
+        return;
+    }
+    routines[routine_count].address = address;
+    routines[routine_count].first = node_count;
+    routine_count++;
+}
+
+static bool is_word(const char *mnemonic, const char *word)
+{
+    size_t n = strlen(word);
+    return strncasecmp(mnemonic, word, n) == 0 && (mnemonic[n] == ' ' || mnemonic[n] == '\0');
+}
+
+static bool is_pair(const char *s, size_t n)
+{
+    static const char *const pairs[] = {"bc", "de", "hl", "ix", "iy", "sp"};
+    for (uint8_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++)
+    {
+        if (n == 2 && strncasecmp(s, pairs[i], 2) == 0)
+            return true;
+    }
+    return false;
+}
+
+// Bytes an instruction reads or writes in memory besides fetching itself
+static uint8_t data_bytes(const char *mnemonic, bool wide)
+{
+    uint8_t pair = wide ? 3 : 2;
+    const char *operands = strchr(mnemonic, ' ');
+    if (is_word(mnemonic, "push") || is_word(mnemonic, "pop"))
+        return pair;
+    if (is_word(mnemonic, "ex") && operands && strstr(operands, "(sp)"))
+        return 2 * pair;
+    if (is_word(mnemonic, "ldi") || is_word(mnemonic, "ldd") || is_word(mnemonic, "ldir") ||
+        is_word(mnemonic, "lddr"))
+        return 2;
+    if (is_word(mnemonic, "cpi") || is_word(mnemonic, "cpd") || is_word(mnemonic, "cpir") ||
+        is_word(mnemonic, "cpdr"))
+        return 1;
+    if (!operands || !strchr(operands, '(') || strstr(operands, "(c)") || strstr(operands, "(n"))
+        return strchr(mnemonic, '(') && (is_word(mnemonic, "in") || is_word(mnemonic, "out")) ? 1 : 0;
+
+    // read-modify-write of a memory byte
+    static const char *const rmw[] = {"inc", "dec", "rlc", "rrc", "rl", "rr", "sla", "sra", "srl", "set", "res"};
+    for (uint8_t i = 0; i < sizeof(rmw) / sizeof(rmw[0]); i++)
+    {
+        if (is_word(mnemonic, rmw[i]))
+            return 2;
+    }
+    // a register pair on the other side moves a whole word
+    for (const char *p = operands + 1; *p;)
+    {
+        size_t n = strcspn(p, ",");
+        if (*p != '(' && is_pair(p, n))
+            return pair;
+        p += n;
+        if (*p == ',')
+            p++;
+    }
+    return 1;
+}
+
+// Control flow of an entry, from its mnemonic
+static Flow flow_of(const char *mnemonic)
+{
+    bool cond = strchr(mnemonic, ',') != NULL;
+    if (is_word(mnemonic, "jp") || is_word(mnemonic, "jr"))
+        return cond ? FLOW_BRANCH : FLOW_JUMP;
+    if (is_word(mnemonic, "djnz"))
+        return FLOW_BRANCH;
+    if (is_word(mnemonic, "call"))
+        return cond ? FLOW_CALL_IF : FLOW_CALL;
+    if (is_word(mnemonic, "rst"))
+        return FLOW_CALL;
+    if (is_word(mnemonic, "ret"))
+        return strchr(mnemonic, ' ') ? FLOW_RET_IF : FLOW_RET;
+    if (is_word(mnemonic, "reti") || is_word(mnemonic, "retn"))
+        return FLOW_RET;
+    static const char *const repeats[] = {"ldir", "lddr", "cpir", "cpdr", "inir", "indr", "otir", "otdr"};
+    for (uint8_t i = 0; i < sizeof(repeats) / sizeof(repeats[0]); i++)
+    {
+        if (is_word(mnemonic, repeats[i]))
+            return FLOW_REPEAT;
+    }
+    return FLOW_NEXT;
+}
+
+// Record an instruction emitted in pass 2. Costs are eZ80 cycles with no
+// wait states: one per byte fetched and per data byte moved, one more to
+// refill the pipeline after a taken jump, two more for a return.
+void timing_add(uint24_t address, uint8_t length, const Instruction *inst, bool wide, uint24_t target, uint16_t trips)
+{
+    if (node_count >= TIMING_MAX_NODES)
+    {
+        nodes_full = true;
+        return;
+    }
+    TimingNode *n = &nodes[node_count++];
+    const char *m = inst->mnemonic;
+    uint8_t data = data_bytes(m, wide);
+    uint8_t pair = wide ? 3 : 2;
+    n->address = address;
+    n->target = target;
+    n->trips = trips;
+    n->length = length;
+    n->flow = flow_of(m);
+    n->fall = length + data;
+    n->taken = n->fall;
+    switch (n->flow)
+    {
+    case FLOW_JUMP:
+        n->fall = n->taken = length + 1;
+        break;
+    case FLOW_BRANCH:
+        n->taken = length + 1;
+        break;
+    case FLOW_CALL:
+        n->fall = n->taken = length + pair;
+        if (is_word(m, "rst"))
+            n->target = inst->opcode[0] & 0x38;
+        break;
+    case FLOW_CALL_IF:
+        n->fall = length;
+        n->taken = length + pair;
+        break;
+    case FLOW_RET:
+        n->fall = n->taken = length + pair + 2;
+        break;
+    case FLOW_RET_IF:
+        n->fall = length + 1;
+        n->taken = length + pair + 2;
+        break;
+    case FLOW_REPEAT:
+        n->fall = length;
+        n->taken = data + 1;
+        break;
+    default:
+        break;
+    }
+}
+
+// Note an .assert_cycles for the routine at address
+bool timing_expect(const char *name, uint24_t address, unsigned long max, uint8_t file, uint16_t line)
+{
+    if (assert_count >= TIMING_MAX_ASSERTS)
+        return false;
+    TimingAssert *a = &asserts[assert_count++];
+    strncpy(a->name, name, TIMING_NAME_LEN);
+    a->name[TIMING_NAME_LEN - 1] = '\0';
+    a->address = address;
+    a->max = max;
+    a->file = file;
+    a->line = line;
+    return true;
+}
+
+static unsigned long sat_add(unsigned long a, unsigned long b)
+{
+    return (a == TIMING_UNBOUNDED || b == TIMING_UNBOUNDED || a + b < a) ? TIMING_UNBOUNDED : a + b;
+}
+
+static unsigned long sat_mul(unsigned long a, unsigned long b)
+{
+    if (a == 0 || b == 0)
+        return 0;
+    if (a == TIMING_UNBOUNDED || b == TIMING_UNBOUNDED || a > TIMING_UNBOUNDED / b)
+        return TIMING_UNBOUNDED;
+    return a * b;
+}
+
+static int8_t routine_at(uint24_t address)
+{
+    for (uint8_t r = 0; r < routine_count; r++)
+    {
+        if (routines[r].address == address)
+            return (int8_t)r;
+    }
+    return -1;
+}
+
+static uint16_t routine_end(uint8_t r)
+{
+    return r + 1 < routine_count ? routines[r + 1].first : node_count;
+}
+
+// Node of routine nodes [first, end) at address, or end
+static uint16_t node_at(uint16_t first, uint16_t end, uint24_t address)
+{
+    for (uint16_t i = first; i < end; i++)
+    {
+        if (nodes[i].address == address)
+            return i;
+    }
+    return end;
+}
+
+static void analyze(uint8_t r);
+
+// Cycles a call or tail jump to target adds: the callee's, or nothing for
+// code outside the program (the OS)
+static void callee_cycles(uint24_t target, unsigned long *best, unsigned long *worst)
+{
+    int8_t callee = routine_at(target);
+    *best = 0;
+    *worst = 0;
+    if (callee < 0)
+        return;
+    analyze((uint8_t)callee);
+    *best = routine_best[callee];
+    *worst = routine_worst[callee];
+}
+
+// Relax the walk into node j
+static void reach(uint16_t j, unsigned long best, unsigned long worst)
+{
+    if (!reached[j] || best < dist_best[j])
+        dist_best[j] = best;
+    if (!reached[j] || worst > dist_worst[j])
+        dist_worst[j] = worst;
+    reached[j] = true;
+}
+
+// A way out of the routine, after best and worst cycles
+static void leave(unsigned long best, unsigned long worst)
+{
+    if (best < exit_best)
+        exit_best = best;
+    if (worst > exit_worst)
+        exit_worst = worst;
+    exits = true;
+}
+
+// Best and worst case of routine r, from its entry to every way out. Nodes
+// inside a loop count once per trip; a loop without .trips makes the worst
+// case unbounded and counts once for the best.
+static void analyze(uint8_t r)
+{
+    if (routine_state[r] == 2)
+        return;
+    if (routine_state[r] == 1)
+    {
+        // recursion
+        routine_best[r] = 0;
+        routine_worst[r] = TIMING_UNBOUNDED;
+        return;
+    }
+    routine_state[r] = 1;
+    uint16_t first = routines[r].first;
+    uint16_t end = routine_end(r);
+
+    // callees first, since the walk below reuses the shared arrays
+    for (uint16_t i = first; i < end; i++)
+    {
+        Flow flow = (Flow)nodes[i].flow;
+        if (flow == FLOW_CALL || flow == FLOW_CALL_IF ||
+            ((flow == FLOW_JUMP || flow == FLOW_BRANCH) && node_at(first, end, nodes[i].target) == end))
+        {
+            int8_t callee = routine_at(nodes[i].target);
+            if (callee >= 0)
+                analyze((uint8_t)callee);
+        }
+    }
+
+    for (uint16_t i = first; i < end; i++)
+    {
+        mult_best[i] = 1;
+        mult_worst[i] = 1;
+        reached[i] = false;
+    }
+    // a branch back to target repeats the nodes from target up to itself
+    for (uint16_t b = first; b < end; b++)
+    {
+        const TimingNode *n = &nodes[b];
+        if ((n->flow != FLOW_JUMP && n->flow != FLOW_BRANCH) || n->target > n->address)
+            continue;
+        uint16_t t = node_at(first, end, n->target);
+        if (t == end)
+            continue;
+        unsigned long trips = n->trips ? n->trips : TIMING_UNBOUNDED;
+        for (uint16_t i = t; i < b; i++)
+        {
+            mult_worst[i] = sat_mul(mult_worst[i], trips);
+            if (n->trips)
+                mult_best[i] = sat_mul(mult_best[i], trips);
+        }
+    }
+
+    exit_best = TIMING_UNBOUNDED;
+    exit_worst = 0;
+    exits = false;
+    if (first < end)
+        reach(first, 0, 0);
+    for (uint16_t i = first; i < end; i++)
+    {
+        if (!reached[i])
+            continue;
+        const TimingNode *n = &nodes[i];
+        unsigned long fall_best = n->fall;
+        unsigned long fall_worst = n->fall;
+        unsigned long taken_best = n->taken;
+        unsigned long taken_worst = n->taken;
+        bool has_next = true;
+        bool back = (n->flow == FLOW_JUMP || n->flow == FLOW_BRANCH) && n->target <= n->address &&
+                    node_at(first, end, n->target) != end;
+        int8_t taken_to = -1; // -1 no taken edge, 0 leaves the routine, 1 to node target
+        uint16_t target = end;
+
+        switch (n->flow)
+        {
+        case FLOW_JUMP:
+        case FLOW_BRANCH:
+            has_next = n->flow == FLOW_BRANCH;
+            if (back)
+            {
+                // taken trips - 1 times, then falls through
+                unsigned long rounds = n->trips ? n->trips - 1UL : TIMING_UNBOUNDED;
+                fall_worst = sat_add(sat_mul(rounds, n->taken), n->fall);
+                if (n->trips)
+                    fall_best = fall_worst;
+                break;
+            }
+            target = node_at(first, end, n->target);
+            taken_to = target < end ? 1 : 0;
+            if (!taken_to)
+            {
+                // tail jump: the target routine runs and returns for us
+                unsigned long b, w;
+                callee_cycles(n->target, &b, &w);
+                taken_best = sat_add(taken_best, b);
+                taken_worst = sat_add(taken_worst, w);
+            }
+            break;
+        case FLOW_CALL:
+        case FLOW_CALL_IF:
+        {
+            unsigned long b, w;
+            callee_cycles(n->target, &b, &w);
+            if (n->flow == FLOW_CALL)
+                fall_best = sat_add(n->taken, b);
+            fall_worst = sat_add(n->taken, w);
+            break;
+        }
+        case FLOW_RET:
+            has_next = false;
+            taken_to = 0;
+            break;
+        case FLOW_RET_IF:
+            taken_to = 0;
+            break;
+        case FLOW_REPEAT:
+            fall_best = n->fall + n->taken * (n->trips ? n->trips : 1);
+            fall_worst = n->trips ? fall_best : TIMING_UNBOUNDED;
+            break;
+        default:
+            break;
+        }
+
+        fall_best = sat_mul(fall_best, mult_best[i]);
+        fall_worst = sat_mul(fall_worst, mult_worst[i]);
+        taken_best = sat_mul(taken_best, mult_best[i]);
+        taken_worst = sat_mul(taken_worst, mult_worst[i]);
+
+        // on to the next node; running off the routine or into data leaves it
+        if (has_next)
+        {
+            if (i + 1 < end && nodes[i + 1].address == n->address + n->length)
+                reach(i + 1, sat_add(dist_best[i], fall_best), sat_add(dist_worst[i], fall_worst));
+            else
+                leave(sat_add(dist_best[i], fall_best), sat_add(dist_worst[i], fall_worst));
+        }
+        if (taken_to == 1)
+            reach(target, sat_add(dist_best[i], taken_best), sat_add(dist_worst[i], taken_worst));
+        else if (taken_to == 0)
+            leave(sat_add(dist_best[i], taken_best), sat_add(dist_worst[i], taken_worst));
+    }
+    routine_best[r] = exits ? exit_best : TIMING_UNBOUNDED;
+    routine_worst[r] = exits ? exit_worst : TIMING_UNBOUNDED;
+    routine_state[r] = 2;
+}
+
+static void print_cycles(char *buf, size_t size, unsigned long value)
+{
+    if (value == TIMING_UNBOUNDED)
+        snprintf(buf, size, "?");
+    else
+        snprintf(buf, size, "%lu", value);
+}
+
+// After pass 2: print each asserted routine's best and worst case and
+// report those over budget, unbounded, or not recorded
+bool timing_check(void)
+{
+    bool ok = true;
+    memset(routine_state, 0, sizeof(routine_state));
+    for (uint8_t a = 0; a < assert_count; a++)
+    {
+        const TimingAssert *as = &asserts[a];
+        int8_t r = routine_at(as->address);
+        if (nodes_full || r < 0)
+        {
+            diag_error(DIAG_TIMING_FULL, as->file, as->line, 0);
+            ok = false;
+            continue;
+        }
+        analyze((uint8_t)r);
+
+        char best[12], worst[12], buf[40];
+        print_cycles(best, sizeof(best), routine_best[r]);
+        print_cycles(worst, sizeof(worst), routine_worst[r]);
+        snprintf(buf, sizeof(buf), "%s %s-%s cyc", as->name, best, worst);
+        console_print(buf);
+        console_newline();
+
+        if (routine_worst[r] == TIMING_UNBOUNDED)
+        {
+            diag_error(DIAG_UNBOUNDED, as->file, as->line, 0);
+            ok = false;
+        }
+        else if (routine_worst[r] > as->max)
+        {
+            diag_error(DIAG_CYCLES, as->file, as->line, 0);
+            ok = false;
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,32 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "opcodes.h"
+
+#ifdef __INTELLISENSE__
+typedef unsigned long uint24_t;
+#endif
+
+// Static timing (.assert_cycles): pass 2 records every instruction with
+// its cycle cost and branch target, then each asserted routine's control
+// flow graph is walked for its best and worst case. Loops need a .trips
+// count for a worst case.
+#define TIMING_MAX_NODES 512   // instructions recorded per build
+#define TIMING_MAX_ROUTINES 64 // global labels, as many as there can be
+#define TIMING_MAX_ASSERTS 8
+#define TIMING_NAME_LEN 16
+
+#define TIMING_UNBOUNDED 0xFFFFFFFFUL
+
+void timing_reset(void);
+void timing_want(void);
+bool timing_wanted(void);
+void timing_start(void);
+void timing_routine(uint24_t address);
+void timing_add(uint24_t address, uint8_t length, const Instruction *inst, bool wide, uint24_t target, uint16_t trips);
+bool timing_expect(const char *name, uint24_t address, unsigned long max, uint8_t file, uint16_t line);
+bool timing_check(void);
+
+#endif